@@ -12,6 +12,8 @@
  *-------------------------------*/
 #define CHRONOS_SUCCESS         0
 #define CHRONOS_FAIL            1
+#define CHRONOS_TIMEOUT         2
+#define CHRONOS_AGAIN           3
 
 #define CHRONOS_MIN_DATA_ITEMS_PER_XACT   50
 #define CHRONOS_MAX_DATA_ITEMS_PER_XACT   100
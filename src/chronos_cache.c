@@ -1,45 +1,22 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <assert.h>
 #include <benchmark.h>
 #include "chronos.h"
+#include "include/chronos_transactions.h"
 #include "include/chronos_cache.h"
 
-#define CHRONOS_CLIENT_NUM_STOCKS     (3000)
 #define CHRONOS_CLIENT_NUM_USERS      (50)
 
 #define MAXLINE   1024
 
-/*--------------------------------------------------
- * Information for each symbol a user is interested in.
- *------------------------------------------------*/
-typedef struct chronosClientStockInfo_t
-{
-  int            symbolId;
-  const char    *symbol;
-  int            random_amount;
-  float          random_price;
-} chronosClientStockInfo_t;
-
-/*--------------------------------------------------
- * A user's portfolio information.
- * A user is interested in k stock symbols.
- *------------------------------------------------*/
-typedef struct chronosClientPortfolios_t 
-{
-  int         userId;
-
-  /* Which user is this? */
-  const char *user;
-
-  /* How many symbols the user is interested in */
-  int   numSymbols;
-
-  /* Information for each of the k stocks managed by a user */
-  chronosClientStockInfo_t  stockInfoArr[CHRONOS_CLIENT_MAX_SYMBOLS_PER_PORTFOLIO];
-} chronosClientPortfolios_t;
-
 #define CHRONOS_CLIENT_CACHE_MAGIC   (0xDEAD)
 #define CHRONOS_CLIENT_CACHE_MAGIC_CHECK(cacheP)    assert((cacheP)->magic == CHRONOS_CLIENT_CACHE_MAGIC)
 #define CHRONOS_CLIENT_CACHE_MAGIC_SET(cacheP)      (cacheP)->magic = CHRONOS_CLIENT_CACHE_MAGIC
@@ -49,18 +26,50 @@ typedef struct chronosClientPortfolios_t
  * A client cache contains a number of portfolios and
  * each portfolio contains stock information about a 
  * number of stocks.
+ *
+ * The portfolios are stored as parallel arrays sized
+ * to the actual number of portfolios and symbols. The
+ * symbols of portfolio i are the entries 
+ * [symbolStartArr[i], symbolStartArr[i+1]) of the
+ * per-symbol arrays. Names are not copied: they are
+ * read from the chronos cache by id.
  *------------------------------------------------*/
 typedef struct chronosClientCache_t 
 {
   int                     magic;
   int                     numPortfolios;
 
-  /*List of portfolios handled by this client thread:
-   * we have one entry in the array per each managed user
-   */
-  chronosClientPortfolios_t portfoliosArr[CHRONOS_CLIENT_MAX_PORTFOLIOS_PER_CLIENT];
+  /* Random stream of the client thread that owns this cache */
+  chronosRandom_t         random;
+
+  /* How requests pick portfolios and symbols. NULL means
+   * uniform, within the portfolio for symbols. Not owned
+   * by the cache */
+  CHRONOS_KEY_DIST_H      userDistH;
+  CHRONOS_KEY_DIST_H      symbolDistH;
+
+  /* Where user and symbol names live */
+  CHRONOS_CACHE_H         chronosCacheH;
+
+  /* Single allocation backing all the arrays below */
+  void                   *portfolioDataP;
+
+  /* One entry per portfolio (plus one for symbolStartArr) */
+  int32_t                *userIdArr;
+  int32_t                *symbolStartArr;
+
+  /* One entry per symbol of every portfolio */
+  int32_t                *symbolIdArr;
+  int32_t                *amountArr;
+  float                  *priceArr;
 } chronosClientCache_t;
 
+#define CHRONOS_CLIENT_CACHE_SYMBOL_POS(_clientCacheP, _numUser, _numSymbol) \
+  ((_clientCacheP)->symbolStartArr[(_numUser)] + (_numSymbol))
+
+#define CHRONOS_CLIENT_CACHE_NUM_SYMBOLS(_clientCacheP, _numUser) \
+  ((_clientCacheP)->symbolStartArr[(_numUser) + 1] - (_clientCacheP)->symbolStartArr[(_numUser)])
+
 #define CHRONOS_CACHE_MAGIC   (0xBEEF)
 #define CHRONOS_CACHE_MAGIC_CHECK(cacheP)    assert((cacheP)->magic == CHRONOS_CACHE_MAGIC)
 #define CHRONOS_CACHE_MAGIC_SET(cacheP)      (cacheP)->magic = CHRONOS_CACHE_MAGIC
@@ -76,12 +85,59 @@ typedef struct chronosCache_t {
   int                 numStocks;
   int                 firstElt;
   int                 numElt;
-  char                **stocksListP;
 
   int                 numUsers;
-  char                users[CHRONOS_CLIENT_NUM_USERS][256];
+
+  /* Single block holding the snapshot header, the
+   * symbol index and the symbol and user arenas.
+   * Either malloc'ed or mapped from a snapshot. */
+  void               *tableP;
+  size_t              tableSize;
+  int                 tableMapped;
+
+  /* Symbol names, back to back every ID_SZ bytes */
+  char               *symbolArenaP;
+
+  /* User names, back to back every ID_SZ bytes */
+  char               *userArenaP;
+
+  /* Open-addressing (linear probing) index from symbol
+   * name to symbol index. Each slot holds a symbol index,
+   * or -1 if empty. The size is a power of two. */
+  int                 symbolIndexSize;
+  int                *symbolIndexP;
 } chronosCache_t;
 
+/*--------------------------------------------------
+ * Layout of a cache snapshot. The header is followed
+ * by the symbol index and the symbol and user arenas
+ * at the recorded offsets. The in-memory cache table
+ * uses exactly this layout, so a snapshot is a dump
+ * of it. Integers are in host byte order.
+ *------------------------------------------------*/
+#define CHRONOS_CACHE_SNAPSHOT_MAGIC     "CHRSNAP"
+#define CHRONOS_CACHE_SNAPSHOT_VERSION   (1)
+
+typedef struct chronosCacheSnapshotHeader_t {
+  char      magic[8];
+  int       version;
+  int       stride;
+  int       numStocks;
+  int       numUsers;
+  int       symbolIndexSize;
+  int       reserved;
+  uint64_t  symbolIndexOffset;
+  uint64_t  symbolArenaOffset;
+  uint64_t  userArenaOffset;
+  uint64_t  totalSize;
+} chronosCacheSnapshotHeader_t;
+
+
+#define CHRONOS_CACHE_SYMBOL(_cacheP, _symbolNum) \
+  ((_cacheP)->symbolArenaP + (size_t) (_symbolNum) * ID_SZ)
+
+#define CHRONOS_CACHE_USER(_cacheP, _userNum) \
+  ((_cacheP)->userArenaP + (size_t) (_userNum) * ID_SZ)
 
 #define MIN(a,b)        (a < b ? a : b)
 #define MAX(a,b)        (a > b ? a : b)
@@ -155,12 +211,64 @@ chronosCacheSymbolGet(int             symbolNum,
   cacheP = (chronosCache_t *) chronosCacheH;
   CHRONOS_CACHE_MAGIC_CHECK(cacheP);
 
-  if (symbolNum < 0 || symbolNum > cacheP->numStocks) {
+  if (symbolNum < 0 || symbolNum >= cacheP->numStocks) {
     return NULL;
   }
   else {
-    return cacheP->stocksListP[symbolNum];
+    return CHRONOS_CACHE_SYMBOL(cacheP, symbolNum);
+  }
+}
+
+/*-------------------------------------------
+ * FNV-1a hash of a symbol name.
+ *-----------------------------------------*/
+static unsigned int
+symbolHash(const char *symbol)
+{
+  unsigned int hash = 2166136261U;
+
+  while (*symbol != '\0') {
+    hash ^= (unsigned char) *symbol;
+    hash *= 16777619U;
+    symbol ++;
+  }
+
+  return hash;
+}
+
+/*-------------------------------------------
+ * Get the index of the provided symbol name
+ * in the chronos cache, or -1 if the symbol
+ * is unknown.
+ *-----------------------------------------*/
+int
+chronosCacheSymbolLookup(const char      *symbol,
+                         CHRONOS_CACHE_H  chronosCacheH)
+{
+  int slot;
+  int symbolIdx;
+  int mask;
+  chronosCache_t *cacheP= NULL;
+
+  if (chronosCacheH == NULL || symbol == NULL) {
+    chronos_error("Invalid argument");
+    return -1;
   }
+
+  cacheP = (chronosCache_t *) chronosCacheH;
+  CHRONOS_CACHE_MAGIC_CHECK(cacheP);
+
+  mask = cacheP->symbolIndexSize - 1;
+  slot = symbolHash(symbol) & mask;
+
+  while ((symbolIdx = cacheP->symbolIndexP[slot]) != -1) {
+    if (strcmp(CHRONOS_CACHE_SYMBOL(cacheP, symbolIdx), symbol) == 0) {
+      return symbolIdx;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return -1;
 }
 
 int
@@ -217,11 +325,11 @@ chronosCacheUserGet(int userNum,
   cacheP = (chronosCache_t *) chronosCacheH;
   CHRONOS_CACHE_MAGIC_CHECK(cacheP);
 
-  if (userNum < 0 || userNum > cacheP->numUsers) {
+  if (userNum < 0 || userNum >= cacheP->numUsers) {
     return NULL;
   }
 
-  return cacheP->users[userNum];
+  return CHRONOS_CACHE_USER(cacheP, userNum);
 }
 
 /*------------------------------------------------------------
@@ -235,14 +343,17 @@ createPortfolios(int                   numClient,
                  CHRONOS_CACHE_H       chronosCacheH)
 {
   int   i, j;
+  int   pos;
   int   numSymbols = 0;
   int   numUsers =  0;
   int   numPortfolios = 0;
   int   symbolsPerUser = 0;
+  int   totalSymbols = 0;
   int   random_symbol;
   int   random_user;
   int   random_amount;
   float random_price;
+  char *dataP = NULL;
 
   if (chronosCacheH == NULL || clientCacheP == NULL) {
     chronos_error("Invalid cache pointer");
@@ -260,9 +371,10 @@ createPortfolios(int                   numClient,
    * We will create at most 10 portfolios and each portfolio
    * handles at most 10 symbols
    */
-  numPortfolios = MAX(MIN(numUsers / numClients, 100), 10);
+  numPortfolios = MAX(MIN(numUsers / numClients, CHRONOS_CLIENT_MAX_PORTFOLIOS_PER_CLIENT), 10);
   //symbolsPerUser = MAX(MIN(numSymbols / numUsers, 100), 10);
-  symbolsPerUser = 100;
+  symbolsPerUser = CHRONOS_CLIENT_MAX_SYMBOLS_PER_PORTFOLIO;
+  totalSymbols = numPortfolios * symbolsPerUser;
 
   chronos_info("DEBUG: numSymbols: %d, numUsers: %d, numPortfolios: %d, symbolsPerClient: %d",
                numSymbols,
@@ -270,37 +382,57 @@ createPortfolios(int                   numClient,
                numPortfolios,
                symbolsPerUser);
 
+  /* All the arrays hold 4-byte elements, so they can
+   * be carved out of one block back to back */
+  dataP = malloc((size_t) (2 * numPortfolios + 1) * sizeof(int32_t)
+                 + (size_t) totalSymbols * (2 * sizeof(int32_t) + sizeof(float)));
+  if (dataP == NULL) {
+    chronos_error("Could not allocate portfolios");
+    goto failXit;
+  }
+
+  clientCacheP->portfolioDataP = dataP;
+  clientCacheP->userIdArr = (int32_t *) dataP;
+  clientCacheP->symbolStartArr = clientCacheP->userIdArr + numPortfolios;
+  clientCacheP->symbolIdArr = clientCacheP->symbolStartArr + numPortfolios + 1;
+  clientCacheP->amountArr = clientCacheP->symbolIdArr + totalSymbols;
+  clientCacheP->priceArr = (float *) (clientCacheP->amountArr + totalSymbols);
+
+  clientCacheP->chronosCacheH = chronosCacheH;
   clientCacheP->numPortfolios = numPortfolios;
 
   /* Create the portfolios. */
+  pos = 0;
   for (i=0; i<numPortfolios; i++) {
     /* TODO: does it matter which client we choose? */
     random_user = (i + (numPortfolios * (numClient -1))) % numUsers;
 
-    clientCacheP->portfoliosArr[i].userId = random_user;
-    clientCacheP->portfoliosArr[i].user = chronosCacheUserGet(random_user, chronosCacheH);
-    clientCacheP->portfoliosArr[i].numSymbols = symbolsPerUser;
+    clientCacheP->userIdArr[i] = random_user;
+    clientCacheP->symbolStartArr[i] = pos;
 
     /* Assign the symbols to each portfolio */
     for (j=0; j<symbolsPerUser; j++) {
-      random_symbol = rand() % chronosCacheNumSymbolsGet(chronosCacheH);
-      random_amount = rand() % 100;
+      random_symbol = chronosRandomRange(numSymbols, &(clientCacheP->random));
+      random_amount = chronosRandomRange(100, &(clientCacheP->random));
       random_price = 500.0;
 
-      clientCacheP->portfoliosArr[i].stockInfoArr[j].symbolId = random_symbol;
-      clientCacheP->portfoliosArr[i].stockInfoArr[j].symbol = chronosCacheSymbolGet(random_symbol, chronosCacheH);
-      clientCacheP->portfoliosArr[i].stockInfoArr[j].random_amount = random_amount;
-      clientCacheP->portfoliosArr[i].stockInfoArr[j].random_price = random_price;
+      clientCacheP->symbolIdArr[pos] = random_symbol;
+      clientCacheP->amountArr[pos] = random_amount;
+      clientCacheP->priceArr[pos] = random_price;
+      pos ++;
+
       chronos_debug(3,
                     "DEBUG: Portfolio: %d (Client %d Handling user: %s symbol: %s)",
                     i,
                     numClient,
-                    clientCacheP->portfoliosArr[i].user,
-                    clientCacheP->portfoliosArr[i].stockInfoArr[j].symbol);
+                    chronosCacheUserGet(random_user, chronosCacheH),
+                    chronosCacheSymbolGet(random_symbol, chronosCacheH));
     }
     chronos_info("   created portfolio for user %d.", random_user);
 
   }
+  clientCacheP->symbolStartArr[numPortfolios] = pos;
+
     chronos_info("Finished creating %d portfolios.", numPortfolios);
 
   return CHRONOS_SUCCESS;
@@ -338,6 +470,9 @@ chronosClientCacheAlloc(int             numClient,
 
   memset(clientCacheP, 0, sizeof(*clientCacheP));
 
+  /* Each client gets its own reproducible stream */
+  chronosRandomSeed(numClient, &(clientCacheP->random));
+
   rc = createPortfolios(numClient, 
                         numClients, 
                         clientCacheP, 
@@ -353,6 +488,9 @@ chronosClientCacheAlloc(int             numClient,
 
 failXit:
   if (clientCacheP != NULL) {
+    if (clientCacheP->portfolioDataP != NULL) {
+      free(clientCacheP->portfolioDataP);
+    }
     free(clientCacheP);
     clientCacheP = NULL;
   }
@@ -375,7 +513,12 @@ chronosClientCacheFree(CHRONOS_CLIENT_CACHE_H chronosClientCacheH)
   cacheP = (chronosClientCache_t *) chronosClientCacheH;
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(cacheP);
 
+  if (cacheP->portfolioDataP != NULL) {
+    free(cacheP->portfolioDataP);
+  }
+
   memset(cacheP, 0, sizeof(*cacheP));
+  free(cacheP);
 
   goto cleanup;
 
@@ -386,6 +529,131 @@ cleanup:
   return rc;
 }
 
+/*------------------------------------------------------
+ * Reseed the random stream of a client cache. By default
+ * the stream is seeded with the client number.
+ *----------------------------------------------------*/
+int
+chronosClientCacheSeedSet(uint64_t               seed,
+                          CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  chronosRandomSeed(seed, &(clientCacheP->random));
+
+  return CHRONOS_SUCCESS;
+}
+
+chronosRandom_t *
+chronosClientCacheRandomGet(CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return NULL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  return &(clientCacheP->random);
+}
+
+/*------------------------------------------------------
+ * Attach the distribution used to pick portfolios when
+ * generating requests. Its keys are rescaled to the
+ * number of portfolios. Pass NULL to go back to uniform.
+ * The caller keeps ownership of the distribution.
+ *----------------------------------------------------*/
+int
+chronosClientCacheUserDistSet(CHRONOS_KEY_DIST_H     distH,
+                              CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  clientCacheP->userDistH = distH;
+
+  return CHRONOS_SUCCESS;
+}
+
+CHRONOS_KEY_DIST_H
+chronosClientCacheUserDistGet(CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return NULL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  return clientCacheP->userDistH;
+}
+
+/*------------------------------------------------------
+ * Attach the distribution used to pick symbols when
+ * generating requests, updates included. Its keys are
+ * rescaled to the symbol ids of the chronos cache, so
+ * every portfolio sees the same hot symbols; a "latest"
+ * distribution follows the updates as they are built.
+ * Pass NULL to go back to picking uniformly within the
+ * portfolio. The caller keeps ownership of the
+ * distribution.
+ *----------------------------------------------------*/
+int
+chronosClientCacheSymbolDistSet(CHRONOS_KEY_DIST_H     distH,
+                                CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  clientCacheP->symbolDistH = distH;
+
+  return CHRONOS_SUCCESS;
+}
+
+CHRONOS_KEY_DIST_H
+chronosClientCacheSymbolDistGet(CHRONOS_CLIENT_CACHE_H clientCacheH)
+{
+  chronosClientCache_t *clientCacheP = NULL;
+
+  if (clientCacheH == NULL) {
+    chronos_error("Invalid handle");
+    return NULL;
+  }
+
+  clientCacheP = (chronosClientCache_t *) clientCacheH;
+  CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
+
+  return clientCacheP->symbolDistH;
+}
+
 int
 chronosClientCacheNumPortfoliosGet(CHRONOS_CLIENT_CACHE_H clientCacheH)
 {
@@ -414,7 +682,7 @@ chronosClientCacheUserIdGet(int numUser, CHRONOS_CLIENT_CACHE_H clientCacheH)
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
 
-  return clientCacheP->portfoliosArr[numUser].userId;
+  return clientCacheP->userIdArr[numUser];
 }
 
 const char *
@@ -430,7 +698,7 @@ chronosClientCacheUserGet(int numUser, CHRONOS_CLIENT_CACHE_H clientCacheH)
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
 
-  return clientCacheP->portfoliosArr[numUser].user;
+  return chronosCacheUserGet(clientCacheP->userIdArr[numUser], clientCacheP->chronosCacheH);
 }
 
 int
@@ -446,7 +714,7 @@ chronosClientCacheNumSymbolFromUserGet(int numUser, CHRONOS_CLIENT_CACHE_H clien
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
 
-  return clientCacheP->portfoliosArr[numUser].numSymbols;
+  return CHRONOS_CLIENT_CACHE_NUM_SYMBOLS(clientCacheP, numUser);
 }
 
 int
@@ -461,9 +729,9 @@ chronosClientCacheSymbolIdFromUserGet(int numUser, int numSymbol, CHRONOS_CLIENT
   clientCacheP = (chronosClientCache_t *) clientCacheH;
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
-  assert(0 <= numSymbol && numSymbol < clientCacheP->portfoliosArr[numUser].numSymbols);
+  assert(0 <= numSymbol && numSymbol < CHRONOS_CLIENT_CACHE_NUM_SYMBOLS(clientCacheP, numUser));
 
-  return clientCacheP->portfoliosArr[numUser].stockInfoArr[numSymbol].symbolId;
+  return clientCacheP->symbolIdArr[CHRONOS_CLIENT_CACHE_SYMBOL_POS(clientCacheP, numUser, numSymbol)];
 }
 
 const char *
@@ -478,9 +746,10 @@ chronosClientCacheSymbolFromUserGet(int numUser, int numSymbol, CHRONOS_CLIENT_C
   clientCacheP = (chronosClientCache_t *) clientCacheH;
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
-  assert(0 <= numSymbol && numSymbol < clientCacheP->portfoliosArr[numUser].numSymbols);
+  assert(0 <= numSymbol && numSymbol < CHRONOS_CLIENT_CACHE_NUM_SYMBOLS(clientCacheP, numUser));
 
-  return clientCacheP->portfoliosArr[numUser].stockInfoArr[numSymbol].symbol;
+  return chronosCacheSymbolGet(clientCacheP->symbolIdArr[CHRONOS_CLIENT_CACHE_SYMBOL_POS(clientCacheP, numUser, numSymbol)],
+                               clientCacheP->chronosCacheH);
 }
 
 float
@@ -495,41 +764,436 @@ chronosClientCacheSymbolPriceFromUserGet(int numUser, int numSymbol, CHRONOS_CLI
   clientCacheP = (chronosClientCache_t *) clientCacheH;
   CHRONOS_CLIENT_CACHE_MAGIC_CHECK(clientCacheP);
   assert(0 <= numUser && numUser < clientCacheP->numPortfolios);
-  assert(0 <= numSymbol && numSymbol < clientCacheP->portfoliosArr[numUser].numSymbols);
+  assert(0 <= numSymbol && numSymbol < CHRONOS_CLIENT_CACHE_NUM_SYMBOLS(clientCacheP, numUser));
 
-  return clientCacheP->portfoliosArr[numUser].stockInfoArr[numSymbol].random_price;
+  return clientCacheP->priceArr[CHRONOS_CLIENT_CACHE_SYMBOL_POS(clientCacheP, numUser, numSymbol)];
 }
 
+/*------------------------------------------------
+ * Whether a region of length bytes at offset fits
+ * in a table of tableSize bytes, without
+ * overflowing on a corrupt offset.
+ *----------------------------------------------*/
 static int
-stockListFree(chronosCache_t *cacheP) 
+cacheTableRegionFits(uint64_t offset, uint64_t length, size_t tableSize)
+{
+  return (offset <= tableSize && length <= tableSize - offset);
+}
+
+/*------------------------------------------------
+ * Lay out the pointers of the cache over a table
+ * image, either freshly built or mapped from a
+ * snapshot. The header of the image is checked
+ * first, so that every region lies within it.
+ *----------------------------------------------*/
+static int
+cacheTableAttach(void *tableP, size_t tableSize, chronosCache_t *cacheP)
+{
+  chronosCacheSnapshotHeader_t *headerP = NULL;
+
+  if (tableSize < sizeof(*headerP)) {
+    chronos_error("Cache table too small: %zu bytes", tableSize);
+    goto failXit;
+  }
+
+  headerP = (chronosCacheSnapshotHeader_t *) tableP;
+
+  if (memcmp(headerP->magic, CHRONOS_CACHE_SNAPSHOT_MAGIC, sizeof(headerP->magic)) != 0
+      || headerP->version != CHRONOS_CACHE_SNAPSHOT_VERSION
+      || headerP->stride != ID_SZ) {
+    chronos_error("Unrecognized cache table format");
+    goto failXit;
+  }
+
+  if (headerP->numStocks <= 0 
+      || headerP->numStocks > CHRONOS_CACHE_MAX_NUM_SYMBOLS
+      || headerP->numUsers <= 0
+      || headerP->symbolIndexSize <= 0
+      || (int64_t) headerP->symbolIndexSize < 2 * (int64_t) headerP->numStocks
+      || (headerP->symbolIndexSize & (headerP->symbolIndexSize - 1)) != 0) {
+    chronos_error("Inconsistent cache table header");
+    goto failXit;
+  }
+
+  /* All the sizes are products of ints and small
+   * constants, so they cannot overflow 64 bits */
+  if (headerP->totalSize != tableSize
+      || headerP->symbolIndexOffset < sizeof(*headerP)
+      || headerP->symbolArenaOffset < sizeof(*headerP)
+      || headerP->userArenaOffset < sizeof(*headerP)
+      || !cacheTableRegionFits(headerP->symbolIndexOffset, 
+                               (uint64_t) headerP->symbolIndexSize * sizeof(int), 
+                               tableSize)
+      || !cacheTableRegionFits(headerP->symbolArenaOffset, 
+                               (uint64_t) headerP->numStocks * ID_SZ, 
+                               tableSize)
+      || !cacheTableRegionFits(headerP->userArenaOffset, 
+                               (uint64_t) headerP->numUsers * ID_SZ, 
+                               tableSize)
+      || headerP->symbolIndexOffset % sizeof(int) != 0) {
+    chronos_error("Truncated cache table");
+    goto failXit;
+  }
+
+  cacheP->tableP = tableP;
+  cacheP->tableSize = tableSize;
+  cacheP->numStocks = headerP->numStocks;
+  cacheP->numUsers = headerP->numUsers;
+  cacheP->symbolIndexSize = headerP->symbolIndexSize;
+  cacheP->symbolIndexP = (int *) ((char *) tableP + headerP->symbolIndexOffset);
+  cacheP->symbolArenaP = (char *) tableP + headerP->symbolArenaOffset;
+  cacheP->userArenaP = (char *) tableP + headerP->userArenaOffset;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*------------------------------------------------
+ * Check the contents of an attached table that
+ * comes from a snapshot: every index slot must be
+ * empty or name a symbol, at least one must be
+ * empty so that lookups stop, and every name must
+ * be NUL-terminated within its stride.
+ *----------------------------------------------*/
+static int
+cacheTableContentsCheck(chronosCache_t *cacheP)
+{
+  int i;
+  int symbolIdx;
+  int numEmpty = 0;
+
+  for (i=0; i<cacheP->symbolIndexSize; i++) {
+    symbolIdx = cacheP->symbolIndexP[i];
+    if (symbolIdx == -1) {
+      numEmpty ++;
+    }
+    else if (symbolIdx < 0 || symbolIdx >= cacheP->numStocks) {
+      chronos_error("Invalid symbol index entry %d: %d", i, symbolIdx);
+      goto failXit;
+    }
+  }
+
+  if (numEmpty == 0) {
+    chronos_error("Symbol index has no empty slot");
+    goto failXit;
+  }
+
+  for (i=0; i<cacheP->numStocks; i++) {
+    if (memchr(CHRONOS_CACHE_SYMBOL(cacheP, i), '\0', ID_SZ) == NULL) {
+      chronos_error("Symbol %d is not terminated", i);
+      goto failXit;
+    }
+  }
+
+  for (i=0; i<cacheP->numUsers; i++) {
+    if (memchr(CHRONOS_CACHE_USER(cacheP, i), '\0', ID_SZ) == NULL) {
+      chronos_error("User %d is not terminated", i);
+      goto failXit;
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*------------------------------------------------
+ * Build the cache table from the symbols read from
+ * the data file: the snapshot header, the symbol
+ * name index, and the symbol and user names in
+ * fixed-stride arenas, all in a single allocation
+ * laid out exactly as a snapshot file. The index is
+ * kept at most half full so probe sequences stay
+ * short.
+ *----------------------------------------------*/
+static int
+cacheTableBuild(char **stocksListP, int numStocks, int numUsers, chronosCache_t *cacheP)
 {
-  int rc = CHRONOS_SUCCESS;
   int i;
+  int rc;
+  int slot;
+  int mask;
+  int symbolIndexSize;
+  int *symbolIndexP = NULL;
+  size_t len;
+  size_t tableSize;
+  char *tableP = NULL;
+  char *symbolP = NULL;
+  chronosCacheSnapshotHeader_t *headerP = NULL;
+
+  symbolIndexSize = 1;
+  while (symbolIndexSize < 2 * numStocks) {
+    symbolIndexSize <<= 1;
+  }
+
+  tableSize = sizeof(*headerP) 
+              + (size_t) symbolIndexSize * sizeof(int)
+              + (size_t) numStocks * ID_SZ 
+              + (size_t) numUsers * ID_SZ;
+
+  tableP = malloc(tableSize);
+  if (tableP == NULL) {
+    chronos_error("Could not allocate cache table");
+    goto failXit;
+  }
+
+  memset(tableP, 0, tableSize);
+
+  headerP = (chronosCacheSnapshotHeader_t *) tableP;
+  memcpy(headerP->magic, CHRONOS_CACHE_SNAPSHOT_MAGIC, sizeof(headerP->magic));
+  headerP->version = CHRONOS_CACHE_SNAPSHOT_VERSION;
+  headerP->stride = ID_SZ;
+  headerP->numStocks = numStocks;
+  headerP->numUsers = numUsers;
+  headerP->symbolIndexSize = symbolIndexSize;
+  headerP->symbolIndexOffset = sizeof(*headerP);
+  headerP->symbolArenaOffset = headerP->symbolIndexOffset + (uint64_t) symbolIndexSize * sizeof(int);
+  headerP->userArenaOffset = headerP->symbolArenaOffset + (uint64_t) numStocks * ID_SZ;
+  headerP->totalSize = tableSize;
+
+  rc = cacheTableAttach(tableP, tableSize, cacheP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  symbolIndexP = cacheP->symbolIndexP;
+  memset(symbolIndexP, -1, (size_t) symbolIndexSize * sizeof(int));
+  mask = symbolIndexSize - 1;
+
+  for (i=0; i<numStocks; i++) {
+    symbolP = CHRONOS_CACHE_SYMBOL(cacheP, i);
+
+    len = strlen(stocksListP[i]);
+    if (len >= ID_SZ) {
+      chronos_warning("Symbol %s truncated to %d characters", stocksListP[i], ID_SZ - 1);
+      len = ID_SZ - 1;
+    }
+    memcpy(symbolP, stocksListP[i], len);
+
+    slot = symbolHash(symbolP) & mask;
+
+    while (symbolIndexP[slot] != -1) {
+      if (strcmp(CHRONOS_CACHE_SYMBOL(cacheP, symbolIndexP[slot]), symbolP) == 0) {
+        chronos_warning("Duplicate symbol: %s", symbolP);
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+
+    if (symbolIndexP[slot] == -1) {
+      symbolIndexP[slot] = i;
+    }
+  }
+
+  for (i=0; i<numUsers; i++) {
+    snprintf(CHRONOS_CACHE_USER(cacheP, i), ID_SZ, "%d", i + 1);
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  if (tableP != NULL) {
+    free(tableP);
+  }
+  cacheP->tableP = NULL;
+  return CHRONOS_FAIL;
+}
 
+/*------------------------------------------------
+ * Map a cache snapshot read-only. Processes that
+ * map the same snapshot share its pages.
+ *----------------------------------------------*/
+static int
+cacheTableMap(const char *snapshotPath, chronosCache_t *cacheP)
+{
+  int fd = -1;
+  int rc;
+  void *tableP = MAP_FAILED;
+  struct stat sb;
+
+  fd = open(snapshotPath, O_RDONLY);
+  if (fd < 0) {
+    goto failXit;
+  }
+
+  if (fstat(fd, &sb) < 0) {
+    perror("fstat() failed");
+    goto failXit;
+  }
+
+  if (sb.st_size == 0) {
+    chronos_warning("Empty cache snapshot: %.200s", snapshotPath);
+    goto failXit;
+  }
+
+  tableP = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (tableP == MAP_FAILED) {
+    perror("mmap() failed");
+    goto failXit;
+  }
+
+  close(fd);
+  fd = -1;
+
+  rc = cacheTableAttach(tableP, sb.st_size, cacheP);
+  if (rc == CHRONOS_SUCCESS) {
+    rc = cacheTableContentsCheck(cacheP);
+  }
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_warning("Ignoring bad cache snapshot: %.200s", snapshotPath);
+    goto failXit;
+  }
+
+  cacheP->tableMapped = 1;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  if (tableP != MAP_FAILED) {
+    munmap(tableP, sb.st_size);
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  cacheP->tableP = NULL;
+  cacheP->symbolIndexP = NULL;
+  cacheP->symbolArenaP = NULL;
+  cacheP->userArenaP = NULL;
+  return CHRONOS_FAIL;
+}
+
+static int
+cacheTableFree(chronosCache_t *cacheP) 
+{
   if (cacheP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  if (cacheP->tableP != NULL) {
+    if (cacheP->tableMapped) {
+      munmap(cacheP->tableP, cacheP->tableSize);
+    }
+    else {
+      free(cacheP->tableP);
+    }
+    cacheP->tableP = NULL;
+  }
+  cacheP->tableSize = 0;
+  cacheP->tableMapped = 0;
+  cacheP->symbolIndexP = NULL;
+  cacheP->symbolArenaP = NULL;
+  cacheP->userArenaP = NULL;
+  cacheP->symbolIndexSize = 0;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*------------------------------------------------
+ * Release the list of symbols handed out by the
+ * benchmark library, once it has been copied.
+ *----------------------------------------------*/
+static void
+stockListFree(char **stocksListP, int numStocks) 
+{
+  int i;
+
+  if (stocksListP == NULL) {
+    return;
+  }
+
+  for (i=0; i<numStocks; i++) {
+    if (stocksListP[i] != NULL) {
+      free(stocksListP[i]);
+      stocksListP[i] = NULL;
+    }
+  }
+
+  free(stocksListP);
+}
+
+/*------------------------------------------------
+ * Write a binary snapshot of the cache that later
+ * calls to chronosCacheAlloc() can map instead of
+ * parsing the data file. The snapshot is written
+ * to a temporary file and renamed into place.
+ *----------------------------------------------*/
+int
+chronosCacheSnapshotWrite(const char      *snapshotPath,
+                          CHRONOS_CACHE_H  chronosCacheH)
+{
+  int fd = -1;
+  int tmpCreated = 0;
+  ssize_t written;
+  size_t to_write;
+  const char *buf = NULL;
+  char tmpPath[PATH_MAX];
+  chronosCache_t *cacheP = NULL;
+
+  if (chronosCacheH == NULL || snapshotPath == NULL) {
     chronos_error("Invalid argument");
     goto failXit;
   }
 
-  if (cacheP->stocksListP != NULL) {
-    for (i=0; i<CHRONOS_CLIENT_NUM_STOCKS; i++) {
-      if (cacheP->stocksListP[i] != NULL) {
-        free(cacheP->stocksListP[i]);
-        cacheP->stocksListP[i] = NULL;
+  cacheP = (chronosCache_t *) chronosCacheH;
+  CHRONOS_CACHE_MAGIC_CHECK(cacheP);
+
+  if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", snapshotPath) >= (int) sizeof(tmpPath)) {
+    chronos_error("Snapshot path too long");
+    goto failXit;
+  }
+
+  fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open() failed");
+    goto failXit;
+  }
+  tmpCreated = 1;
+
+  buf = (const char *) cacheP->tableP;
+  to_write = cacheP->tableSize;
+
+  while (to_write > 0) {
+    written = write(fd, buf, to_write);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      perror("write() failed");
+      goto failXit;
     }
 
-    free(cacheP->stocksListP);
-    cacheP->stocksListP = NULL;
+    to_write -= written;
+    buf += written;
   }
 
-  goto cleanup;
+  if (close(fd) < 0) {
+    fd = -1;
+    perror("close() failed");
+    goto failXit;
+  }
+  fd = -1;
 
-failXit:
-  rc = CHRONOS_FAIL;
+  if (rename(tmpPath, snapshotPath) < 0) {
+    perror("rename() failed");
+    goto failXit;
+  }
 
-cleanup:
-  return rc;
+  return CHRONOS_SUCCESS;
+
+failXit:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (tmpCreated) {
+    unlink(tmpPath);
+  }
+  return CHRONOS_FAIL;
 }
 
 
@@ -537,16 +1201,26 @@ cleanup:
  * Create a cache of the list of stocks managed
  * by the systems. 
  *
- * This is achieved by reading the stocks data
- * file that is initially used to populate the
- * stocks database.
+ * The cache holds numSymbols symbols, or
+ * CHRONOS_CACHE_DEFAULT_NUM_SYMBOLS if numSymbols
+ * is not positive. All symbol storage is sized to
+ * that count.
+ *
+ * If the data files directory holds a cache
+ * snapshot (CHRONOS_CACHE_SNAPSHOT_FILE) with the
+ * same number of symbols, it is
+ * mapped read-only. Otherwise the cache is built
+ * by reading the stocks data file that is 
+ * initially used to populate the stocks database.
  *----------------------------------------------*/
 CHRONOS_CACHE_H
 chronosCacheAlloc(const char *homedir, 
-                  const char *datafilesdir)
+                  const char *datafilesdir,
+                  int         numSymbols)
 {
-  int i;
   chronosCache_t *cacheP = NULL;
+  char **stocksListP = NULL;
+  char snapshotPath[PATH_MAX];
   int rc = CHRONOS_SUCCESS;
 
   cacheP = malloc(sizeof(chronosCache_t));
@@ -557,36 +1231,68 @@ chronosCacheAlloc(const char *homedir,
 
   memset(cacheP, 0, sizeof(*cacheP));
 
-  /* Retrieve CHRONOS_CLIENT_NUM_STOCKS symbols
-   * from the datafile */
-  rc = benchmark_stock_list_from_file_get(homedir, 
-                                          datafilesdir, 
-                                          CHRONOS_CLIENT_NUM_STOCKS, 
-                                          &(cacheP->stocksListP));
-  if (rc != CHRONOS_SUCCESS) {
-    chronos_error("Could not initialize cache structure");
+  if (numSymbols <= 0) {
+    numSymbols = CHRONOS_CACHE_DEFAULT_NUM_SYMBOLS;
+  }
+
+  if (numSymbols > CHRONOS_CACHE_MAX_NUM_SYMBOLS) {
+    chronos_error("Too many symbols requested: %d", numSymbols);
     goto failXit;
   }
 
-  assert(cacheP->stocksListP != NULL);
+  if (datafilesdir != NULL 
+      && snprintf(snapshotPath, sizeof(snapshotPath), "%s/%s", 
+                  datafilesdir, CHRONOS_CACHE_SNAPSHOT_FILE) < (int) sizeof(snapshotPath)) {
+    rc = cacheTableMap(snapshotPath, cacheP);
+    if (rc == CHRONOS_SUCCESS && cacheP->numStocks != numSymbols) {
+      chronos_warning("Cache snapshot has %d symbols, expected %d", 
+                      cacheP->numStocks, numSymbols);
+      cacheTableFree(cacheP);
+      rc = CHRONOS_FAIL;
+    }
+  }
+  else {
+    rc = CHRONOS_FAIL;
+  }
 
-  cacheP->numStocks = CHRONOS_CLIENT_NUM_STOCKS;
-  cacheP->firstElt = 0;
-  cacheP->numElt = cacheP->numStocks;
+  if (rc != CHRONOS_SUCCESS) {
+    /* Retrieve numSymbols symbols from the datafile */
+    rc = benchmark_stock_list_from_file_get(homedir, 
+                                            datafilesdir, 
+                                            numSymbols, 
+                                            &stocksListP);
+    if (rc != CHRONOS_SUCCESS) {
+      chronos_error("Could not initialize cache structure");
+      goto failXit;
+    }
 
+    assert(stocksListP != NULL);
+
+    rc = cacheTableBuild(stocksListP, 
+                         numSymbols, 
+                         CHRONOS_CLIENT_NUM_USERS, 
+                         cacheP);
+    if (rc != CHRONOS_SUCCESS) {
+      chronos_error("Could not build cache table");
+      goto failXit;
+    }
 
-  cacheP->numUsers = CHRONOS_CLIENT_NUM_USERS;
-  for (i=0; i<CHRONOS_CLIENT_NUM_USERS; i++) {
-    snprintf(cacheP->users[i], sizeof(cacheP->users[i]),
-             "%d", i + 1);
+    stockListFree(stocksListP, numSymbols);
+    stocksListP = NULL;
   }
 
+  cacheP->firstElt = 0;
+  cacheP->numElt = cacheP->numStocks;
+
   CHRONOS_CACHE_MAGIC_SET(cacheP);
 
   goto cleanup;
 
 failXit:
+  stockListFree(stocksListP, numSymbols);
+
   if (cacheP != NULL) {
+    cacheTableFree(cacheP);
     free(cacheP);
     cacheP = NULL;
   }
@@ -609,13 +1315,14 @@ chronosCacheFree(CHRONOS_CACHE_H chronosCacheH)
   cacheP = (chronosCache_t *) chronosCacheH;
   CHRONOS_CACHE_MAGIC_CHECK(cacheP);
 
-  rc = stockListFree(cacheP);
+  rc = cacheTableFree(cacheP);
   if (rc != CHRONOS_SUCCESS) {
     chronos_error("Could not free cached items");
     goto failXit;
   }
 
   memset(cacheP, 0, sizeof(*cacheP));
+  free(cacheP);
 
   goto cleanup;
 
@@ -625,4 +1332,3 @@ failXit:
 cleanup:
   return rc;
 }
-
@@ -1,9 +1,18 @@
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/poll.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,23 +20,250 @@
 #include <errno.h>
 #include "chronos.h"
 #include "include/chronos_client.h"
+#include "include/chronos_histogram.h"
+#include "include/chronos_shm.h"
+#include "include/chronos_uring.h"
 
 
 typedef enum {
   CHRONOS_CONNECTION_INVALID = 0,
   CHRONOS_CONNECTION_DISCONNECTED,
+  CHRONOS_CONNECTION_CONNECTING,
   CHRONOS_CONNECTION_CONNECTED
 } chronosConnState_t;
 
+#define CHRONOS_CLIENT_RECV_BUF_SIZE   (16 * 1024)
+
+/* How long a disconnect waits for the kernel to release
+ * the requests of zero-copy sends */
+#define CHRONOS_CLIENT_ZEROCOPY_DRAIN_MS  (200)
+
+/* How many times chronosClientConnect() retries a unix
+ * socket whose listen backlog is full, backing off from
+ * 1ms */
+#define CHRONOS_CLIENT_UNIX_CONNECT_RETRIES  (8)
+
+#define CHRONOS_INFLIGHT_SLOT(_requestId)  ((_requestId) & (CHRONOS_CLIENT_MAX_INFLIGHT - 1))
+
+typedef enum {
+  CHRONOS_INFLIGHT_FREE = 0,
+  CHRONOS_INFLIGHT_PENDING,
+  CHRONOS_INFLIGHT_DONE
+} chronosInFlightState_t;
+
+/*--------------------------------------------------
+ * A request that was sent on the connection and
+ * whose response has not been collected yet.
+ *------------------------------------------------*/
+typedef struct chronosInFlight_t {
+  chronosInFlightState_t   state;
+  unsigned int             requestId;
+  chronosUserTransaction_t txnType;
+  uint64_t                 submitNs;
+  uint64_t                 sentNs;
+  uint64_t                 deadlineNs;
+
+  /* Requests sent with chronosClientSubmit() complete
+   * into the connection's completion queue */
+  int                      isSubmitted;
+  uint64_t                 userTag;
+  chronosResponsePacket_t  response;
+} chronosInFlight_t;
+
+/*--------------------------------------------------
+ * A request whose frame went out with zero-copy send
+ * number seq. The kernel may still be reading it.
+ *------------------------------------------------*/
+typedef struct chronosZeroCopyHeld_t {
+  uint32_t           seq;
+  int                isDone;
+  CHRONOS_REQUEST_H  requestH;
+} chronosZeroCopyHeld_t;
+
+/* The low bits of the user data of io_uring operations
+ * tell which operation of the connection completed */
+#define CHRONOS_URING_OP_RECV   (1)
+#define CHRONOS_URING_OP_SEND   (2)
+#define CHRONOS_URING_OP_POLL   (3)
+#define CHRONOS_URING_OP_MASK   (7)
+
+struct chronosClientConnection_t;
+
+/*--------------------------------------------------
+ * What a connection has going on in an io_uring event
+ * loop. Its address, tagged with the operation, is the
+ * user data of the operations, so it stays around after
+ * the connection left the loop until the last of them
+ * completed.
+ *------------------------------------------------*/
+typedef struct chronosClientUring_t {
+  CHRONOS_URING_H    uringH;
+
+  /* NULL once the connection left the loop */
+  struct chronosClientConnection_t *connectionP;
+
+  /* Operations not completed yet */
+  int                numOps;
+  int                isRecvArmed;
+  int                isSendArmed;
+  int                isRecvMultishot;
+  int                isPollArmed;
+
+  /* While a send is in flight the kernel owns the send
+   * buffer, and the connection queues into the spare one.
+   * They swap every send */
+  char              *sendBufP;
+  size_t             sendBufSize;
+  size_t             sendOff;
+  size_t             sendLen;
+  char              *spareBufP;
+  size_t             spareBufSize;
+} chronosClientUring_t;
+
+#define CHRONOS_COMPLETION_QUEUE_MAGIC   (0xC0C0)
+#define CHRONOS_COMPLETION_QUEUE_MAGIC_CHECK(queueP)    assert((queueP)->magic == CHRONOS_COMPLETION_QUEUE_MAGIC)
+#define CHRONOS_COMPLETION_QUEUE_MAGIC_SET(queueP)      (queueP)->magic = CHRONOS_COMPLETION_QUEUE_MAGIC
+
+/*--------------------------------------------------
+ * A growable ring of completions. One queue can be
+ * shared by many connections as long as they are all
+ * driven by the same thread.
+ *------------------------------------------------*/
+typedef struct chronosCompletionQueue_t {
+  int                   magic;
+  int                   head;
+  int                   count;
+  int                   size;
+  chronosCompletion_t  *completionArr;
+} chronosCompletionQueue_t;
+
 typedef struct chronosClientConnection_t {
   char                connectionName[256];
   char                serverAddress[256];
   int                 serverPort;
   int                 socket_fd;
   chronosConnState_t  state;
+
+  /* Set instead of socket_fd on shared-memory connections */
+  CHRONOS_SHM_H       shmH;
   CHRONOS_ENV_H          envH; 
+
+  /* Applied to the socket on every connect. The TCP ones
+   * only if isTcp */
+  chronosConnOptions_t options;
+  int                 isTcp;
+
+  /* TCP_QUICKACK is re-armed once per burst: by the first
+   * read after requests went out on an idle connection.
+   * Left off for good if the kernel refuses it */
+  int                 isQuickAckDue;
+  int                 isQuickAckBroken;
+
+  /* Set if the socket does MSG_ZEROCOPY sends. The kernel
+   * numbers them from 0 and reports ranges of them done.
+   * The requests they used are held in [zeroCopyHead,
+   * zeroCopyTail) of zeroCopyHeldArr until then */
+  int                 isZeroCopy;
+  uint32_t            zeroCopyNextSeq;
+  int                 zeroCopyHead;
+  int                 zeroCopyTail;
+  int                 zeroCopySize;
+  chronosZeroCopyHeld_t *zeroCopyHeldArr;
+  uint64_t            numZeroCopySends;
+  uint64_t            numZeroCopyCopied;
+
+  /* Bytes read from the socket but not yet consumed:
+   * valid data lives in [recvHead, recvTail) */
+  size_t              recvHead;
+  size_t              recvTail;
+  char                recvBuf[CHRONOS_CLIENT_RECV_BUF_SIZE];
+
+  /* The peer closed the socket after sending what is
+   * still in recvBuf */
+  int                 isPeerClosed;
+
+  /* Bytes queued but not yet taken by the socket: pending
+   * data lives in [sendHead, sendTail). Allocated the first
+   * time a send cannot complete, grows as needed */
+  size_t              sendHead;
+  size_t              sendTail;
+  size_t              sendBufSize;
+  char               *sendBufP;
+
+  /* Non-blocking sends are refused with CHRONOS_AGAIN
+   * while this many bytes are pending */
+  size_t              sendLimit;
+
+  /* The epoll instance the socket is registered with, or
+   * -1, and the events it is currently watched for */
+  int                 epollFd;
+  uint32_t            epollEvents;
+
+  /* Set instead while in an io_uring event loop. The loop
+   * then does all the socket I/O */
+  chronosClientUring_t *uringP;
+
+  /* If set, responses are handed to this callback as soon
+   * as they arrive instead of waiting to be collected */
+  chronosClientCompletionFp_t completionFp;
+  void               *completionArg;
+
+  /* Where completions of submitted requests go. The
+   * connection owns it unless it was set from outside */
+  chronosCompletionQueue_t *completionQueueP;
+  int                 ownsCompletionQueue;
+
+  /* Written by chronosClientInterrupt() to wake up a
+   * thread blocked on this connection */
+  int                 wakeupFd;
+
+  /* Requests sent but not collected yet. Ids in
+   * [oldestRequestId, nextRequestId) may be in flight,
+   * each one lives at slot CHRONOS_INFLIGHT_SLOT(id) */
+  unsigned int        nextRequestId;
+  unsigned int        oldestRequestId;
+  int                 numInFlight;
+  chronosInFlight_t   inFlightArr[CHRONOS_CLIENT_MAX_INFLIGHT];
+
+  /* The last response collected on this connection */
+  chronosResponsePacket_t lastResponse;
+
+  /* Responses to requests with a deadline, by whether
+   * they arrived in time */
+  uint64_t            numDeadlineMet;
+  uint64_t            numDeadlineMissed;
 } chronosClientConnection_t;
 
+static int
+chronosClientRecvFill(chronosClientConnection_t *connectionP);
+
+static void
+chronosClientQuickAckRearm(chronosClientConnection_t *connectionP);
+
+static int
+chronosClientResponsesDispatch(chronosClientConnection_t *connectionP);
+
+static void
+chronosClientSubmittedFail(chronosClientConnection_t *connectionP);
+
+static void
+chronosClientZeroCopyDone(uint32_t                   lo,
+                          uint32_t                   hi,
+                          int                        isAbandon,
+                          chronosClientConnection_t *connectionP);
+
+static int
+chronosClientZeroCopyReap(chronosClientConnection_t *connectionP);
+
+static void
+chronosClientZeroCopyDrain(chronosClientConnection_t *connectionP);
+
+static int
+chronosClientUringUpdate(chronosClientConnection_t *connectionP);
+
+static void
+chronosClientUringCancel(chronosClientConnection_t *connectionP);
+
 CHRONOS_ENV_H
 chronosClientEnvGet(CHRONOS_CONN_H connH)
 {
@@ -53,368 +289,3201 @@ failXit:
   return NULL;
 }
 
-int
-chronosClientDisconnect(CHRONOS_CONN_H connH)
+/*
+ * Keeps the events the socket is watched for in step with
+ * the connection state: writability while connecting or
+ * while sends are pending, readability once connected.
+ */
+static int
+chronosClientEpollUpdate(chronosClientConnection_t *connectionP)
 {
-  chronosClientConnection_t *connectionP = NULL;
+  uint32_t events;
+  struct epoll_event event;
 
-  if (connH == NULL) {
-    chronos_error("Invalid handle");
-    goto failXit;
+  if (connectionP->uringP != NULL) {
+    return chronosClientUringUpdate(connectionP);
   }
 
-  connectionP = (chronosClientConnection_t *) connH;
+  if (connectionP->epollFd < 0 || connectionP->socket_fd < 0) {
+    return CHRONOS_SUCCESS;
+  }
 
-  if (connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
-    close(connectionP->socket_fd);
-    connectionP->socket_fd = -1;
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+    events = EPOLLOUT;
+  }
+  else {
+    events = EPOLLIN;
+    if (connectionP->sendTail > connectionP->sendHead) {
+      events |= EPOLLOUT;
+    }
   }
 
-  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
+  if (events == connectionP->epollEvents) {
+    return CHRONOS_SUCCESS;
+  }
 
-  return CHRONOS_SUCCESS;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = connectionP;
 
-failXit:
-  return CHRONOS_FAIL; 
+  if (epoll_ctl(connectionP->epollFd, EPOLL_CTL_MOD, connectionP->socket_fd, &event) < 0) {
+    perror("epoll_ctl() failed");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP->epollEvents = events;
+
+  return CHRONOS_SUCCESS;
 }
 
+/*
+ * Registers the connection's socket with an epoll
+ * instance. The connection must be connected or
+ * connecting; from then on it keeps the registration up
+ * to date by itself and epoll reports it with the
+ * connection handle as data.ptr.
+ */
 int
-chronosClientConnect(const char *serverAddress,
-                     int serverPort,
-                     const char *connName,
-                     CHRONOS_CONN_H connH) 
+chronosClientEpollAttach(int            epollFd,
+                         CHRONOS_CONN_H connH)
 {
-  int on = 1;
-  int socket_fd;
-  int rc = CHRONOS_SUCCESS;
+  struct epoll_event event;
   chronosClientConnection_t *connectionP = NULL;
-  struct sockaddr_in chronos_server_address;
-  struct pollfd fds[1];
-
-  if (connH == NULL) {
-    chronos_error("Invalid connection handle");
-    goto failXit;
-  }
 
-  if (serverPort == 0 || serverAddress == NULL) {
-    chronos_error("Invalid arguments");
+  if (connH == NULL || epollFd < 0) {
+    chronos_error("Invalid argument");
     goto failXit;
   }
 
   connectionP = (chronosClientConnection_t *) connH;
 
-  if (connectionP->state != CHRONOS_CONNECTION_DISCONNECTED) {
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED
+      && connectionP->state != CHRONOS_CONNECTION_CONNECTING) {
     chronos_error("Invalid connection state");
     goto failXit;
   }
 
-  strncpy(connectionP->serverAddress, 
-          serverAddress, 
-          sizeof(connectionP->serverAddress));
-  connectionP->serverPort = serverPort;
-
-  if (connName != NULL) {
-    strncpy(connectionP->connectionName, 
-            connName, 
-            sizeof(connectionP->connectionName));
-  }
-  else {
-    snprintf(connectionP->connectionName,
-             sizeof(connectionP->connectionName),
-             "%s:%d", 
-             serverAddress,
-             serverPort);
+  if (connectionP->epollFd >= 0 || connectionP->uringP != NULL) {
+    chronos_error("Connection already attached");
+    goto failXit;
   }
 
-  socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (socket_fd == -1) {
-    perror("socket() failed");
+  if (connectionP->shmH != NULL) {
+    chronos_error("Shared-memory connections cannot be polled with epoll");
     goto failXit;
   }
 
-  /* Make socket reusable */
-  rc = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on));
-  if (rc == -1) {
-    perror("setsockopt() failed");
+  memset(&event, 0, sizeof(event));
+  event.events = 0;
+  event.data.ptr = connectionP;
+
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, connectionP->socket_fd, &event) < 0) {
+    perror("epoll_ctl() failed");
     goto failXit;
   }
 
-  /* Make non-blocking socket */
-  rc = ioctl(socket_fd, FIONBIO, (char *)&on);
-  if (rc < 0) {
-    perror("ioctl() failed");
-    goto failXit;
+  connectionP->epollFd = epollFd;
+  connectionP->epollEvents = 0;
+
+  return chronosClientEpollUpdate(connectionP);
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+int
+chronosClientEpollDetach(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
   }
 
-  fds[0].fd = socket_fd;
-  fds[0].events = POLLOUT;
+  connectionP = (chronosClientConnection_t *) connH;
 
-  chronos_server_address.sin_family = AF_INET;
-  chronos_server_address.sin_addr.s_addr = inet_addr(serverAddress);
-  chronos_server_address.sin_port = htons(serverPort);
-  
-  rc = connect(socket_fd, 
-                (struct sockaddr *)&chronos_server_address, 
-                sizeof(chronos_server_address));
-  if (rc < 0 && errno != EINPROGRESS) {
-    perror("connect() failed");
-    goto failXit;
+  if (connectionP->epollFd < 0) {
+    chronos_error("Connection not attached");
+    return CHRONOS_FAIL;
   }
-  else if (rc == 0) {
-    /* connected successfully */
+
+  if (connectionP->socket_fd >= 0
+      && epoll_ctl(connectionP->epollFd, EPOLL_CTL_DEL, connectionP->socket_fd, NULL) < 0) {
+    perror("epoll_ctl() failed");
   }
-  else {
-    /* wait for connect to complete */
-    while (fds[0].events) {
-      int result;
-      socklen_t result_len = sizeof(result);
-
-      rc = poll(fds, 1, 1000 /* one second */);
-      if (rc < 0) {
-        perror("poll() failed");
-        goto failXit;
-      }
 
-      /* poll timed out */
-      if (rc == 0) {
-        continue;
-      }
+  connectionP->epollFd = -1;
+  connectionP->epollEvents = 0;
 
-      rc = getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &result, &result_len);
-      if (rc < 0) {
-        perror("getsockopt() failed");
-        goto failXit; 
-      }
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * The io_uring counterpart of chronosClientEpollUpdate():
+ * arms what the connection state calls for. A poll for
+ * writability while connecting; once connected, a
+ * multishot receive and, when bytes are pending and no
+ * send is in flight, a send of all of them.
+ */
+static int
+chronosClientUringUpdate(chronosClientConnection_t *connectionP)
+{
+  int rc;
+  char *bufP = NULL;
+  size_t bufSize;
+  chronosClientUring_t *uringP = connectionP->uringP;
 
-      if (result != 0) {
-        char errMsg[256];
-        (void)strerror_r(result, errMsg, sizeof(errMsg));
-        chronos_error("connect() failed: %s", errMsg);
+  if (connectionP->socket_fd < 0) {
+    return CHRONOS_SUCCESS;
+  }
+
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+    if (!uringP->isPollArmed) {
+      rc = chronosUringPollPrep(connectionP->socket_fd, 
+                                POLLOUT, 
+                                0, 
+                                (uintptr_t) uringP | CHRONOS_URING_OP_POLL, 
+                                uringP->uringH);
+      if (rc != CHRONOS_SUCCESS) {
         goto failXit;
       }
-    
-      break;
+      uringP->isPollArmed = 1;
+      uringP->numOps ++;
     }
+    return CHRONOS_SUCCESS;
   }
 
-  connectionP->socket_fd = socket_fd;
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    return CHRONOS_SUCCESS;
+  }
 
-  connectionP->state = CHRONOS_CONNECTION_CONNECTED;
+  if (!uringP->isRecvArmed) {
+    rc = chronosUringRecvPrep(connectionP->socket_fd, 
+                              (uintptr_t) uringP | CHRONOS_URING_OP_RECV, 
+                              uringP->uringH);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+    uringP->isRecvArmed = 1;
+    uringP->isRecvMultishot = chronosUringRecvIsMultishot(uringP->uringH);
+    uringP->numOps ++;
+  }
+
+  if (!uringP->isSendArmed && connectionP->sendTail > connectionP->sendHead) {
+    /* The kernel gets the send buffer, and the connection
+     * queues into the spare one meanwhile */
+    bufP = uringP->spareBufP;
+    bufSize = uringP->spareBufSize;
+    uringP->spareBufP = NULL;
+    uringP->spareBufSize = 0;
+
+    uringP->sendBufP = connectionP->sendBufP;
+    uringP->sendBufSize = connectionP->sendBufSize;
+    uringP->sendOff = connectionP->sendHead;
+    uringP->sendLen = connectionP->sendTail;
+
+    connectionP->sendBufP = bufP;
+    connectionP->sendBufSize = bufSize;
+    connectionP->sendHead = 0;
+    connectionP->sendTail = 0;
+
+    rc = chronosUringSendPrep(connectionP->socket_fd,
+                              uringP->sendBufP + uringP->sendOff,
+                              uringP->sendLen - uringP->sendOff,
+                              (uintptr_t) uringP | CHRONOS_URING_OP_SEND,
+                              uringP->uringH);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+    uringP->isSendArmed = 1;
+    uringP->numOps ++;
+  }
 
   return CHRONOS_SUCCESS;
 
 failXit:
-  
-  connectionP->socket_fd = -1;
-  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
-  return CHRONOS_FAIL; 
+  return CHRONOS_FAIL;
 }
 
-CHRONOS_CONN_H
-chronosConnHandleAlloc(CHRONOS_ENV_H envH)
+/*
+ * Cancels the operations the connection has armed, before
+ * its socket is closed. They still complete, with
+ * -ECANCELED unless they were already done.
+ */
+static void
+chronosClientUringCancel(chronosClientConnection_t *connectionP)
 {
-  int rc = CHRONOS_SUCCESS;
-  chronosClientConnection_t *connectionP = NULL;
+  chronosClientUring_t *uringP = connectionP->uringP;
 
-  connectionP = malloc(sizeof(chronosClientConnection_t));
-  if (connectionP == NULL) {
-    chronos_error("Could not allocate connection handle");
-    goto failXit;
+  if (uringP->isRecvArmed) {
+    chronosUringCancelPrep((uintptr_t) uringP | CHRONOS_URING_OP_RECV, uringP->uringH);
   }
-
-  memset(connectionP, 0, sizeof(*connectionP));
-
-  rc = chronosEnvCheck(envH);
-  if (rc != CHRONOS_SUCCESS) {
-    chronos_error("Bad env handle");
-    goto failXit;
+  if (uringP->isSendArmed) {
+    chronosUringCancelPrep((uintptr_t) uringP | CHRONOS_URING_OP_SEND, uringP->uringH);
   }
+  if (uringP->isPollArmed) {
+    chronosUringCancelPrep((uintptr_t) uringP | CHRONOS_URING_OP_POLL, uringP->uringH);
+  }
+}
 
-  connectionP->envH = envH;
-  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
-  goto cleanup;
-
-failXit:
-  if (connectionP != NULL) {
-    free(connectionP);
-    connectionP = NULL;
+static void
+chronosClientUringFree(chronosClientUring_t *uringP)
+{
+  if (uringP->sendBufP != NULL) {
+    free(uringP->sendBufP);
   }
-  
-cleanup:
-  return  (void *) connectionP;
+  if (uringP->spareBufP != NULL) {
+    free(uringP->spareBufP);
+  }
+  free(uringP);
 }
 
+/*
+ * Hands the connection's socket I/O over to an io_uring
+ * instance. The connection must be connected or
+ * connecting. From then on the ring does every read and
+ * write, and each completion for the connection goes to
+ * chronosClientUringComplete(); blocking calls on the
+ * connection fail. Fails while zero-copy sends made on
+ * the socket still hold requests.
+ */
 int
-chronosConnHandleFree(CHRONOS_CONN_H connH) 
+chronosClientUringAttach(CHRONOS_URING_H uringH,
+                         CHRONOS_CONN_H  connH)
 {
-  int rc = CHRONOS_SUCCESS;
+  chronosClientUring_t *uringP = NULL;
   chronosClientConnection_t *connectionP = NULL;
 
-  if (connH == NULL) {
-    chronos_error("Invalid handle");
+  if (connH == NULL || uringH == NULL) {
+    chronos_error("Invalid argument");
     goto failXit;
   }
 
   connectionP = (chronosClientConnection_t *) connH;
 
-  if (connectionP->state != CHRONOS_CONNECTION_DISCONNECTED) {
-    chronos_error("Invalid state");
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED
+      && connectionP->state != CHRONOS_CONNECTION_CONNECTING) {
+    chronos_error("Invalid connection state");
     goto failXit;
   }
 
-  rc = chronosEnvCheck(connectionP->envH);
-  if (rc != CHRONOS_SUCCESS) {
-    chronos_error("Bad env handle");
+  if (connectionP->epollFd >= 0 || connectionP->uringP != NULL) {
+    chronos_error("Connection already attached");
     goto failXit;
   }
-  
-  memset(connectionP, 0, sizeof(*connectionP));
-  free(connectionP);
 
-  goto cleanup;
+  if (connectionP->shmH != NULL) {
+    chronos_error("Shared-memory connections cannot be driven by io_uring");
+    goto failXit;
+  }
 
-failXit:
-  rc = CHRONOS_FAIL;
+  /* The ring cannot release requests earlier zero-copy
+   * sends still hold: the kernel must be done with them */
+  if (connectionP->zeroCopyHead != connectionP->zeroCopyTail
+      && chronosClientZeroCopyReap(connectionP) == CHRONOS_FAIL) {
+    goto failXit;
+  }
 
-cleanup:
-  return rc;
+  if (connectionP->zeroCopyHead != connectionP->zeroCopyTail) {
+    chronos_error("Zero-copy sends still in progress");
+    goto failXit;
+  }
+
+  uringP = malloc(sizeof(chronosClientUring_t));
+  if (uringP == NULL) {
+    chronos_error("Could not allocate io_uring state");
+    goto failXit;
+  }
+
+  memset(uringP, 0, sizeof(*uringP));
+  uringP->uringH = uringH;
+  uringP->connectionP = connectionP;
+  connectionP->uringP = uringP;
+
+  /* Zero-copy completions are read from the error queue,
+   * which the ring does not watch */
+  connectionP->isZeroCopy = 0;
+
+  return chronosClientUringUpdate(connectionP);
+
+failXit:
+  return CHRONOS_FAIL;
 }
 
 /*
- * Sends a transaction request to the Chronos Server
+ * The connection must be disconnected first. Its state in
+ * the ring lives on until its cancelled operations have
+ * completed.
  */
 int
-chronosClientSendRequest(CHRONOS_REQUEST_H    requestH,
-                         CHRONOS_CONN_H connH)
+chronosClientUringDetach(CHRONOS_CONN_H connH)
 {
-  int written, to_write;
-  char *buf = NULL;
+  chronosClientUring_t *uringP = NULL;
   chronosClientConnection_t *connectionP = NULL;
 
   if (connH == NULL) {
     chronos_error("Invalid handle");
-    goto failXit;
-  }
-
-  if (requestH == NULL) {
-    chronos_error("Invalid packet");
-    goto failXit;
+    return CHRONOS_FAIL;
   }
 
   connectionP = (chronosClientConnection_t *) connH;
+  uringP = connectionP->uringP;
 
-  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
-    chronos_error("Invalid connection state");
-    goto failXit;
+  if (uringP == NULL) {
+    chronos_error("Connection not attached");
+    return CHRONOS_FAIL;
   }
 
-#ifdef CHRONOS_DEBUG_2
-  chronos_info("Sending new transaction request: %d", 
-                chronosRequestTypeGet(requestH));
-#endif
+  if (connectionP->state != CHRONOS_CONNECTION_DISCONNECTED) {
+    chronos_error("Connection must be disconnected first");
+    return CHRONOS_FAIL;
+  }
 
-  buf = (char *)requestH;
-  to_write = chronosRequestSizeGet(requestH);
- 
-  while(to_write >0) {
-    written = write(connectionP->socket_fd, buf, to_write);
-    if (written < 0) {
-      chronos_error("Failed to write to socket");
-      goto failXit;
-    }
+  connectionP->uringP = NULL;
+  uringP->connectionP = NULL;
 
-    to_write -= written;
-    buf += written;
+  if (uringP->numOps == 0) {
+    chronosClientUringFree(uringP);
   }
 
   return CHRONOS_SUCCESS;
-
-failXit:
-  return CHRONOS_FAIL; 
 }
 
-/* 
- * Waits for response from chronos server
+/*
+ * Installs the callback that receives every response as
+ * soon as it arrives. The callback may send new requests
+ * on the connection but must not free it, nor any other
+ * connection. Pass NULL to go back to collecting responses with
+ * chronosClientReceiveResponse*().
  */
 int
-chronosClientReceiveResponse(int *txn_rc_ret, 
-                             CHRONOS_CONN_H connH, 
-                             int (*isTimeToDieFp) (void))
+chronosClientCompletionSet(chronosClientCompletionFp_t completionFp,
+                           void                       *completionArg,
+                           CHRONOS_CONN_H              connH)
 {
-  int rc;
-  int num_bytes;
-  CHRONOS_RESPONSE_H responseH = NULL; 
   chronosClientConnection_t *connectionP = NULL;
-  struct pollfd fds[1];
 
-  if (connH == NULL || txn_rc_ret == NULL) {
+  if (connH == NULL) {
     chronos_error("Invalid handle");
-    goto failXit;
+    return CHRONOS_FAIL;
   }
 
   connectionP = (chronosClientConnection_t *) connH;
 
-  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
-    chronos_error("Invalid connection state");
-    goto failXit;
-  }
+  connectionP->completionFp = completionFp;
+  connectionP->completionArg = completionArg;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Requests submitted with chronosClientSubmit() that are
+ * still in flight complete with CHRONOS_FAIL.
+ */
+int
+chronosClientDisconnect(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
 
-  responseH = chronosResponseAlloc();
-  if (responseH == NULL) {
-    chronos_error("Could not create response");
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
     goto failXit;
   }
 
-  fds[0].fd = connectionP->socket_fd;
-  fds[0].events = POLLIN;
-
-  /* While we are interested in reading from this 
-   * socket 
-   */
-  while(fds[0].events) {
-    char *buf = (char *) responseH;
-    int   to_read = chronosResponseSizeGet(responseH);
+  connectionP = (chronosClientConnection_t *) connH;
 
-    if (isTimeToDieFp()) {
-      chronos_error("requested to die");
-      goto failXit;
+  /* The socket leaves the epoll set before it is closed:
+   * close() alone does not drop it if the descriptor was
+   * duplicated, e.g. by a fork(). Operations an io_uring
+   * has on it are cancelled. The connection stays attached
+   * until its event loop removes it */
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTED
+      || connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+    if (connectionP->epollFd >= 0 
+        && epoll_ctl(connectionP->epollFd, EPOLL_CTL_DEL, connectionP->socket_fd, NULL) < 0) {
+      perror("epoll_ctl() failed");
     }
+    if (connectionP->uringP != NULL) {
+      chronosClientUringCancel(connectionP);
+    }
+    connectionP->epollEvents = 0;
+    if (connectionP->zeroCopyHead != connectionP->zeroCopyTail) {
+      chronosClientZeroCopyDrain(connectionP);
+    }
+    if (connectionP->shmH != NULL) {
+      chronosShmClose(connectionP->shmH);
+      connectionP->shmH = NULL;
+    }
+    else {
+      close(connectionP->socket_fd);
+    }
+    connectionP->socket_fd = -1;
+  }
+
+  connectionP->sendHead = 0;
+  connectionP->sendTail = 0;
+  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
+
+  connectionP->isZeroCopy = 0;
+  connectionP->zeroCopyNextSeq = 0;
+
+  chronosClientSubmittedFail(connectionP);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Builds the socket address of the server: a Unix domain
+ * socket for "unix:<path>" addresses, where the port is
+ * ignored, and an IPv4 address otherwise.
+ */
+static int
+chronosClientSockaddrGet(const char              *serverAddress,
+                         int                      serverPort,
+                         struct sockaddr_storage *addrP,
+                         socklen_t               *addrLenP)
+{
+  size_t pathLen;
+  const char *path = NULL;
+  struct sockaddr_in *inAddrP = NULL;
+  struct sockaddr_un *unAddrP = NULL;
+
+  memset(addrP, 0, sizeof(*addrP));
+
+  if (strncmp(serverAddress, CHRONOS_CLIENT_UNIX_PREFIX, strlen(CHRONOS_CLIENT_UNIX_PREFIX)) == 0) {
+    path = serverAddress + strlen(CHRONOS_CLIENT_UNIX_PREFIX);
+    pathLen = strlen(path);
+
+    unAddrP = (struct sockaddr_un *) addrP;
+    if (pathLen == 0 || pathLen >= sizeof(unAddrP->sun_path)) {
+      chronos_error("Invalid unix socket path: %s", path);
+      return CHRONOS_FAIL;
+    }
+
+    unAddrP->sun_family = AF_UNIX;
+    memcpy(unAddrP->sun_path, path, pathLen);
+    if (path[0] == '@') {
+      unAddrP->sun_path[0] = '\0';
+    }
+
+    *addrLenP = offsetof(struct sockaddr_un, sun_path) + pathLen;
+    return CHRONOS_SUCCESS;
+  }
+
+  if (serverPort == 0) {
+    chronos_error("Invalid server port");
+    return CHRONOS_FAIL;
+  }
+
+  inAddrP = (struct sockaddr_in *) addrP;
+  inAddrP->sin_family = AF_INET;
+  inAddrP->sin_addr.s_addr = inet_addr(serverAddress);
+  inAddrP->sin_port = htons(serverPort);
+
+  *addrLenP = sizeof(*inAddrP);
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Starts a new session on the connection: nothing is
+ * buffered and nothing is in flight.
+ */
+static void
+chronosClientSessionReset(chronosClientConnection_t *connectionP)
+{
+  connectionP->recvHead = 0;
+  connectionP->recvTail = 0;
+  connectionP->isPeerClosed = 0;
+  connectionP->sendHead = 0;
+  connectionP->sendTail = 0;
+
+  memset(connectionP->inFlightArr, 0, sizeof(connectionP->inFlightArr));
+  connectionP->oldestRequestId = connectionP->nextRequestId;
+  connectionP->numInFlight = 0;
+}
+
+/*
+ * Attaches to the shared-memory segment of a server on the
+ * same host. There is nothing to wait for: the connection
+ * is CONNECTED right away.
+ */
+static int
+chronosClientShmConnect(const char                *serverAddress,
+                        const char                *connName,
+                        chronosClientConnection_t *connectionP)
+{
+  CHRONOS_SHM_H shmH = NULL;
+
+  shmH = chronosShmAttach(serverAddress + strlen(CHRONOS_CLIENT_SHM_PREFIX));
+  if (shmH == NULL) {
+    return CHRONOS_FAIL;
+  }
+
+  strncpy(connectionP->serverAddress, 
+          serverAddress, 
+          sizeof(connectionP->serverAddress) - 1);
+  connectionP->serverPort = 0;
+
+  snprintf(connectionP->connectionName,
+           sizeof(connectionP->connectionName),
+           "%s", 
+           (connName != NULL) ? connName : serverAddress);
+
+  connectionP->shmH = shmH;
+  connectionP->socket_fd = -1;
+  connectionP->isTcp = 0;
+  chronosClientSessionReset(connectionP);
+  connectionP->state = CHRONOS_CONNECTION_CONNECTED;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Applies the connection options to a fresh socket, before
+ * it connects so that the buffer sizes are taken into
+ * account in the TCP handshake. Zero-copy sends are
+ * enabled if asked for and the kernel supports them.
+ */
+static int
+chronosClientSocketOptionsApply(int                        socket_fd,
+                                int                        family,
+                                chronosClientConnection_t *connectionP)
+{
+  int rc;
+  int on = 1;
+  const chronosConnOptions_t *optionsP = &(connectionP->options);
+
+  connectionP->isZeroCopy = 0;
+  connectionP->zeroCopyNextSeq = 0;
+
+  if (optionsP->sendBufSize > 0) {
+    rc = setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &(optionsP->sendBufSize), sizeof(int));
+    if (rc == -1) {
+      perror("setsockopt(SO_SNDBUF) failed");
+      goto failXit;
+    }
+  }
+
+  if (optionsP->recvBufSize > 0) {
+    rc = setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &(optionsP->recvBufSize), sizeof(int));
+    if (rc == -1) {
+      perror("setsockopt(SO_RCVBUF) failed");
+      goto failXit;
+    }
+  }
+
+  if (optionsP->priority >= 0) {
+    rc = setsockopt(socket_fd, SOL_SOCKET, SO_PRIORITY, &(optionsP->priority), sizeof(int));
+    if (rc == -1) {
+      perror("setsockopt(SO_PRIORITY) failed");
+      goto failXit;
+    }
+  }
+
+  if (family != AF_INET) {
+    return CHRONOS_SUCCESS;
+  }
+
+  rc = setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &(optionsP->noDelay), sizeof(int));
+  if (rc == -1) {
+    perror("setsockopt(TCP_NODELAY) failed");
+    goto failXit;
+  }
+
+  if (optionsP->zeroCopy) {
+    rc = setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+    if (rc == -1) {
+      chronos_warning("Zero-copy sends not supported, copying instead: %s", strerror(errno));
+    }
+    connectionP->isZeroCopy = (rc == 0);
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Starts connecting to the server without waiting for the
+ * connection to be established. If it cannot complete
+ * right away the connection is left CONNECTING: wait for
+ * its socket to become writable and then call
+ * chronosClientConnectFinish(). Returns CHRONOS_AGAIN,
+ * leaving the connection DISCONNECTED, if the server is on
+ * a unix socket whose listen backlog is full.
+ */
+int
+chronosClientConnectStart(const char *serverAddress,
+                          int serverPort,
+                          const char *connName,
+                          CHRONOS_CONN_H connH) 
+{
+  int on = 1;
+  int socket_fd = -1;
+  int rc = CHRONOS_SUCCESS;
+  chronosClientConnection_t *connectionP = NULL;
+  struct sockaddr_storage chronos_server_address;
+  socklen_t chronos_server_address_len;
+
+  if (connH == NULL) {
+    chronos_error("Invalid connection handle");
+    return CHRONOS_FAIL;
+  }
+
+  if (serverAddress == NULL) {
+    chronos_error("Invalid arguments");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_DISCONNECTED) {
+    chronos_error("Invalid connection state");
+    return CHRONOS_FAIL;
+  }
+
+  if (connectionP->epollFd >= 0 || connectionP->uringP != NULL) {
+    chronos_error("Connection still attached to an event loop");
+    return CHRONOS_FAIL;
+  }
+
+  if (strncmp(serverAddress, CHRONOS_CLIENT_SHM_PREFIX, strlen(CHRONOS_CLIENT_SHM_PREFIX)) == 0) {
+    return chronosClientShmConnect(serverAddress, connName, connectionP);
+  }
+
+  rc = chronosClientSockaddrGet(serverAddress, 
+                                serverPort, 
+                                &chronos_server_address, 
+                                &chronos_server_address_len);
+  if (rc != CHRONOS_SUCCESS) {
+    return CHRONOS_FAIL;
+  }
+
+  strncpy(connectionP->serverAddress, 
+          serverAddress, 
+          sizeof(connectionP->serverAddress));
+  connectionP->serverPort = serverPort;
+
+  if (connName != NULL) {
+    strncpy(connectionP->connectionName, 
+            connName, 
+            sizeof(connectionP->connectionName));
+  }
+  else if (chronos_server_address.ss_family == AF_UNIX) {
+    snprintf(connectionP->connectionName,
+             sizeof(connectionP->connectionName),
+             "%s", 
+             serverAddress);
+  }
+  else {
+    snprintf(connectionP->connectionName,
+             sizeof(connectionP->connectionName),
+             "%s:%d", 
+             serverAddress,
+             serverPort);
+  }
+
+  socket_fd = socket(chronos_server_address.ss_family, SOCK_STREAM, 0);
+  if (socket_fd == -1) {
+    perror("socket() failed");
+    goto failXit;
+  }
+
+  /* Make socket reusable */
+  if (chronos_server_address.ss_family == AF_INET) {
+    rc = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on));
+    if (rc == -1) {
+      perror("setsockopt() failed");
+      goto failXit;
+    }
+  }
+
+  rc = chronosClientSocketOptionsApply(socket_fd, 
+                                       chronos_server_address.ss_family,
+                                       connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  /* Make non-blocking socket */
+  rc = ioctl(socket_fd, FIONBIO, (char *)&on);
+  if (rc < 0) {
+    perror("ioctl() failed");
+    goto failXit;
+  }
+
+  rc = connect(socket_fd, 
+                (struct sockaddr *)&chronos_server_address, 
+                chronos_server_address_len);
+
+  /* A unix socket is never left connecting: when the
+   * server's backlog is full the connect fails with EAGAIN
+   * and has to be tried again */
+  if (rc < 0 && errno == EAGAIN && chronos_server_address.ss_family == AF_UNIX) {
+    close(socket_fd);
+    connectionP->socket_fd = -1;
+    connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
+    return CHRONOS_AGAIN;
+  }
+
+  if (rc < 0 && errno != EINPROGRESS) {
+    perror("connect() failed");
+    goto failXit;
+  }
+
+  connectionP->socket_fd = socket_fd;
+  connectionP->isTcp = (chronos_server_address.ss_family == AF_INET);
+  chronosClientSessionReset(connectionP);
+
+  connectionP->state = (rc == 0) ? CHRONOS_CONNECTION_CONNECTED : CHRONOS_CONNECTION_CONNECTING;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  if (socket_fd >= 0) {
+    close(socket_fd);
+  }
+  connectionP->socket_fd = -1;
+  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Completes a connection started with
+ * chronosClientConnectStart(). Returns CHRONOS_TIMEOUT if
+ * the connection is still in progress. On failure the
+ * connection goes back to DISCONNECTED.
+ */
+int
+chronosClientConnectFinish(CHRONOS_CONN_H connH)
+{
+  int rc;
+  int result;
+  socklen_t result_len = sizeof(result);
+  char errMsg[256];
+  chronosClientConnection_t *connectionP = NULL;
+  struct pollfd fds[1];
+
+  if (connH == NULL) {
+    chronos_error("Invalid connection handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+    return CHRONOS_SUCCESS;
+  }
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTING) {
+    chronos_error("Invalid connection state");
+    return CHRONOS_FAIL;
+  }
+
+  /* SO_ERROR reads 0 while the connect is in progress, so
+   * make sure it is over first */
+  fds[0].fd = connectionP->socket_fd;
+  fds[0].events = POLLOUT;
+  rc = poll(fds, 1, 0);
+  if (rc < 0) {
+    if (errno == EINTR) {
+      return CHRONOS_TIMEOUT;
+    }
+    perror("poll() failed");
+    goto failXit;
+  }
+  else if (rc == 0) {
+    return CHRONOS_TIMEOUT;
+  }
+
+  rc = getsockopt(connectionP->socket_fd, SOL_SOCKET, SO_ERROR, &result, &result_len);
+  if (rc < 0) {
+    perror("getsockopt() failed");
+    goto failXit; 
+  }
+
+  if (result != 0) {
+    chronos_error("connect() failed: %s", strerror_r(result, errMsg, sizeof(errMsg)));
+    goto failXit;
+  }
+
+  connectionP->state = CHRONOS_CONNECTION_CONNECTED;
+
+  rc = chronosClientEpollUpdate(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  chronosClientDisconnect(connH);
+  return CHRONOS_FAIL; 
+}
+
+int
+chronosClientConnect(const char *serverAddress,
+                     int serverPort,
+                     const char *connName,
+                     CHRONOS_CONN_H connH) 
+{
+  int retry;
+  int rc = CHRONOS_SUCCESS;
+  useconds_t backoffUs = 1000;
+  chronosClientConnection_t *connectionP = NULL;
+  struct pollfd fds[1];
+
+  for (retry=0; ; retry++) {
+    rc = chronosClientConnectStart(serverAddress, serverPort, connName, connH);
+    if (rc != CHRONOS_AGAIN || retry == CHRONOS_CLIENT_UNIX_CONNECT_RETRIES) {
+      break;
+    }
+    usleep(backoffUs);
+    backoffUs *= 2;
+  }
+  if (rc != CHRONOS_SUCCESS) {
+    if (rc == CHRONOS_AGAIN) {
+      chronos_error("Server backlog full, giving up");
+    }
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  fds[0].fd = connectionP->socket_fd;
+  fds[0].events = POLLOUT;
+
+  /* wait for connect to complete */
+  while (connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+    rc = poll(fds, 1, 1000 /* one second */);
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll() failed");
+      chronosClientDisconnect(connH);
+      return CHRONOS_FAIL;
+    }
+
+    /* poll timed out */
+    if (rc == 0) {
+      continue;
+    }
+
+    rc = chronosClientConnectFinish(connH);
+    if (rc == CHRONOS_FAIL) {
+      return CHRONOS_FAIL;
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Same as chronosClientConnect() with the given options,
+ * which the connection keeps for later reconnects.
+ */
+int
+chronosClientConnectWithOptions(const char                 *serverAddress,
+                                int                         serverPort,
+                                const char                 *connName,
+                                const chronosConnOptions_t *optionsP,
+                                CHRONOS_CONN_H              connH)
+{
+  int rc;
+
+  rc = chronosClientOptionsSet(optionsP, connH);
+  if (rc != CHRONOS_SUCCESS) {
+    return CHRONOS_FAIL;
+  }
+
+  return chronosClientConnect(serverAddress, serverPort, connName, connH);
+}
+
+/*
+ * Fills in the options of a connection profile. New
+ * connection handles start with the LATENCY one.
+ */
+void
+chronosConnOptionsInit(chronosConnProfile_t  profile,
+                       chronosConnOptions_t *optionsP)
+{
+  memset(optionsP, 0, sizeof(*optionsP));
+
+  optionsP->noDelay = 1;
+  optionsP->priority = -1;
+
+  if (profile == CHRONOS_CONN_PROFILE_BULK) {
+    optionsP->cork = 1;
+  }
+  else {
+    optionsP->quickAck = 1;
+  }
+}
+
+CHRONOS_CONN_H
+chronosConnHandleAlloc(CHRONOS_ENV_H envH)
+{
+  int rc = CHRONOS_SUCCESS;
+  chronosClientConnection_t *connectionP = NULL;
+
+  connectionP = malloc(sizeof(chronosClientConnection_t));
+  if (connectionP == NULL) {
+    chronos_error("Could not allocate connection handle");
+    goto failXit;
+  }
+
+  memset(connectionP, 0, sizeof(*connectionP));
+
+  rc = chronosEnvCheck(envH);
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_error("Bad env handle");
+    goto failXit;
+  }
+
+  connectionP->envH = envH;
+  connectionP->epollFd = -1;
+  connectionP->sendLimit = CHRONOS_CLIENT_SEND_LIMIT;
+  chronosConnOptionsInit(CHRONOS_CONN_PROFILE_LATENCY, &(connectionP->options));
+  connectionP->state = CHRONOS_CONNECTION_DISCONNECTED;
+
+  connectionP->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (connectionP->wakeupFd < 0) {
+    perror("eventfd() failed");
+    goto failXit;
+  }
+  goto cleanup;
+
+failXit:
+  if (connectionP != NULL) {
+    free(connectionP);
+    connectionP = NULL;
+  }
+  
+cleanup:
+  return  (void *) connectionP;
+}
+
+int
+chronosConnHandleFree(CHRONOS_CONN_H connH) 
+{
+  int rc = CHRONOS_SUCCESS;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_DISCONNECTED
+      || connectionP->epollFd >= 0
+      || connectionP->uringP != NULL) {
+    chronos_error("Invalid state");
+    goto failXit;
+  }
+
+  rc = chronosEnvCheck(connectionP->envH);
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_error("Bad env handle");
+    goto failXit;
+  }
+  
+  if (connectionP->sendBufP != NULL) {
+    free(connectionP->sendBufP);
+  }
+
+  if (connectionP->zeroCopyHeldArr != NULL) {
+    free(connectionP->zeroCopyHeldArr);
+  }
+
+  if (connectionP->ownsCompletionQueue) {
+    chronosCompletionQueueFree(connectionP->completionQueueP);
+  }
+
+  close(connectionP->wakeupFd);
+
+  memset(connectionP, 0, sizeof(*connectionP));
+  free(connectionP);
+
+  goto cleanup;
+
+failXit:
+  rc = CHRONOS_FAIL;
+
+cleanup:
+  return rc;
+}
+
+/*
+ * Sets the options the connection applies to its socket.
+ * Corking and quick ACKs take effect right away, the
+ * socket options the next time it connects.
+ */
+int
+chronosClientOptionsSet(const chronosConnOptions_t *optionsP,
+                        CHRONOS_CONN_H              connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || optionsP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+  connectionP->options = *optionsP;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Releases the requests held for zero-copy sends lo to hi.
+ * If isAbandon, all of them are let go of instead, without
+ * freeing them: the kernel may still read their pages.
+ */
+static void
+chronosClientZeroCopyDone(uint32_t                   lo,
+                          uint32_t                   hi,
+                          int                        isAbandon,
+                          chronosClientConnection_t *connectionP)
+{
+  int i;
+  chronosZeroCopyHeld_t *heldP = NULL;
+
+  for (i=connectionP->zeroCopyHead; i<connectionP->zeroCopyTail; i++) {
+    heldP = &(connectionP->zeroCopyHeldArr[i]);
+    if (heldP->isDone) {
+      continue;
+    }
+
+    if (isAbandon) {
+      heldP->requestH = NULL;
+      heldP->isDone = 1;
+    }
+    /* The range may wrap around */
+    else if (heldP->seq - lo <= hi - lo) {
+      chronosRequestFree(heldP->requestH);
+      heldP->requestH = NULL;
+      heldP->isDone = 1;
+    }
+  }
+
+  while (connectionP->zeroCopyHead < connectionP->zeroCopyTail
+         && connectionP->zeroCopyHeldArr[connectionP->zeroCopyHead].isDone) {
+    connectionP->zeroCopyHead ++;
+  }
+
+  if (connectionP->zeroCopyHead == connectionP->zeroCopyTail) {
+    connectionP->zeroCopyHead = 0;
+    connectionP->zeroCopyTail = 0;
+  }
+}
+
+/*
+ * Holds on to the requests that went out in the zero-copy
+ * send being numbered now.
+ */
+static int
+chronosClientZeroCopyHold(CHRONOS_REQUEST_H         *requestArr,
+                          int                        numRequests,
+                          chronosClientConnection_t *connectionP)
+{
+  int i;
+  int newSize;
+  chronosZeroCopyHeld_t *newArr = NULL;
+  chronosZeroCopyHeld_t *heldP = NULL;
+
+  if (connectionP->zeroCopyTail + numRequests > connectionP->zeroCopySize) {
+    /* Slide what is still held to the front first */
+    if (connectionP->zeroCopyHead > 0) {
+      memmove(connectionP->zeroCopyHeldArr,
+              connectionP->zeroCopyHeldArr + connectionP->zeroCopyHead,
+              (connectionP->zeroCopyTail - connectionP->zeroCopyHead) * sizeof(chronosZeroCopyHeld_t));
+      connectionP->zeroCopyTail -= connectionP->zeroCopyHead;
+      connectionP->zeroCopyHead = 0;
+    }
+
+    newSize = (connectionP->zeroCopySize > 0) ? connectionP->zeroCopySize : CHRONOS_CLIENT_MAX_INFLIGHT;
+    while (newSize < connectionP->zeroCopyTail + numRequests) {
+      newSize *= 2;
+    }
+
+    if (newSize > connectionP->zeroCopySize) {
+      newArr = realloc(connectionP->zeroCopyHeldArr, newSize * sizeof(chronosZeroCopyHeld_t));
+      if (newArr == NULL) {
+        chronos_error("Could not grow zero-copy list to %d entries", newSize);
+        return CHRONOS_FAIL;
+      }
+      connectionP->zeroCopyHeldArr = newArr;
+      connectionP->zeroCopySize = newSize;
+    }
+  }
+
+  for (i=0; i<numRequests; i++) {
+    heldP = &(connectionP->zeroCopyHeldArr[connectionP->zeroCopyTail]);
+    heldP->seq = connectionP->zeroCopyNextSeq;
+    heldP->isDone = 0;
+    heldP->requestH = requestArr[i];
+    chronosRequestRetain(requestArr[i]);
+    connectionP->zeroCopyTail ++;
+  }
+
+  connectionP->zeroCopyNextSeq ++;
+  connectionP->numZeroCopySends ++;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Reads the kernel's zero-copy notifications off the
+ * socket's error queue, without blocking, and releases the
+ * requests they cover. Returns CHRONOS_TIMEOUT if there
+ * was none.
+ */
+static int
+chronosClientZeroCopyReap(chronosClientConnection_t *connectionP)
+{
+  int numReaped = 0;
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cmsgP = NULL;
+  struct sock_extended_err *errP = NULL;
+
+  while (1) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(connectionP->socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      else if (errno == EINTR) {
+        continue;
+      }
+      perror("recvmsg() failed");
+      return CHRONOS_FAIL;
+    }
+
+    for (cmsgP = CMSG_FIRSTHDR(&msg); cmsgP != NULL; cmsgP = CMSG_NXTHDR(&msg, cmsgP)) {
+      if (cmsgP->cmsg_level != SOL_IP || cmsgP->cmsg_type != IP_RECVERR) {
+        continue;
+      }
+
+      errP = (struct sock_extended_err *) CMSG_DATA(cmsgP);
+      if (errP->ee_errno != 0 || errP->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+
+      /* The kernel had to copy after all, e.g. on loopback */
+      if (errP->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        connectionP->numZeroCopyCopied += errP->ee_data - errP->ee_info + 1;
+      }
+
+      chronosClientZeroCopyDone(errP->ee_info, errP->ee_data, 0, connectionP);
+      numReaped ++;
+    }
+  }
+
+  return (numReaped > 0) ? CHRONOS_SUCCESS : CHRONOS_TIMEOUT;
+}
+
+/*
+ * Called before the socket is closed: the kernel may still
+ * send, or resend, queued data from the pages of requests
+ * it has not released, so those must not be recycled yet.
+ * Shuts the socket down, so that nothing new is queued,
+ * and reaps notifications for up to
+ * CHRONOS_CLIENT_ZEROCOPY_DRAIN_MS. Requests still held
+ * after that are leaked rather than handed out again.
+ */
+static void
+chronosClientZeroCopyDrain(chronosClientConnection_t *connectionP)
+{
+  int waitMs;
+  uint64_t deadlineNs;
+  uint64_t nowNs;
+  struct pollfd fds[1];
+
+  if (connectionP->zeroCopyHead == connectionP->zeroCopyTail) {
+    return;
+  }
+
+  if (shutdown(connectionP->socket_fd, SHUT_WR) < 0 && errno != ENOTCONN) {
+    perror("shutdown() failed");
+  }
+
+  deadlineNs = chronosLatencyNowNs() + CHRONOS_CLIENT_ZEROCOPY_DRAIN_MS * 1000000ULL;
+
+  while (connectionP->zeroCopyHead != connectionP->zeroCopyTail) {
+    if (chronosClientZeroCopyReap(connectionP) == CHRONOS_FAIL) {
+      break;
+    }
+    if (connectionP->zeroCopyHead == connectionP->zeroCopyTail) {
+      break;
+    }
+
+    nowNs = chronosLatencyNowNs();
+    if (nowNs >= deadlineNs) {
+      break;
+    }
+    waitMs = (int) ((deadlineNs - nowNs + 999999) / 1000000);
+
+    /* Notifications raise POLLERR, which poll always reports */
+    fds[0].fd = connectionP->socket_fd;
+    fds[0].events = 0;
+    fds[0].revents = 0;
+    if (poll(fds, 1, waitMs) < 0 && errno != EINTR) {
+      perror("poll() failed");
+      break;
+    }
+  }
+
+  if (connectionP->zeroCopyHead != connectionP->zeroCopyTail) {
+    chronos_warning("Leaking %d requests the kernel did not release",
+                    connectionP->zeroCopyTail - connectionP->zeroCopyHead);
+    chronosClientZeroCopyDone(0, 0, 1, connectionP);
+  }
+}
+
+/*
+ * Writes what the socket takes of the batch with
+ * MSG_ZEROCOPY, holding on to every request whose frame
+ * went out. Trims the iovec array like
+ * chronosClientSendQueue() and sets *numSentP to the
+ * number of its buffers that went out completely.
+ */
+static int
+chronosClientZeroCopySend(CHRONOS_REQUEST_H         *requestArr,
+                          struct iovec              *iov,
+                          int                        iovcnt,
+                          int                       *numSentP,
+                          chronosClientConnection_t *connectionP)
+{
+  int i = 0;
+  int first;
+  int rc;
+  ssize_t written;
+  struct msghdr msg;
+
+  while (i < iovcnt) {
+    /* Notifications are normally reaped as they come. A
+     * sender that never waits gets the rest of the batch
+     * copied once it holds a window's worth of requests */
+    if (connectionP->zeroCopyTail - connectionP->zeroCopyHead >= CHRONOS_CLIENT_MAX_INFLIGHT) {
+      if (chronosClientZeroCopyReap(connectionP) == CHRONOS_FAIL) {
+        goto failXit;
+      }
+      if (connectionP->zeroCopyTail - connectionP->zeroCopyHead >= CHRONOS_CLIENT_MAX_INFLIGHT) {
+        break;
+      }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov + i;
+    msg.msg_iovlen = iovcnt - i;
+
+    written = sendmsg(connectionP->socket_fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      /* ENOBUFS: too many notifications outstanding, the
+       * rest of the batch is copied */
+      else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        break;
+      }
+      chronos_error("Failed to write to socket");
+      goto failXit;
+    }
+
+    first = i;
+    while (i < iovcnt && (size_t) written >= iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      i ++;
+    }
+
+    if (i < iovcnt && written > 0) {
+      iov[i].iov_base = (char *) iov[i].iov_base + written;
+      iov[i].iov_len -= written;
+    }
+
+    rc = chronosClientZeroCopyHold(requestArr + first, 
+                                   i - first + ((written > 0) ? 1 : 0), 
+                                   connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  *numSentP = i;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * The transport under the connection is a socket or, for
+ * shared-memory connections, a pair of rings. Either way
+ * it behaves like a non-blocking socket. Writing to a
+ * socket the peer reset fails with EPIPE instead of
+ * raising SIGPIPE.
+ */
+static ssize_t
+chronosClientTransportWritev(chronosClientConnection_t *connectionP,
+                             const struct iovec        *iov,
+                             int                        iovcnt)
+{
+  struct msghdr msg;
+
+  if (connectionP->shmH != NULL) {
+    return chronosShmWritev(iov, iovcnt, connectionP->shmH);
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *) iov;
+  msg.msg_iovlen = iovcnt;
+
+  return sendmsg(connectionP->socket_fd, &msg, MSG_NOSIGNAL);
+}
+
+static ssize_t
+chronosClientTransportRead(chronosClientConnection_t *connectionP,
+                           void                      *buf,
+                           size_t                     len)
+{
+  if (connectionP->shmH != NULL) {
+    return chronosShmRead(buf, len, connectionP->shmH);
+  }
+
+  return read(connectionP->socket_fd, buf, len);
+}
+
+/*
+ * Consumes pending chronosClientInterrupt() wakeups.
+ * Returns whether there was any.
+ */
+static int
+chronosClientWakeupClear(chronosClientConnection_t *connectionP)
+{
+  int isWakeup = 0;
+  uint64_t value;
+
+  while (read(connectionP->wakeupFd, &value, sizeof(value)) > 0) {
+    isWakeup = 1;
+  }
+
+  return isWakeup;
+}
+
+/*
+ * Waits until the transport is ready for the given poll()
+ * events, for up to *timeoutP (NULL waits forever). If
+ * isInterruptedP is given, chronosClientInterrupt() also
+ * ends the wait and sets it. Returns CHRONOS_TIMEOUT if
+ * nothing happened in time.
+ */
+static int
+chronosClientTransportWait(chronosClientConnection_t *connectionP,
+                           short                      events,
+                           const struct timespec     *timeoutP,
+                           short                     *reventsP,
+                           int                       *isInterruptedP)
+{
+  int rc;
+  int nfds = 1;
+  struct pollfd fds[2];
+
+  *reventsP = 0;
+  if (isInterruptedP != NULL) {
+    *isInterruptedP = 0;
+  }
+
+  if (connectionP->shmH != NULL) {
+    rc = chronosShmWait(events, timeoutP, reventsP, connectionP->shmH);
+    if (isInterruptedP != NULL && chronosClientWakeupClear(connectionP)) {
+      *isInterruptedP = 1;
+    }
+    return rc;
+  }
+
+  /* The loop owns the socket: there is nothing to wait
+   * for here, only a check that found nothing */
+  if (connectionP->uringP != NULL) {
+    if (timeoutP != NULL && timeoutP->tv_sec == 0 && timeoutP->tv_nsec == 0) {
+      return CHRONOS_TIMEOUT;
+    }
+    chronos_error("Connection is driven by an io_uring event loop");
+    return CHRONOS_FAIL;
+  }
+
+  fds[0].fd = connectionP->socket_fd;
+  fds[0].events = events;
+  fds[0].revents = 0;
+
+  if (isInterruptedP != NULL) {
+    fds[1].fd = connectionP->wakeupFd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    nfds = 2;
+  }
+
+  rc = ppoll(fds, nfds, timeoutP, NULL);
+  if (rc < 0) {
+    if (errno == EINTR) {
+      return CHRONOS_SUCCESS;
+    }
+    perror("ppoll() failed");
+    return CHRONOS_FAIL;
+  }
+  else if (rc == 0) {
+    return CHRONOS_TIMEOUT;
+  }
+
+  if (isInterruptedP != NULL && fds[1].revents) {
+    chronosClientWakeupClear(connectionP);
+    *isInterruptedP = 1;
+  }
+
+  /* Zero-copy notifications show up as POLLERR */
+  if ((fds[0].revents & POLLERR) && connectionP->isZeroCopy) {
+    rc = chronosClientZeroCopyReap(connectionP);
+    if (rc == CHRONOS_FAIL) {
+      return CHRONOS_FAIL;
+    }
+    else if (rc == CHRONOS_SUCCESS) {
+      fds[0].revents &= ~POLLERR;
+    }
+  }
+
+  *reventsP = fds[0].revents;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Writes what the socket takes of the iovec array without
+ * blocking and appends the rest to the connection's send
+ * buffer. If earlier bytes are still waiting there, or the
+ * send is corked, the whole array is appended so that
+ * frames stay in order. The iovec array is consumed in the
+ * process.
+ */
+static int
+chronosClientSendQueue(chronosClientConnection_t *connectionP,
+                       struct iovec              *iov,
+                       int                        iovcnt,
+                       int                        isCorked)
+{
+  int i;
+  ssize_t written;
+  size_t pending;
+  size_t needed;
+  size_t newSize;
+  char *newBufP = NULL;
+
+  /* In an io_uring event loop every write goes through
+   * the ring, so the data is only queued here */
+  while (iovcnt > 0 && connectionP->sendTail == connectionP->sendHead 
+         && !isCorked && connectionP->uringP == NULL) {
+    written = chronosClientTransportWritev(connectionP, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      chronos_error("Failed to write to socket");
+      goto failXit;
+    }
+
+    /* Skip the buffers that went out completely and
+     * trim the one that went out partially */
+    while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov ++;
+      iovcnt --;
+    }
+
+    if (iovcnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  if (iovcnt == 0) {
+    return CHRONOS_SUCCESS;
+  }
+
+  needed = 0;
+  for (i=0; i<iovcnt; i++) {
+    needed += iov[i].iov_len;
+  }
+
+  /* Slide pending bytes to the front, then grow if needed */
+  pending = connectionP->sendTail - connectionP->sendHead;
+  if (connectionP->sendHead > 0) {
+    if (pending > 0) {
+      memmove(connectionP->sendBufP,
+              connectionP->sendBufP + connectionP->sendHead,
+              pending);
+    }
+    connectionP->sendHead = 0;
+    connectionP->sendTail = pending;
+  }
+
+  if (pending + needed > connectionP->sendBufSize) {
+    newSize = (connectionP->sendBufSize > 0) ? connectionP->sendBufSize : CHRONOS_CLIENT_RECV_BUF_SIZE;
+    while (newSize < pending + needed) {
+      newSize *= 2;
+    }
+
+    newBufP = realloc(connectionP->sendBufP, newSize);
+    if (newBufP == NULL) {
+      chronos_error("Could not grow send buffer to %zu bytes", newSize);
+      goto failXit;
+    }
+    connectionP->sendBufP = newBufP;
+    connectionP->sendBufSize = newSize;
+  }
+
+  for (i=0; i<iovcnt; i++) {
+    memcpy(connectionP->sendBufP + connectionP->sendTail, iov[i].iov_base, iov[i].iov_len);
+    connectionP->sendTail += iov[i].iov_len;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Writes as much of the send buffer as the socket takes,
+ * without blocking.
+ */
+static int
+chronosClientSendFlush(chronosClientConnection_t *connectionP)
+{
+  ssize_t written;
+  struct iovec iov;
+
+  if (connectionP->uringP != NULL) {
+    return CHRONOS_SUCCESS;
+  }
+
+  while (connectionP->sendHead < connectionP->sendTail) {
+    iov.iov_base = connectionP->sendBufP + connectionP->sendHead;
+    iov.iov_len = connectionP->sendTail - connectionP->sendHead;
+    written = chronosClientTransportWritev(connectionP, &iov, 1);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      chronos_error("Failed to write to socket");
+      goto failXit;
+    }
+
+    connectionP->sendHead += written;
+  }
+
+  if (connectionP->sendHead == connectionP->sendTail) {
+    connectionP->sendHead = 0;
+    connectionP->sendTail = 0;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Waits until no more than maxPending bytes are left in the
+ * send buffer and, if needWindow, until the in-flight
+ * window has room for one more request. Responses that
+ * arrive meanwhile are read and dispatched: a server
+ * blocked writing them would otherwise never read what we
+ * are waiting to send, and they are what frees the window.
+ * Returns CHRONOS_TIMEOUT if timeoutP (NULL waits forever)
+ * expired or chronosClientInterrupt() was called. The
+ * timeout bounds the whole wait, not each poll.
+ */
+static int
+chronosClientSendWaitFor(size_t                     maxPending,
+                         int                        needWindow,
+                         const struct timespec     *timeoutP,
+                         chronosClientConnection_t *connectionP)
+{
+  int rc;
+  int isInterrupted;
+  int isWindowFull;
+  short events;
+  short revents;
+  uint64_t deadlineNs = 0;
+  uint64_t nowNs;
+  struct timespec remaining;
+
+  if (timeoutP != NULL) {
+    deadlineNs = chronosLatencyNowNs() 
+                 + (uint64_t) timeoutP->tv_sec * 1000000000ULL + timeoutP->tv_nsec;
+  }
+
+  while (1) {
+    isWindowFull = needWindow 
+                   && connectionP->nextRequestId - connectionP->oldestRequestId >= CHRONOS_CLIENT_MAX_INFLIGHT;
+
+    if (connectionP->sendTail - connectionP->sendHead <= maxPending && !isWindowFull) {
+      break;
+    }
+
+    /* Only collecting the oldest response frees the window */
+    if (isWindowFull
+        && connectionP->sendTail == connectionP->sendHead
+        && connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(connectionP->oldestRequestId)].state == CHRONOS_INFLIGHT_DONE) {
+      chronos_error("In-flight window is held by uncollected responses");
+      goto failXit;
+    }
+
+    events = 0;
+    if (connectionP->sendTail != connectionP->sendHead) {
+      events |= POLLOUT;
+    }
+    if (connectionP->numInFlight > 0) {
+      events |= POLLIN;
+    }
+
+    if (timeoutP != NULL) {
+      nowNs = chronosLatencyNowNs();
+      if (nowNs >= deadlineNs) {
+        return CHRONOS_TIMEOUT;
+      }
+      remaining.tv_sec = (deadlineNs - nowNs) / 1000000000ULL;
+      remaining.tv_nsec = (deadlineNs - nowNs) % 1000000000ULL;
+    }
+
+    rc = chronosClientTransportWait(connectionP, 
+                                    events, 
+                                    (timeoutP != NULL) ? &remaining : NULL, 
+                                    &revents, 
+                                    &isInterrupted);
+    if (rc != CHRONOS_SUCCESS) {
+      return rc;
+    }
+
+    if (isInterrupted) {
+      return CHRONOS_TIMEOUT;
+    }
+
+    if (revents & ~POLLOUT) {
+      rc = chronosClientRecvFill(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+
+      rc = chronosClientResponsesDispatch(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+
+    if (revents & POLLOUT) {
+      rc = chronosClientSendFlush(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Waits until the send buffer is empty.
+ */
+static int
+chronosClientSendDrain(chronosClientConnection_t *connectionP)
+{
+  int rc;
+  struct timespec timeout = { 1, 0 };
+
+  do {
+    rc = chronosClientSendWaitFor(0, 0, &timeout, connectionP);
+  } while (rc == CHRONOS_TIMEOUT);
+
+  return rc;
+}
+
+/*
+ * Applies backpressure to non-blocking sends: returns
+ * CHRONOS_AGAIN if numRequests more would overflow the
+ * in-flight window, or if the send buffer is still at its
+ * limit after writing what the socket takes.
+ */
+static int
+chronosClientSendRoomCheck(int                        numRequests,
+                           chronosClientConnection_t *connectionP)
+{
+  int rc;
+
+  if (numRequests > 0 && numRequests <= CHRONOS_CLIENT_MAX_INFLIGHT
+      && connectionP->nextRequestId - connectionP->oldestRequestId + numRequests > CHRONOS_CLIENT_MAX_INFLIGHT) {
+    return CHRONOS_AGAIN;
+  }
+
+  if (connectionP->sendTail - connectionP->sendHead < connectionP->sendLimit) {
+    return CHRONOS_SUCCESS;
+  }
+
+  rc = chronosClientSendFlush(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    return CHRONOS_FAIL;
+  }
+
+  if (connectionP->sendTail - connectionP->sendHead < connectionP->sendLimit) {
+    return CHRONOS_SUCCESS;
+  }
+
+  /* Make sure the event loop resumes writing */
+  rc = chronosClientEpollUpdate(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    return CHRONOS_FAIL;
+  }
+
+  return CHRONOS_AGAIN;
+}
+
+/*
+ * Stamps each request with a fresh request id, encodes the
+ * batch and queues it for sending with a single sendmsg()
+ * call (none if corked), then marks the requests in
+ * flight. Large batches on zero-copy connections go out
+ * with sendmsg(MSG_ZEROCOPY) instead.
+ */
+static int
+chronosClientRequestsQueue(CHRONOS_REQUEST_H         *requestArr,
+                           int                        numRequests,
+                           const uint64_t            *userTagArr,
+                           int                        isCorked,
+                           chronosClientConnection_t *connectionP)
+{
+  int i;
+  int rc;
+  int numSent = 0;
+  size_t frameSize;
+  size_t batchSize = 0;
+  unsigned int requestId;
+  uint64_t startNs;
+  uint64_t sentNs;
+  const char *frame = NULL;
+  chronosInFlight_t *slotP = NULL;
+  struct iovec iov[CHRONOS_CLIENT_MAX_INFLIGHT];
+
+  if (requestArr == NULL || numRequests <= 0 || numRequests > CHRONOS_CLIENT_MAX_INFLIGHT) {
+    chronos_error("Invalid request batch");
+    goto failXit;
+  }
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  if (connectionP->nextRequestId - connectionP->oldestRequestId + numRequests > CHRONOS_CLIENT_MAX_INFLIGHT) {
+    chronos_error("Too many requests in flight: %d", connectionP->numInFlight);
+    goto failXit;
+  }
+
+  startNs = chronosLatencyNowNs();
+
+  for (i=0; i<numRequests; i++) {
+    if (requestArr[i] == NULL) {
+      chronos_error("Invalid packet");
+      goto failXit;
+    }
+
+#ifdef CHRONOS_DEBUG_2
+    chronos_info("Sending new transaction request: %d", 
+                  chronosRequestTypeGet(requestArr[i]));
+#endif
+
+    requestId = connectionP->nextRequestId + i;
+    assert(connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(requestId)].state == CHRONOS_INFLIGHT_FREE);
+
+    chronosRequestIdSet(requestId, requestArr[i]);
+
+    /* Only the used part of the request goes on the wire */
+    rc = chronosRequestEncode(requestArr[i], &frame, &frameSize);
+    if (rc != CHRONOS_SUCCESS) {
+      chronos_error("Could not encode request");
+      goto failXit;
+    }
+
+    iov[i].iov_base = (void *) frame;
+    iov[i].iov_len = frameSize;
+    batchSize += frameSize;
+  }
+
+  if (connectionP->isZeroCopy 
+      && !isCorked
+      && connectionP->uringP == NULL
+      && batchSize >= CHRONOS_CLIENT_ZEROCOPY_MIN_SIZE
+      && connectionP->sendTail == connectionP->sendHead) {
+    rc = chronosClientZeroCopySend(requestArr, iov, numRequests, &numSent, connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  /* Whatever zero-copy did not send is copied */
+  rc = chronosClientSendQueue(connectionP, iov + numSent, numRequests - numSent, isCorked);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  /* The cost of a batch is split evenly among its requests */
+  sentNs = chronosLatencyNowNs();
+
+  /* A new burst of responses is coming */
+  if (connectionP->numInFlight == 0) {
+    connectionP->isQuickAckDue = 1;
+  }
+
+  for (i=0; i<numRequests; i++) {
+    requestId = connectionP->nextRequestId;
+    slotP = &(connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(requestId)]);
+    slotP->state = CHRONOS_INFLIGHT_PENDING;
+    slotP->requestId = requestId;
+    slotP->txnType = chronosRequestTypeGet(requestArr[i]);
+    slotP->submitNs = startNs;
+    slotP->sentNs = sentNs;
+    slotP->isSubmitted = (userTagArr != NULL);
+    slotP->userTag = (userTagArr != NULL) ? userTagArr[i] : 0;
+    slotP->deadlineNs = chronosRequestDeadlineGet(requestArr[i]);
+    chronosLatencyRecord(slotP->txnType, 
+                         CHRONOS_LATENCY_SEND, 
+                         (sentNs - startNs) / numRequests);
+    connectionP->nextRequestId ++;
+    connectionP->numInFlight ++;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Sends a batch of transaction requests to the Chronos
+ * Server with a single sendmsg() call, waiting until all
+ * of it has been written. Each request is stamped with a
+ * fresh request id, which can be read back with
+ * chronosRequestIdGet(). Up to CHRONOS_CLIENT_MAX_INFLIGHT
+ * requests can be sent before their responses are
+ * collected.
+ */
+int
+chronosClientSendRequests(CHRONOS_REQUEST_H *requestArr,
+                          int                numRequests,
+                          CHRONOS_CONN_H     connH)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  rc = chronosClientRequestsQueue(requestArr, numRequests, NULL, 0, connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  rc = chronosClientSendDrain(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Like chronosClientSendRequests() but never blocks: what
+ * the socket does not take right away stays in the
+ * connection's send buffer, to be written by
+ * chronosClientFlush() or by the event loop the connection
+ * is attached to. On corked connections (see
+ * chronosConnOptions_t) nothing is written right away. The
+ * requests can be freed on return.
+ *
+ * If the send buffer is at its limit (see
+ * chronosClientSendLimitSet()) or the in-flight window
+ * has no room for the batch, nothing is sent and
+ * CHRONOS_AGAIN is returned: try again once the socket
+ * drained, e.g. after chronosClientSendWait(), or once
+ * responses came back.
+ */
+int
+chronosClientSendRequestsNoWait(CHRONOS_REQUEST_H *requestArr,
+                                int                numRequests,
+                                CHRONOS_CONN_H     connH)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  rc = chronosClientSendRoomCheck(numRequests, connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    return rc;
+  }
+
+  rc = chronosClientRequestsQueue(requestArr, numRequests, NULL, connectionP->options.cork, connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  rc = chronosClientEpollUpdate(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Writes as much of the pending send buffer as the socket
+ * takes, without blocking.
+ */
+int
+chronosClientFlush(CHRONOS_CONN_H connH)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  rc = chronosClientSendFlush(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  rc = chronosClientEpollUpdate(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+size_t
+chronosClientSendPendingGet(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return 0;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  /* Count what an io_uring send still has in flight too */
+  if (connectionP->uringP != NULL && connectionP->uringP->isSendArmed) {
+    return connectionP->sendTail - connectionP->sendHead 
+           + connectionP->uringP->sendLen - connectionP->uringP->sendOff;
+  }
+
+  return connectionP->sendTail - connectionP->sendHead;
+}
+
+/*
+ * Caps the bytes a connection buffers for sending before
+ * non-blocking sends are refused with CHRONOS_AGAIN. A
+ * single batch may go over it.
+ */
+int
+chronosClientSendLimitSet(size_t         sendLimit,
+                          CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || sendLimit == 0) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+  connectionP->sendLimit = sendLimit;
+
+  return CHRONOS_SUCCESS;
+}
+
+size_t
+chronosClientSendLimitGet(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return 0;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  return connectionP->sendLimit;
+}
+
+/*
+ * Parks the caller until the connection takes
+ * non-blocking sends again, or for up to timeoutMs (-1
+ * waits forever): until its send buffer is below the
+ * limit and its in-flight window has room. Responses
+ * arriving meanwhile are collected. Returns
+ * CHRONOS_TIMEOUT if the time ran out or
+ * chronosClientInterrupt() was called, and CHRONOS_FAIL
+ * if the window is full of responses that are waiting
+ * to be received.
+ */
+int
+chronosClientSendWait(int            timeoutMs,
+                      CHRONOS_CONN_H connH)
+{
+  struct timespec timeout;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    return CHRONOS_FAIL;
+  }
+
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+  return chronosClientSendWaitFor(connectionP->sendLimit - 1,
+                                  1,
+                                  (timeoutMs < 0) ? NULL : &timeout,
+                                  connectionP);
+}
+
+/*
+ * Sends a transaction request to the Chronos Server
+ */
+int
+chronosClientSendRequest(CHRONOS_REQUEST_H    requestH,
+                         CHRONOS_CONN_H connH)
+{
+  return chronosClientSendRequests(&requestH, 1, connH);
+}
+
+/*
+ * Drains whatever the socket has available into the
+ * connection's receive buffer, using as few read() calls
+ * as the free space allows. Stops on EAGAIN. Fails on a
+ * read error, or if the peer closed the socket: right
+ * away if nothing is left in the buffer, otherwise on the
+ * next call, so that the responses that made it in are
+ * dispatched first.
+ */
+static int
+chronosClientRecvFill(chronosClientConnection_t *connectionP)
+{
+  ssize_t num_bytes;
+  size_t  pending;
+  size_t  tail;
+
+  pending = connectionP->recvTail - connectionP->recvHead;
+
+  /* Slide any partial frame to the front to make room */
+  if (connectionP->recvHead > 0) {
+    if (pending > 0) {
+      memmove(connectionP->recvBuf,
+              connectionP->recvBuf + connectionP->recvHead,
+              pending);
+    }
+    connectionP->recvHead = 0;
+    connectionP->recvTail = pending;
+  }
+
+  /* The ring delivers what arrives by itself, see
+   * chronosClientUringComplete() */
+  if (connectionP->uringP != NULL) {
+    return CHRONOS_SUCCESS;
+  }
+
+  if (connectionP->isPeerClosed) {
+    chronos_error("socket closed");
+    goto failXit;
+  }
+
+  tail = connectionP->recvTail;
+
+  while (connectionP->recvTail < sizeof(connectionP->recvBuf)) {
+    num_bytes = chronosClientTransportRead(connectionP,
+                                           connectionP->recvBuf + connectionP->recvTail,
+                                           sizeof(connectionP->recvBuf) - connectionP->recvTail);
+    if (num_bytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      else if (errno == EINTR) {
+        continue;
+      }
+      perror("read() failed");
+      goto failXit;
+    }
+    else if (num_bytes == 0) {
+      connectionP->isPeerClosed = 1;
+      if (connectionP->recvTail == 0) {
+        chronos_error("socket closed");
+        goto failXit;
+      }
+      break;
+    }
+
+    connectionP->recvTail += num_bytes;
+  }
+
+  if (connectionP->recvTail > tail) {
+    chronosClientQuickAckRearm(connectionP);
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * The kernel drops out of quick ACK mode on its own, so it
+ * is asked again when the first data of a burst came in.
+ * The option is only advisory: if the kernel refuses it,
+ * that is reported once and the connection goes on
+ * without it.
+ */
+static void
+chronosClientQuickAckRearm(chronosClientConnection_t *connectionP)
+{
+  int on = 1;
+
+  if (!connectionP->isQuickAckDue 
+      || !connectionP->isTcp 
+      || !connectionP->options.quickAck
+      || connectionP->isQuickAckBroken) {
+    return;
+  }
+
+  connectionP->isQuickAckDue = 0;
+
+  if (setsockopt(connectionP->socket_fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) == -1) {
+    chronos_warning("setsockopt(TCP_QUICKACK) failed: %s, not asking again", strerror(errno));
+    connectionP->isQuickAckBroken = 1;
+  }
+}
+
+CHRONOS_COMPLETION_QUEUE_H
+chronosCompletionQueueAlloc(void)
+{
+  chronosCompletionQueue_t *queueP = NULL;
+
+  queueP = malloc(sizeof(chronosCompletionQueue_t));
+  if (queueP == NULL) {
+    chronos_error("Could not allocate completion queue");
+    return NULL;
+  }
+
+  memset(queueP, 0, sizeof(*queueP));
+  CHRONOS_COMPLETION_QUEUE_MAGIC_SET(queueP);
+
+  return queueP;
+}
+
+/*
+ * The queue must no longer be used by any connection.
+ */
+int
+chronosCompletionQueueFree(CHRONOS_COMPLETION_QUEUE_H queueH)
+{
+  chronosCompletionQueue_t *queueP = NULL;
+
+  if (queueH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  queueP = (chronosCompletionQueue_t *) queueH;
+  CHRONOS_COMPLETION_QUEUE_MAGIC_CHECK(queueP);
+
+  if (queueP->completionArr != NULL) {
+    free(queueP->completionArr);
+  }
+
+  memset(queueP, 0, sizeof(*queueP));
+  free(queueP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Takes up to maxCompletions completions off the queue,
+ * oldest first. Never blocks.
+ */
+int
+chronosCompletionQueuePop(chronosCompletion_t       *completionArr,
+                          int                        maxCompletions,
+                          int                       *numCompletionsP,
+                          CHRONOS_COMPLETION_QUEUE_H queueH)
+{
+  int i;
+  int numCompletions;
+  chronosCompletionQueue_t *queueP = NULL;
+
+  if (queueH == NULL || completionArr == NULL || numCompletionsP == NULL || maxCompletions < 0) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  queueP = (chronosCompletionQueue_t *) queueH;
+  CHRONOS_COMPLETION_QUEUE_MAGIC_CHECK(queueP);
+
+  numCompletions = (queueP->count < maxCompletions) ? queueP->count : maxCompletions;
+
+  for (i=0; i<numCompletions; i++) {
+    completionArr[i] = queueP->completionArr[queueP->head];
+    queueP->head = (queueP->head + 1) % queueP->size;
+  }
+
+  queueP->count -= numCompletions;
+  *numCompletionsP = numCompletions;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Queues the completion of a submitted request, growing
+ * the queue if it is full.
+ */
+static int
+chronosClientCompletionPush(chronosInFlight_t         *slotP,
+                            uint64_t                   nowNs,
+                            chronosClientConnection_t *connectionP)
+{
+  int i;
+  int newSize;
+  chronosCompletion_t      *newArr = NULL;
+  chronosCompletion_t      *completionP = NULL;
+  chronosCompletionQueue_t *queueP = connectionP->completionQueueP;
+
+  assert(queueP != NULL);
+
+  if (queueP->count == queueP->size) {
+    newSize = (queueP->size > 0) ? 2 * queueP->size : CHRONOS_CLIENT_MAX_INFLIGHT;
+    newArr = malloc(newSize * sizeof(chronosCompletion_t));
+    if (newArr == NULL) {
+      chronos_error("Could not grow completion queue");
+      return CHRONOS_FAIL;
+    }
+
+    for (i=0; i<queueP->count; i++) {
+      newArr[i] = queueP->completionArr[(queueP->head + i) % queueP->size];
+    }
+
+    if (queueP->completionArr != NULL) {
+      free(queueP->completionArr);
+    }
+    queueP->completionArr = newArr;
+    queueP->size = newSize;
+    queueP->head = 0;
+  }
+
+  completionP = &(queueP->completionArr[(queueP->head + queueP->count) % queueP->size]);
+  completionP->userTag = slotP->userTag;
+  completionP->connH = connectionP;
+  completionP->requestId = slotP->requestId;
+  completionP->txnType = slotP->response.txn_type;
+  completionP->txn_rc = slotP->response.rc;
+  completionP->latencyNs = nowNs - slotP->submitNs;
+  queueP->count ++;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Hands out the response of a completed request and frees
+ * its in-flight slot.
+ */
+static void
+chronosClientSlotRelease(chronosInFlight_t         *slotP,
+                         chronosResponsePacket_t   *responseP,
+                         chronosClientConnection_t *connectionP)
+{
+  *responseP = slotP->response;
+  slotP->state = CHRONOS_INFLIGHT_FREE;
+  connectionP->numInFlight --;
+
+  /* Slide the window past everything already collected */
+  while (connectionP->oldestRequestId != connectionP->nextRequestId
+         && connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(connectionP->oldestRequestId)].state == CHRONOS_INFLIGHT_FREE) {
+    connectionP->oldestRequestId ++;
+  }
+}
+
+/*
+ * Moves every whole response sitting in the receive
+ * buffer into the in-flight slot of its request. Responses
+ * to submitted requests go to the completion queue, and if
+ * the connection has a completion callback the response is
+ * handed to it right away.
+ */
+static int
+chronosClientResponsesDispatch(chronosClientConnection_t *connectionP)
+{
+  int rc;
+  uint64_t nowNs;
+  chronosResponsePacket_t  response;
+  chronosInFlight_t       *slotP = NULL;
+
+  while (connectionP->recvTail - connectionP->recvHead >= sizeof(response)) {
+    memcpy(&response,
+           connectionP->recvBuf + connectionP->recvHead,
+           sizeof(response));
+    connectionP->recvHead += sizeof(response);
+
+    slotP = &(connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(response.requestId)]);
+    if (slotP->state != CHRONOS_INFLIGHT_PENDING || slotP->requestId != response.requestId) {
+      chronos_error("Unexpected response for request id: %u", response.requestId);
+      goto failXit;
+    }
+
+#ifdef CHRONOS_DEBUG_2
+    chronos_info("Txn: %u, type: %d, rc: %d", 
+                  response.requestId,
+                  response.txn_type,
+                  response.rc);
+#endif
+    nowNs = chronosLatencyNowNs();
+    chronosLatencyRecord(slotP->txnType, 
+                         CHRONOS_LATENCY_WAIT, 
+                         nowNs - slotP->sentNs);
+
+    if (slotP->deadlineNs != 0) {
+      if (chronosRequestTimeNowNs() > slotP->deadlineNs) {
+        connectionP->numDeadlineMissed ++;
+      }
+      else {
+        connectionP->numDeadlineMet ++;
+      }
+    }
+
+    slotP->response = response;
+    slotP->state = CHRONOS_INFLIGHT_DONE;
+
+    if (slotP->isSubmitted) {
+      rc = chronosClientCompletionPush(slotP, nowNs, connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+      chronosClientSlotRelease(slotP, &(connectionP->lastResponse), connectionP);
+    }
+    else if (connectionP->completionFp != NULL) {
+      chronosClientSlotRelease(slotP, &(connectionP->lastResponse), connectionP);
+      connectionP->completionFp(connectionP,
+                                response.requestId,
+                                response.txn_type,
+                                response.rc,
+                                connectionP->completionArg);
+
+      /* The callback may have closed the connection */
+      if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+        break;
+      }
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Completes every submitted request still waiting for its
+ * response with CHRONOS_FAIL, the connection is gone.
+ */
+static void
+chronosClientSubmittedFail(chronosClientConnection_t *connectionP)
+{
+  unsigned int requestId;
+  uint64_t nowNs;
+  chronosInFlight_t *slotP = NULL;
+
+  if (connectionP->completionQueueP == NULL) {
+    return;
+  }
+
+  nowNs = chronosLatencyNowNs();
+
+  for (requestId = connectionP->oldestRequestId; 
+       requestId != connectionP->nextRequestId; 
+       requestId ++) {
+    slotP = &(connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(requestId)]);
+    if (slotP->state != CHRONOS_INFLIGHT_PENDING || !slotP->isSubmitted) {
+      continue;
+    }
+
+    slotP->response.requestId = requestId;
+    slotP->response.txn_type = slotP->txnType;
+    slotP->response.rc = CHRONOS_FAIL;
+
+    if (chronosClientCompletionPush(slotP, nowNs, connectionP) != CHRONOS_SUCCESS) {
+      chronos_warning("Dropping completion of request id: %u", requestId);
+    }
+    chronosClientSlotRelease(slotP, &(connectionP->lastResponse), connectionP);
+  }
+}
+
+/*
+ * Blocks until the response for requestId has arrived and
+ * then releases its in-flight slot. Responses for other
+ * requests that arrive meanwhile are kept in their slots.
+ */
+static int
+chronosClientResponseCollect(unsigned int               requestId,
+                             chronosResponsePacket_t   *responseP,
+                             chronosClientConnection_t *connectionP,
+                             int (*isTimeToDieFp) (void))
+{
+  int rc;
+  int isInterrupted;
+  short events;
+  short revents;
+  struct timespec timeout = { 1, 0 };
+  chronosInFlight_t *slotP = NULL;
+
+  slotP = &(connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(requestId)]);
+  if (slotP->state == CHRONOS_INFLIGHT_FREE || slotP->requestId != requestId) {
+    chronos_error("Request id %u is not in flight", requestId);
+    goto failXit;
+  }
+
+  if (slotP->isSubmitted) {
+    chronos_error("Request id %u completes into the completion queue", requestId);
+    goto failXit;
+  }
+
+  while (1) {
+    rc = chronosClientResponsesDispatch(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    if (slotP->state == CHRONOS_INFLIGHT_DONE) {
+      break;
+    }
+
+    if (isTimeToDieFp != NULL && isTimeToDieFp()) {
+      chronos_error("requested to die");
+      goto failXit;
+    }
+
+    /* Requests still sitting in the send buffer have to
+     * go out before their responses can come back */
+    events = POLLIN;
+    if (connectionP->sendTail > connectionP->sendHead) {
+      events |= POLLOUT;
+    }
+
+    /* chronosClientInterrupt() wakes us up right away; the
+     * timeout only matters for callers that never call it */
+    rc = chronosClientTransportWait(connectionP, events, &timeout, &revents, &isInterrupted);
+    if (rc == CHRONOS_FAIL) {
+      goto failXit;
+    }
+    else if (rc == CHRONOS_TIMEOUT) {
+      chronos_debug(1, "poll() timed out");
+      continue;
+    }
+
+    if (revents == 0) {
+      continue;
+    }
+
+    if (revents & POLLOUT) {
+      rc = chronosClientSendFlush(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+
+    if (revents & ~POLLOUT) {
+      rc = chronosClientRecvFill(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+  }
+
+  chronosClientSlotRelease(slotP, responseP, connectionP);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Returns the last response collected on this connection.
+ * The response is owned by the connection and is only valid
+ * until the next response is received; read it with the
+ * chronosResponse*Get() accessors and do not free it.
+ */
+CHRONOS_RESPONSE_H
+chronosClientLastResponseGet(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return NULL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  return (CHRONOS_RESPONSE_H) &(connectionP->lastResponse);
+}
+
+/*
+ * Number of zero-copy sends made on this connection, and
+ * how many of them the kernel ended up copying anyway
+ * (always the case on loopback). Either pointer can be
+ * NULL.
+ */
+int
+chronosClientZeroCopyStatsGet(uint64_t      *numSendsP,
+                              uint64_t      *numCopiedP,
+                              CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (numSendsP != NULL) {
+    *numSendsP = connectionP->numZeroCopySends;
+  }
+  if (numCopiedP != NULL) {
+    *numCopiedP = connectionP->numZeroCopyCopied;
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Number of responses collected on this connection for
+ * requests that had a deadline, split by whether they
+ * arrived before it. Either pointer can be NULL.
+ */
+int
+chronosClientDeadlineStatsGet(uint64_t      *numMetP,
+                              uint64_t      *numMissedP,
+                              CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (numMetP != NULL) {
+    *numMetP = connectionP->numDeadlineMet;
+  }
+  if (numMissedP != NULL) {
+    *numMissedP = connectionP->numDeadlineMissed;
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+int
+chronosClientIsConnected(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return 0;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  return (connectionP->state == CHRONOS_CONNECTION_CONNECTED);
+}
+
+int
+chronosClientNumInFlightGet(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return -1;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  return connectionP->numInFlight;
+}
+
+/*
+ * Number of requests that can still be sent before the
+ * in-flight window is full. Responses collected out of
+ * order do not free room until the older ones are in.
+ */
+int
+chronosClientWindowFreeGet(CHRONOS_CONN_H connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return -1;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  return CHRONOS_CLIENT_MAX_INFLIGHT 
+         - (int) (connectionP->nextRequestId - connectionP->oldestRequestId);
+}
+
+/*
+ * Waits for the response to a specific request previously
+ * sent with chronosClientSendRequest(). Responses can be
+ * collected in any order.
+ */
+int
+chronosClientReceiveResponseById(unsigned int requestId,
+                                 int *txn_rc_ret, 
+                                 CHRONOS_CONN_H connH, 
+                                 int (*isTimeToDieFp) (void))
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || txn_rc_ret == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  if (connectionP->completionFp != NULL) {
+    chronos_error("Responses are delivered to the completion callback");
+    goto failXit;
+  }
+
+  rc = chronosClientResponseCollect(requestId, 
+                                    &(connectionP->lastResponse), 
+                                    connectionP, 
+                                    isTimeToDieFp);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  *txn_rc_ret = connectionP->lastResponse.rc;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Looks for a request in the window whose response has
+ * already arrived. Returns 1 and sets *requestIdP if so.
+ */
+static int
+chronosClientDoneFind(chronosClientConnection_t *connectionP,
+                      unsigned int              *requestIdP)
+{
+  unsigned int requestId;
+
+  for (requestId = connectionP->oldestRequestId; 
+       requestId != connectionP->nextRequestId; 
+       requestId ++) {
+    if (connectionP->inFlightArr[CHRONOS_INFLIGHT_SLOT(requestId)].state == CHRONOS_INFLIGHT_DONE) {
+      *requestIdP = requestId;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Collects the response of whichever request in flight
+ * completes first, waiting at most timeoutUs microseconds
+ * (0 just checks what has already arrived, a negative
+ * value waits forever). The id of the completed request
+ * is returned in *requestIdP.
+ *
+ * Returns CHRONOS_TIMEOUT if nothing completed in time,
+ * or if chronosClientInterrupt() was called meanwhile.
+ * This lets open-loop drivers keep their send schedule
+ * while waiting for responses.
+ */
+int
+chronosClientReceiveResponseAny(unsigned int  *requestIdP,
+                                int           *txn_rc_ret,
+                                int            timeoutUs,
+                                CHRONOS_CONN_H connH)
+{
+  int rc;
+  unsigned int requestId;
+  long long remainingNs;
+  int isInterrupted;
+  short events;
+  short revents;
+  struct timespec now;
+  struct timespec deadline;
+  struct timespec timeout;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || requestIdP == NULL || txn_rc_ret == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  if (connectionP->completionFp != NULL) {
+    chronos_error("Responses are delivered to the completion callback");
+    goto failXit;
+  }
+
+  if (connectionP->numInFlight == 0) {
+    chronos_error("No request in flight");
+    goto failXit;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (timeoutUs > 0) {
+    deadline.tv_sec += timeoutUs / 1000000;
+    deadline.tv_nsec += (timeoutUs % 1000000) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec ++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  while (1) {
+    rc = chronosClientResponsesDispatch(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    if (chronosClientDoneFind(connectionP, &requestId)) {
+      break;
+    }
+
+    events = POLLIN;
+    if (connectionP->sendTail > connectionP->sendHead) {
+      events |= POLLOUT;
+    }
+
+    if (timeoutUs < 0) {
+      rc = chronosClientTransportWait(connectionP, events, NULL, &revents, &isInterrupted);
+    }
+    else {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remainingNs = (deadline.tv_sec - now.tv_sec) * 1000000000LL 
+                    + (deadline.tv_nsec - now.tv_nsec);
+      if (remainingNs < 0) {
+        remainingNs = 0;
+      }
+      timeout.tv_sec = remainingNs / 1000000000LL;
+      timeout.tv_nsec = remainingNs % 1000000000LL;
+      rc = chronosClientTransportWait(connectionP, events, &timeout, &revents, &isInterrupted);
+    }
+
+    if (rc == CHRONOS_FAIL) {
+      goto failXit;
+    }
+    else if (rc == CHRONOS_TIMEOUT) {
+      return CHRONOS_TIMEOUT;
+    }
+
+    /* Interrupted: give up as if the time was over */
+    if (isInterrupted) {
+      return CHRONOS_TIMEOUT;
+    }
+
+    if (revents & POLLOUT) {
+      rc = chronosClientSendFlush(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+
+    if (revents & ~POLLOUT) {
+      rc = chronosClientRecvFill(connectionP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+  }
+
+  rc = chronosClientResponseCollect(requestId,
+                                    &(connectionP->lastResponse),
+                                    connectionP,
+                                    NULL);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  *requestIdP = requestId;
+  *txn_rc_ret = connectionP->lastResponse.rc;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/* 
+ * Waits for response from chronos server. This collects
+ * the response to the oldest request still in flight.
+ */
+int
+chronosClientReceiveResponse(int *txn_rc_ret, 
+                             CHRONOS_CONN_H connH, 
+                             int (*isTimeToDieFp) (void))
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || txn_rc_ret == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  if (connectionP->completionFp != NULL) {
+    chronos_error("Responses are delivered to the completion callback");
+    goto failXit;
+  }
+
+  if (connectionP->numInFlight == 0) {
+    chronos_error("No request in flight");
+    goto failXit;
+  }
+
+  rc = chronosClientResponseCollect(connectionP->oldestRequestId,
+                                    &(connectionP->lastResponse),
+                                    connectionP,
+                                    isTimeToDieFp);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+#ifdef CHRONOS_DEBUG_2
+  chronos_info("Txn: %d, rc: %d", 
+                connectionP->lastResponse.txn_type,
+                connectionP->lastResponse.rc);
+#endif
+  *txn_rc_ret = connectionP->lastResponse.rc;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Reads whatever the socket has without blocking and
+ * dispatches the responses that arrived.
+ */
+int
+chronosClientInputProcess(CHRONOS_CONN_H connH)
+{
+  int rc;
+  int isFull;
+  chronosClientConnection_t *connectionP = NULL;
 
-    rc = poll(fds, 1, 1000 /* one second */);
-    if (rc < 0) {
-      perror("poll() failed");
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  /* A full receive buffer may mean more data is waiting */
+  do {
+    rc = chronosClientRecvFill(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
       goto failXit;
     }
-    else if (rc == 0) {
-      chronos_debug(1, "poll() timed out");
-      continue;
+
+    isFull = (connectionP->recvTail == sizeof(connectionP->recvBuf));
+
+    rc = chronosClientResponsesDispatch(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
     }
+  } while (isFull && connectionP->state == CHRONOS_CONNECTION_CONNECTED);
 
-    assert(fds[0].revents);
+  return CHRONOS_SUCCESS;
 
-    while (to_read > 0) {
-      num_bytes = read(connectionP->socket_fd, buf, 1);
-      if (num_bytes < 0) {
-        perror("read() failed");
-        goto failXit;
-      }
-      else if (num_bytes == 0) {
-        chronos_error("socket closed");
-        fds[0].events = 0;
-        goto failXit;
-      }
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Advances the connection's state machine given the epoll
+ * events reported for its socket: completes a pending
+ * connect, writes pending sends, reads and dispatches
+ * responses. Never blocks. Events for a connection that
+ * was disconnected or detached meanwhile are ignored. On
+ * failure the caller is expected to disconnect.
+ */
+int
+chronosClientEventsHandle(uint32_t       events,
+                          CHRONOS_CONN_H connH)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  /* Events epoll reported before a callback disconnected
+   * the connection, or removed it from the loop, are stale */
+  if (connectionP->epollFd < 0
+      || connectionP->state == CHRONOS_CONNECTION_DISCONNECTED) {
+    return CHRONOS_SUCCESS;
+  }
 
-      to_read -= num_bytes;
-      buf += num_bytes;
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+    rc = chronosClientConnectFinish(connH);
+    if (rc == CHRONOS_FAIL) {
+      goto failXit;
     }
+    return CHRONOS_SUCCESS;
+  }
 
-#ifdef CHRONOS_DEBUG_2
-    chronos_info("Txn: %d, rc: %d", 
-                  chronosResponseTypeGet(responseH),
-                  chronosResponseResultGet(responseH));
-#endif
-    *txn_rc_ret = chronosResponseResultGet(responseH);
-    break;
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  if ((events & EPOLLERR) && connectionP->isZeroCopy) {
+    rc = chronosClientZeroCopyReap(connectionP);
+    if (rc == CHRONOS_FAIL) {
+      goto failXit;
+    }
+    else if (rc == CHRONOS_SUCCESS) {
+      events &= ~EPOLLERR;
+    }
+  }
+
+  if (events & EPOLLOUT) {
+    rc = chronosClientSendFlush(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    rc = chronosClientInputProcess(connH);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+    rc = chronosClientEpollUpdate(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Sends completions of requests submitted on this
+ * connection to the given queue instead of the
+ * connection's own. Pass NULL to go back to the
+ * connection's own queue.
+ */
+int
+chronosClientCompletionQueueSet(CHRONOS_COMPLETION_QUEUE_H queueH,
+                                CHRONOS_CONN_H             connH)
+{
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->ownsCompletionQueue) {
+    if (connectionP->completionQueueP->count > 0) {
+      chronos_error("Connection has completions not yet polled");
+      return CHRONOS_FAIL;
+    }
+    chronosCompletionQueueFree(connectionP->completionQueueP);
+  }
+
+  connectionP->completionQueueP = (chronosCompletionQueue_t *) queueH;
+  connectionP->ownsCompletionQueue = 0;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Sends a request without waiting for anything. When its
+ * response arrives, a completion carrying userTag is
+ * queued, to be picked up with
+ * chronosClientPollCompletions() (or
+ * chronosEventLoopPollCompletions() if the connection is
+ * in an event loop). The request can be freed on return.
+ * Returns CHRONOS_AGAIN, without sending anything, if the
+ * send buffer is at its limit or the in-flight window is
+ * full.
+ */
+int
+chronosClientSubmit(CHRONOS_REQUEST_H requestH,
+                    CHRONOS_CONN_H    connH,
+                    uint64_t          userTag)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (connectionP->completionQueueP == NULL) {
+    connectionP->completionQueueP = chronosCompletionQueueAlloc();
+    if (connectionP->completionQueueP == NULL) {
+      goto failXit;
+    }
+    connectionP->ownsCompletionQueue = 1;
+  }
+
+  if (connectionP->state != CHRONOS_CONNECTION_CONNECTED) {
+    chronos_error("Invalid connection state");
+    goto failXit;
+  }
+
+  rc = chronosClientSendRoomCheck(1, connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    return rc;
+  }
+
+  rc = chronosClientRequestsQueue(&requestH, 1, &userTag, connectionP->options.cork, connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  rc = chronosClientEpollUpdate(connectionP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
   }
 
   return CHRONOS_SUCCESS;
@@ -423,3 +3492,291 @@ failXit:
   return CHRONOS_FAIL; 
 }
 
+/*
+ * Picks up to maxCompletions completions of submitted
+ * requests, without blocking: pending sends are flushed,
+ * whatever the socket has is read, and the completions
+ * already queued are returned.
+ */
+int
+chronosClientPollCompletions(chronosCompletion_t *completionArr,
+                             int                  maxCompletions,
+                             int                 *numCompletionsP,
+                             CHRONOS_CONN_H       connH)
+{
+  int rc;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL || numCompletionsP == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+  *numCompletionsP = 0;
+
+  if (connectionP->completionQueueP == NULL) {
+    return CHRONOS_SUCCESS;
+  }
+
+  if (connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+    if (connectionP->isZeroCopy && chronosClientZeroCopyReap(connectionP) == CHRONOS_FAIL) {
+      goto failXit;
+    }
+
+    rc = chronosClientSendFlush(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    rc = chronosClientInputProcess(connH);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    rc = chronosClientEpollUpdate(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  return chronosCompletionQueuePop(completionArr,
+                                   maxCompletions,
+                                   numCompletionsP,
+                                   connectionP->completionQueueP);
+
+failXit:
+  return CHRONOS_FAIL; 
+}
+
+/*
+ * Wakes up a thread blocked receiving on this connection,
+ * so that it checks its isTimeToDieFp right away. Can be
+ * called from any thread.
+ */
+int
+chronosClientInterrupt(CHRONOS_CONN_H connH)
+{
+  uint64_t value = 1;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  connectionP = (chronosClientConnection_t *) connH;
+
+  if (write(connectionP->wakeupFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    perror("write() failed");
+    return CHRONOS_FAIL;
+  }
+
+  /* Shared-memory connections sleep on a futex instead */
+  if (connectionP->shmH != NULL) {
+    chronosShmWake(connectionP->shmH);
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Copies what a receive delivered into the receive buffer
+ * and dispatches the responses it completes.
+ */
+static int
+chronosClientUringRecvCopy(const char                *dataP,
+                           size_t                     len,
+                           chronosClientConnection_t *connectionP)
+{
+  int rc;
+  size_t chunk;
+
+  while (len > 0 && connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+    /* Slides any partial frame to the front */
+    rc = chronosClientRecvFill(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    chunk = sizeof(connectionP->recvBuf) - connectionP->recvTail;
+    if (chunk == 0) {
+      chronos_error("Response frame too large");
+      goto failXit;
+    }
+    if (chunk > len) {
+      chunk = len;
+    }
+
+    memcpy(connectionP->recvBuf + connectionP->recvTail, dataP, chunk);
+    connectionP->recvTail += chunk;
+    dataP += chunk;
+    len -= chunk;
+
+    rc = chronosClientResponsesDispatch(connectionP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Handles a completion of an operation that
+ * chronosClientUringAttach() or the connection itself
+ * armed, and arms what comes next. *connHP is set to the
+ * connection the completion was for, or to NULL if it
+ * already left the loop. Returns CHRONOS_FAIL if the
+ * connection broke; the caller then disconnects it.
+ */
+int
+chronosClientUringComplete(const chronosUringCompletion_t *completionP,
+                           CHRONOS_CONN_H                 *connHP)
+{
+  int rc = CHRONOS_SUCCESS;
+  int op;
+  int isLast;
+  int isLive;
+  unsigned int bufId;
+  const char *dataP = NULL;
+  chronosClientUring_t *uringP = NULL;
+  chronosClientConnection_t *connectionP = NULL;
+
+  if (completionP == NULL || connHP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  op = (int) (completionP->userData & CHRONOS_URING_OP_MASK);
+  uringP = (chronosClientUring_t *) (uintptr_t) (completionP->userData & ~((uint64_t) CHRONOS_URING_OP_MASK));
+  connectionP = uringP->connectionP;
+  isLast = chronosUringCompletionIsLast(completionP);
+  isLive = (connectionP != NULL
+            && (connectionP->state == CHRONOS_CONNECTION_CONNECTED
+                || connectionP->state == CHRONOS_CONNECTION_CONNECTING));
+
+  *connHP = connectionP;
+
+  /* Keeps the state around until this is handled, in case
+   * a callback below detaches the connection */
+  uringP->numOps ++;
+
+  switch (op) {
+  case CHRONOS_URING_OP_RECV:
+    if (isLast) {
+      uringP->isRecvArmed = 0;
+      uringP->numOps --;
+    }
+
+    if (chronosUringRecvBufIdGet(completionP, &bufId) == CHRONOS_SUCCESS) {
+      if (completionP->res > 0 && connectionP != NULL
+          && connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+        dataP = chronosUringRecvBufGet(bufId, uringP->uringH);
+        rc = chronosClientUringRecvCopy(dataP, completionP->res, connectionP);
+        chronosClientQuickAckRearm(connectionP);
+      }
+      chronosUringRecvBufPut(bufId, uringP->uringH);
+    }
+
+    if (completionP->res == 0) {
+      chronos_error("socket closed");
+      rc = CHRONOS_FAIL;
+    }
+    else if (completionP->res == -EINVAL && uringP->isRecvMultishot) {
+      /* Older kernels take the flag but not the multishot
+       * mode: receive one buffer at a time instead. Any
+       * other EINVAL is a real failure */
+      chronosUringRecvMultishotDisable(uringP->uringH);
+    }
+    else if (completionP->res < 0
+             && completionP->res != -ENOBUFS 
+             && completionP->res != -ECANCELED) {
+      chronos_error("io_uring receive failed: %s", strerror(-completionP->res));
+      rc = CHRONOS_FAIL;
+    }
+    break;
+
+  case CHRONOS_URING_OP_SEND:
+    uringP->isSendArmed = 0;
+    uringP->numOps --;
+
+    if (completionP->res < 0) {
+      if (completionP->res != -ECANCELED) {
+        chronos_error("io_uring send failed: %s", strerror(-completionP->res));
+        rc = CHRONOS_FAIL;
+      }
+    }
+    else if (connectionP != NULL && connectionP->state == CHRONOS_CONNECTION_CONNECTED) {
+      uringP->sendOff += completionP->res;
+
+      /* The socket took part of it: send the rest */
+      if (uringP->sendOff < uringP->sendLen) {
+        rc = chronosUringSendPrep(connectionP->socket_fd,
+                                  uringP->sendBufP + uringP->sendOff,
+                                  uringP->sendLen - uringP->sendOff,
+                                  completionP->userData,
+                                  uringP->uringH);
+        if (rc == CHRONOS_SUCCESS) {
+          uringP->isSendArmed = 1;
+          uringP->numOps ++;
+        }
+        break;
+      }
+    }
+
+    /* Done with it: it becomes the spare buffer */
+    if (uringP->spareBufP == NULL) {
+      uringP->spareBufP = uringP->sendBufP;
+      uringP->spareBufSize = uringP->sendBufSize;
+    }
+    else {
+      free(uringP->sendBufP);
+    }
+    uringP->sendBufP = NULL;
+    uringP->sendBufSize = 0;
+    uringP->sendOff = 0;
+    uringP->sendLen = 0;
+    break;
+
+  case CHRONOS_URING_OP_POLL:
+    uringP->isPollArmed = 0;
+    uringP->numOps --;
+
+    if (connectionP != NULL && completionP->res != -ECANCELED
+        && connectionP->state == CHRONOS_CONNECTION_CONNECTING) {
+      if (chronosClientConnectFinish(connectionP) == CHRONOS_FAIL) {
+        rc = CHRONOS_FAIL;
+      }
+    }
+    break;
+
+  default:
+    chronos_error("Invalid io_uring completion");
+    rc = CHRONOS_FAIL;
+    break;
+  }
+
+  /* What fails after a disconnect was already reported */
+  if (!isLive) {
+    rc = CHRONOS_SUCCESS;
+  }
+
+  if (rc == CHRONOS_SUCCESS && uringP->connectionP != NULL) {
+    rc = chronosClientUringUpdate(uringP->connectionP);
+  }
+
+  uringP->numOps --;
+
+  if (uringP->connectionP == NULL) {
+    *connHP = NULL;
+    if (uringP->numOps == 0) {
+      chronosClientUringFree(uringP);
+    }
+  }
+
+  return rc;
+}
@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "chronos.h"
+#include "include/chronos_distribution.h"
+
+#define CHRONOS_KEY_DIST_MAGIC   (0xD157)
+#define CHRONOS_KEY_DIST_MAGIC_CHECK(distP)    assert((distP)->magic == CHRONOS_KEY_DIST_MAGIC)
+#define CHRONOS_KEY_DIST_MAGIC_SET(distP)      (distP)->magic = CHRONOS_KEY_DIST_MAGIC
+
+/*--------------------------------------------------
+ * A key distribution. Skewed distributions are
+ * sampled through an alias table (Vose's method):
+ * pick a column uniformly, then keep it or jump to
+ * its alias depending on the column's threshold.
+ * This is O(1) per sample whatever the skew.
+ *
+ * For the "latest" distribution the table gives the
+ * distance from the most recently updated key.
+ *------------------------------------------------*/
+typedef struct chronosKeyDist_t {
+  int                   magic;
+  chronosKeyDistType_t  type;
+  int                   numKeys;
+
+  /* Most recently updated key (latest distribution) */
+  int                   latestKey;
+
+  /* Alias table, NULL for the uniform distribution.
+   * Column i is kept if the low 32 bits of the draw are
+   * below thresholdArr[i], otherwise aliasArr[i] is used */
+  void                 *tableP;
+  uint32_t             *thresholdArr;
+  int32_t              *aliasArr;
+} chronosKeyDist_t;
+
+static chronosKeyDist_t *
+keyDistAlloc(chronosKeyDistType_t type, int numKeys)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (numKeys <= 0) {
+    chronos_error("Invalid number of keys: %d", numKeys);
+    goto failXit;
+  }
+
+  distP = malloc(sizeof(chronosKeyDist_t));
+  if (distP == NULL) {
+    chronos_error("Could not allocate key distribution");
+    goto failXit;
+  }
+
+  memset(distP, 0, sizeof(*distP));
+  distP->type = type;
+  distP->numKeys = numKeys;
+  CHRONOS_KEY_DIST_MAGIC_SET(distP);
+
+  return distP;
+
+failXit:
+  return NULL;
+}
+
+/*--------------------------------------------------
+ * Build the alias table of a distribution from the
+ * (not necessarily normalized) weight of each key.
+ *------------------------------------------------*/
+static int
+aliasTableBuild(const double *weightArr, chronosKeyDist_t *distP)
+{
+  int i;
+  int s, l;
+  int numSmall = 0;
+  int numLarge = 0;
+  int numKeys = distP->numKeys;
+  int *smallArr = NULL;
+  int *largeArr = NULL;
+  double sum = 0;
+  double *scaledArr = NULL;
+
+  distP->tableP = malloc((size_t) numKeys * (sizeof(uint32_t) + sizeof(int32_t)));
+  scaledArr = malloc((size_t) numKeys * sizeof(double));
+  smallArr = malloc((size_t) numKeys * sizeof(int));
+  largeArr = malloc((size_t) numKeys * sizeof(int));
+  if (distP->tableP == NULL || scaledArr == NULL || smallArr == NULL || largeArr == NULL) {
+    chronos_error("Could not allocate alias table");
+    goto failXit;
+  }
+
+  distP->thresholdArr = (uint32_t *) distP->tableP;
+  distP->aliasArr = (int32_t *) (distP->thresholdArr + numKeys);
+
+  for (i=0; i<numKeys; i++) {
+    sum += weightArr[i];
+  }
+
+  if (!(sum > 0)) {
+    chronos_error("Invalid key weights");
+    goto failXit;
+  }
+
+  for (i=0; i<numKeys; i++) {
+    scaledArr[i] = weightArr[i] * numKeys / sum;
+    if (scaledArr[i] < 1.0) {
+      smallArr[numSmall++] = i;
+    }
+    else {
+      largeArr[numLarge++] = i;
+    }
+  }
+
+  while (numSmall > 0 && numLarge > 0) {
+    s = smallArr[--numSmall];
+    l = largeArr[numLarge - 1];
+
+    distP->thresholdArr[s] = (uint32_t) (scaledArr[s] * 4294967296.0);
+    distP->aliasArr[s] = l;
+
+    scaledArr[l] = (scaledArr[l] + scaledArr[s]) - 1.0;
+    if (scaledArr[l] < 1.0) {
+      numLarge --;
+      smallArr[numSmall++] = l;
+    }
+  }
+
+  /* Whatever is left is full up to rounding errors */
+  while (numLarge > 0) {
+    l = largeArr[--numLarge];
+    distP->thresholdArr[l] = UINT32_MAX;
+    distP->aliasArr[l] = l;
+  }
+
+  while (numSmall > 0) {
+    s = smallArr[--numSmall];
+    distP->thresholdArr[s] = UINT32_MAX;
+    distP->aliasArr[s] = s;
+  }
+
+  free(scaledArr);
+  free(smallArr);
+  free(largeArr);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  free(scaledArr);
+  free(smallArr);
+  free(largeArr);
+  if (distP->tableP != NULL) {
+    free(distP->tableP);
+    distP->tableP = NULL;
+  }
+  distP->thresholdArr = NULL;
+  distP->aliasArr = NULL;
+
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Build a Zipf(theta) alias table: key k has weight
+ * 1 / (k+1)^theta.
+ *------------------------------------------------*/
+static int
+zipfTableBuild(double theta, chronosKeyDist_t *distP)
+{
+  int i;
+  int rc;
+  double *weightArr = NULL;
+
+  if (theta < 0) {
+    chronos_error("Invalid zipf theta: %f", theta);
+    goto failXit;
+  }
+
+  weightArr = malloc((size_t) distP->numKeys * sizeof(double));
+  if (weightArr == NULL) {
+    chronos_error("Could not allocate key weights");
+    goto failXit;
+  }
+
+  for (i=0; i<distP->numKeys; i++) {
+    weightArr[i] = 1.0 / pow((double) (i + 1), theta);
+  }
+
+  rc = aliasTableBuild(weightArr, distP);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  free(weightArr);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  free(weightArr);
+  return CHRONOS_FAIL;
+}
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistUniformAlloc(int numKeys)
+{
+  return (CHRONOS_KEY_DIST_H) keyDistAlloc(CHRONOS_KEY_DIST_UNIFORM, numKeys);
+}
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistZipfAlloc(int    numKeys,
+                        double theta)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  distP = keyDistAlloc(CHRONOS_KEY_DIST_ZIPF, numKeys);
+  if (distP == NULL) {
+    goto failXit;
+  }
+
+  if (zipfTableBuild(theta, distP) != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return (CHRONOS_KEY_DIST_H) distP;
+
+failXit:
+  if (distP != NULL) {
+    chronosKeyDistFree(distP);
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------
+ * hotAccessFraction of the accesses go to the first
+ * hotKeyFraction of the keys, uniformly within the
+ * hot and the cold sets.
+ *------------------------------------------------*/
+CHRONOS_KEY_DIST_H
+chronosKeyDistHotSetAlloc(int    numKeys,
+                          double hotAccessFraction,
+                          double hotKeyFraction)
+{
+  int i;
+  int numHotKeys;
+  double *weightArr = NULL;
+  chronosKeyDist_t *distP = NULL;
+
+  if (hotAccessFraction < 0 || hotAccessFraction > 1 
+      || hotKeyFraction <= 0 || hotKeyFraction > 1) {
+    chronos_error("Invalid hot set: %f of accesses to %f of keys", 
+                  hotAccessFraction, hotKeyFraction);
+    goto failXit;
+  }
+
+  distP = keyDistAlloc(CHRONOS_KEY_DIST_HOTSET, numKeys);
+  if (distP == NULL) {
+    goto failXit;
+  }
+
+  numHotKeys = (int) (numKeys * hotKeyFraction);
+  if (numHotKeys < 1) {
+    numHotKeys = 1;
+  }
+
+  weightArr = malloc((size_t) numKeys * sizeof(double));
+  if (weightArr == NULL) {
+    chronos_error("Could not allocate key weights");
+    goto failXit;
+  }
+
+  for (i=0; i<numKeys; i++) {
+    if (i < numHotKeys) {
+      weightArr[i] = hotAccessFraction / numHotKeys;
+    }
+    else {
+      weightArr[i] = (1.0 - hotAccessFraction) / (numKeys - numHotKeys);
+    }
+  }
+
+  if (aliasTableBuild(weightArr, distP) != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  free(weightArr);
+
+  return (CHRONOS_KEY_DIST_H) distP;
+
+failXit:
+  free(weightArr);
+  if (distP != NULL) {
+    chronosKeyDistFree(distP);
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------
+ * Keys close to the most recently updated one are
+ * the most likely: the distance back from it follows
+ * a Zipf(theta) distribution.
+ *------------------------------------------------*/
+CHRONOS_KEY_DIST_H
+chronosKeyDistLatestAlloc(int    numKeys,
+                          double theta)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  distP = keyDistAlloc(CHRONOS_KEY_DIST_LATEST, numKeys);
+  if (distP == NULL) {
+    goto failXit;
+  }
+
+  if (zipfTableBuild(theta, distP) != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return (CHRONOS_KEY_DIST_H) distP;
+
+failXit:
+  if (distP != NULL) {
+    chronosKeyDistFree(distP);
+  }
+  return NULL;
+}
+
+int
+chronosKeyDistFree(CHRONOS_KEY_DIST_H distH)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (distH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  if (distP->tableP != NULL) {
+    free(distP->tableP);
+  }
+
+  memset(distP, 0, sizeof(*distP));
+  free(distP);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+chronosKeyDistType_t
+chronosKeyDistTypeGet(CHRONOS_KEY_DIST_H distH)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (distH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_KEY_DIST_UNIFORM;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  return distP->type;
+}
+
+int
+chronosKeyDistNumKeysGet(CHRONOS_KEY_DIST_H distH)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (distH == NULL) {
+    chronos_error("Invalid handle");
+    return 0;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  return distP->numKeys;
+}
+
+/*--------------------------------------------------
+ * Record the most recently updated key. Only the
+ * latest distribution uses it. The distribution may
+ * be shared by several threads, hence the atomic.
+ *------------------------------------------------*/
+int
+chronosKeyDistLatestSet(int                key,
+                        CHRONOS_KEY_DIST_H distH)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (distH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  if (key < 0 || key >= distP->numKeys) {
+    chronos_error("Invalid key: %d", key);
+    goto failXit;
+  }
+
+  __atomic_store_n(&(distP->latestKey), key, __ATOMIC_RELAXED);
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+static inline int
+keyDistSample(chronosKeyDist_t *distP, chronosRandom_t *randP)
+{
+  int key;
+  uint64_t r = chronosRandomNext(randP);
+
+  key = CHRONOS_RANDOM_BOUND(r >> 32, distP->numKeys);
+
+  if (distP->thresholdArr != NULL && (uint32_t) r >= distP->thresholdArr[key]) {
+    key = distP->aliasArr[key];
+  }
+
+  if (distP->type == CHRONOS_KEY_DIST_LATEST) {
+    key = __atomic_load_n(&(distP->latestKey), __ATOMIC_RELAXED) - key;
+    if (key < 0) {
+      key += distP->numKeys;
+    }
+  }
+
+  return key;
+}
+
+/*--------------------------------------------------
+ * Draw one key in [0, numKeys)
+ *------------------------------------------------*/
+int
+chronosKeyDistSample(CHRONOS_KEY_DIST_H  distH,
+                     chronosRandom_t    *randP)
+{
+  chronosKeyDist_t *distP = NULL;
+
+  if (distH == NULL || randP == NULL) {
+    chronos_error("Invalid argument");
+    return -1;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  return keyDistSample(distP, randP);
+}
+
+/*--------------------------------------------------
+ * Fill an array with keys drawn from the distribution,
+ * rescaled to [0, bound). With a bound of 0 the keys
+ * are rescaled to the full 32-bit range instead, the
+ * same as raw values from chronosRandomFill(), so they
+ * can later be narrowed with CHRONOS_RANDOM_BOUND().
+ * Rescaling keeps hot keys at the low end of whatever
+ * range the caller maps them to.
+ *------------------------------------------------*/
+int
+chronosKeyDistFill(unsigned int       *valuesArr,
+                   int                 numValues,
+                   unsigned int        bound,
+                   CHRONOS_KEY_DIST_H  distH,
+                   chronosRandom_t    *randP)
+{
+  int i;
+  uint64_t key;
+  chronosKeyDist_t *distP = NULL;
+
+  if (valuesArr == NULL || distH == NULL || randP == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  distP = (chronosKeyDist_t *) distH;
+  CHRONOS_KEY_DIST_MAGIC_CHECK(distP);
+
+  for (i=0; i<numValues; i++) {
+    key = keyDistSample(distP, randP);
+    if (bound == 0) {
+      valuesArr[i] = (unsigned int) ((key << 32) / distP->numKeys);
+    }
+    else {
+      valuesArr[i] = (unsigned int) (key * bound / distP->numKeys);
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
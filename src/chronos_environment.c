@@ -61,9 +61,15 @@ cleanup:
   return rc;
 }
 
+/*------------------------------------------------
+ * Create a chronos environment. The cache of the
+ * environment holds numSymbols symbols, or the
+ * default number if numSymbols is not positive.
+ *----------------------------------------------*/
 CHRONOS_ENV_H
 chronosEnvAlloc(const char *homedir, 
-                const char *datafilesdir)
+                const char *datafilesdir,
+                int         numSymbols)
 {
   chronosEnv_t *envP = NULL;
   CHRONOS_CACHE_H  cacheH = NULL;
@@ -76,7 +82,7 @@ chronosEnvAlloc(const char *homedir,
 
   memset(envP, 0, sizeof(*envP));
 
-  cacheH = chronosCacheAlloc(homedir, datafilesdir);
+  cacheH = chronosCacheAlloc(homedir, datafilesdir, numSymbols);
   if (cacheH == NULL) {
     chronos_error("Failed to create cache");
     goto failXit;    
@@ -0,0 +1,587 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include "chronos.h"
+#include "include/chronos_eventloop.h"
+#include "include/chronos_uring.h"
+
+#define CHRONOS_EVENT_LOOP_MAGIC   (0xE10F)
+#define CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP)    assert((loopP)->magic == CHRONOS_EVENT_LOOP_MAGIC)
+#define CHRONOS_EVENT_LOOP_MAGIC_SET(loopP)      (loopP)->magic = CHRONOS_EVENT_LOOP_MAGIC
+
+/* Max number of events handled per epoll_wait(), or
+ * completions per chronosUringWait() */
+#define CHRONOS_EVENT_LOOP_MAX_EVENTS   (256)
+
+/* Submission ring size of the io_uring engine */
+#define CHRONOS_EVENT_LOOP_URING_ENTRIES   (256)
+
+/* User data of the io_uring poll on the wakeup eventfd.
+ * Connection operations carry an aligned pointer, and
+ * cancellations 0 */
+#define CHRONOS_EVENT_LOOP_URING_WAKEUP   (1)
+
+typedef struct chronosEventLoop_t {
+  int                        magic;
+  chronosEventLoopEngine_t   engine;
+  int                        epollFd;
+  CHRONOS_URING_H            uringH;
+  int                        numConns;
+  int                        wakeupFd;
+
+  CHRONOS_COMPLETION_QUEUE_H completionQueueH;
+
+  chronosEventLoopErrorFp_t  errorFp;
+  void                      *errorArg;
+
+  struct epoll_event         eventArr[CHRONOS_EVENT_LOOP_MAX_EVENTS];
+  chronosUringCompletion_t   completionArr[CHRONOS_EVENT_LOOP_MAX_EVENTS];
+} chronosEventLoop_t;
+
+CHRONOS_EVENT_LOOP_H
+chronosEventLoopAlloc(chronosEventLoopErrorFp_t  errorFp,
+                      void                      *errorArg)
+{
+  return chronosEventLoopAllocWithEngine(CHRONOS_EVENT_LOOP_EPOLL, errorFp, errorArg);
+}
+
+/*--------------------------------------------------
+ * Arm the poll that tells the io_uring engine its
+ * wakeup eventfd was written to.
+ *------------------------------------------------*/
+static int
+chronosEventLoopUringWakeupArm(chronosEventLoop_t *loopP)
+{
+  return chronosUringPollPrep(loopP->wakeupFd,
+                              POLLIN,
+                              1,
+                              CHRONOS_EVENT_LOOP_URING_WAKEUP,
+                              loopP->uringH);
+}
+
+/*--------------------------------------------------
+ * Allocate a loop on the given engine. The io_uring
+ * engine falls back to epoll, with a warning, where
+ * io_uring is not available: chronosEventLoopEngineGet()
+ * tells which one the loop ended up with.
+ *------------------------------------------------*/
+CHRONOS_EVENT_LOOP_H
+chronosEventLoopAllocWithEngine(chronosEventLoopEngine_t   engine,
+                                chronosEventLoopErrorFp_t  errorFp,
+                                void                      *errorArg)
+{
+  struct epoll_event  event;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (engine != CHRONOS_EVENT_LOOP_EPOLL && engine != CHRONOS_EVENT_LOOP_URING) {
+    chronos_error("Invalid event loop engine: %d", engine);
+    return NULL;
+  }
+
+  loopP = malloc(sizeof(chronosEventLoop_t));
+  if (loopP == NULL) {
+    chronos_error("Could not allocate event loop");
+    goto failXit;
+  }
+
+  memset(loopP, 0, sizeof(*loopP));
+  loopP->wakeupFd = -1;
+  loopP->epollFd = -1;
+
+  loopP->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loopP->wakeupFd < 0) {
+    perror("eventfd() failed");
+    goto failXit;
+  }
+
+  if (engine == CHRONOS_EVENT_LOOP_URING) {
+    loopP->uringH = chronosUringAlloc(CHRONOS_EVENT_LOOP_URING_ENTRIES);
+    if (loopP->uringH == NULL) {
+      chronos_warning("io_uring not available, falling back to epoll");
+      engine = CHRONOS_EVENT_LOOP_EPOLL;
+    }
+    else if (chronosEventLoopUringWakeupArm(loopP) != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+  }
+
+  loopP->engine = engine;
+
+  if (engine == CHRONOS_EVENT_LOOP_EPOLL) {
+    loopP->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loopP->epollFd < 0) {
+      perror("epoll_create1() failed");
+      goto failXit;
+    }
+
+    /* The loop itself is the data of its wakeup event, which
+     * is how it is told apart from connection events */
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = loopP;
+    if (epoll_ctl(loopP->epollFd, EPOLL_CTL_ADD, loopP->wakeupFd, &event) < 0) {
+      perror("epoll_ctl() failed");
+      goto failXit;
+    }
+  }
+
+  loopP->completionQueueH = chronosCompletionQueueAlloc();
+  if (loopP->completionQueueH == NULL) {
+    goto failXit;
+  }
+
+  loopP->errorFp = errorFp;
+  loopP->errorArg = errorArg;
+  CHRONOS_EVENT_LOOP_MAGIC_SET(loopP);
+
+  return loopP;
+
+failXit:
+  if (loopP != NULL) {
+    if (loopP->uringH != NULL) {
+      chronosUringFree(loopP->uringH);
+    }
+    if (loopP->wakeupFd >= 0) {
+      close(loopP->wakeupFd);
+    }
+    if (loopP->epollFd >= 0) {
+      close(loopP->epollFd);
+    }
+    free(loopP);
+  }
+  return NULL;
+}
+
+chronosEventLoopEngine_t
+chronosEventLoopEngineGet(CHRONOS_EVENT_LOOP_H loopH)
+{
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_EVENT_LOOP_EPOLL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  return loopP->engine;
+}
+
+/*--------------------------------------------------
+ * Let the operations that connections removed from an
+ * io_uring loop left behind complete, so that their
+ * state is released, and retire the wakeup poll.
+ *------------------------------------------------*/
+static void
+chronosEventLoopUringDrain(chronosEventLoop_t *loopP)
+{
+  int i;
+  int rc;
+  int numTries;
+  int numCompletions;
+  CHRONOS_CONN_H connH = NULL;
+
+  chronosUringCancelPrep(CHRONOS_EVENT_LOOP_URING_WAKEUP, loopP->uringH);
+
+  for (numTries=0; numTries<100 && chronosUringNumPendingGet(loopP->uringH) > 0; numTries++) {
+    rc = chronosUringWait(10, 
+                          loopP->completionArr, 
+                          CHRONOS_EVENT_LOOP_MAX_EVENTS, 
+                          &numCompletions, 
+                          loopP->uringH);
+    if (rc != CHRONOS_SUCCESS) {
+      break;
+    }
+
+    for (i=0; i<numCompletions; i++) {
+      if (loopP->completionArr[i].userData > CHRONOS_EVENT_LOOP_URING_WAKEUP) {
+        chronosClientUringComplete(&(loopP->completionArr[i]), &connH);
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------
+ * Connections must have been removed from the loop
+ * before it is freed.
+ *------------------------------------------------*/
+int
+chronosEventLoopFree(CHRONOS_EVENT_LOOP_H loopH)
+{
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  if (loopP->numConns > 0) {
+    chronos_error("Event loop still has %d connections", loopP->numConns);
+    return CHRONOS_FAIL;
+  }
+
+  if (loopP->uringH != NULL) {
+    chronosEventLoopUringDrain(loopP);
+    chronosUringFree(loopP->uringH);
+  }
+  else {
+    close(loopP->epollFd);
+  }
+
+  chronosCompletionQueueFree(loopP->completionQueueH);
+  close(loopP->wakeupFd);
+
+  memset(loopP, 0, sizeof(*loopP));
+  free(loopP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Add a connected, or connecting, connection to the
+ * loop. A connection can only be in one loop. While in
+ * the loop, requests submitted on the connection
+ * complete to the loop's completion queue.
+ *------------------------------------------------*/
+int
+chronosEventLoopAdd(CHRONOS_CONN_H       connH,
+                    CHRONOS_EVENT_LOOP_H loopH)
+{
+  int rc;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL || connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  rc = chronosClientCompletionQueueSet(loopP->completionQueueH, connH);
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_error("Could not add connection to event loop");
+    return CHRONOS_FAIL;
+  }
+
+  if (loopP->uringH != NULL) {
+    rc = chronosClientUringAttach(loopP->uringH, connH);
+  }
+  else {
+    rc = chronosClientEpollAttach(loopP->epollFd, connH);
+  }
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_error("Could not add connection to event loop");
+    chronosClientCompletionQueueSet(NULL, connH);
+    return CHRONOS_FAIL;
+  }
+
+  loopP->numConns ++;
+
+  return CHRONOS_SUCCESS;
+}
+
+int
+chronosEventLoopRemove(CHRONOS_CONN_H       connH,
+                       CHRONOS_EVENT_LOOP_H loopH)
+{
+  int rc;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL || connH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  if (loopP->uringH != NULL) {
+    rc = chronosClientUringDetach(connH);
+  }
+  else {
+    rc = chronosClientEpollDetach(connH);
+  }
+  if (rc != CHRONOS_SUCCESS) {
+    return CHRONOS_FAIL;
+  }
+
+  /* Completions already queued stay in the loop's queue */
+  chronosClientCompletionQueueSet(NULL, connH);
+
+  loopP->numConns --;
+
+  return CHRONOS_SUCCESS;
+}
+
+int
+chronosEventLoopNumConnsGet(CHRONOS_EVENT_LOOP_H loopH)
+{
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    return -1;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  return loopP->numConns;
+}
+
+static void
+chronosEventLoopConnFail(CHRONOS_CONN_H      connH,
+                         chronosEventLoop_t *loopP)
+{
+  /* Disconnect first, so that its failed submissions
+   * still complete to the loop's queue */
+  chronosClientDisconnect(connH);
+  chronosEventLoopRemove(connH, loopP);
+  if (loopP->errorFp != NULL) {
+    loopP->errorFp(connH, loopP->errorArg);
+  }
+}
+
+/*--------------------------------------------------
+ * The io_uring engine: one system call hands the
+ * kernel every operation prepared since the last one
+ * and reaps the completions.
+ *------------------------------------------------*/
+static int
+chronosEventLoopUringRunOnce(int                 timeoutMs,
+                             int                *numEventsP,
+                             chronosEventLoop_t *loopP)
+{
+  int i;
+  int rc;
+  int numCompletions;
+  uint64_t value;
+  CHRONOS_CONN_H connH = NULL;
+  chronosUringCompletion_t *completionP = NULL;
+
+  rc = chronosUringWait(timeoutMs,
+                        loopP->completionArr,
+                        CHRONOS_EVENT_LOOP_MAX_EVENTS,
+                        &numCompletions,
+                        loopP->uringH);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  for (i=0; i<numCompletions; i++) {
+    completionP = &(loopP->completionArr[i]);
+
+    if (completionP->userData == CHRONOS_EVENT_LOOP_URING_WAKEUP) {
+      while (read(loopP->wakeupFd, &value, sizeof(value)) > 0) {
+        ;
+      }
+      if (chronosUringCompletionIsLast(completionP)
+          && chronosEventLoopUringWakeupArm(loopP) != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+      continue;
+    }
+    else if (completionP->userData == 0) {
+      continue;
+    }
+
+    rc = chronosClientUringComplete(completionP, &connH);
+    if (rc != CHRONOS_SUCCESS && connH != NULL) {
+      chronosEventLoopConnFail(connH, loopP);
+    }
+  }
+
+  if (numEventsP != NULL) {
+    *numEventsP = numCompletions;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Wait up to timeoutMs (-1 waits forever) for socket
+ * events and service the connections they belong to.
+ * A connection that fails is removed from the loop,
+ * disconnected and reported to the error callback.
+ *------------------------------------------------*/
+int
+chronosEventLoopRunOnce(int                  timeoutMs,
+                        int                 *numEventsP,
+                        CHRONOS_EVENT_LOOP_H loopH)
+{
+  int i;
+  int rc;
+  int numEvents;
+  uint64_t value;
+  CHRONOS_CONN_H connH = NULL;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  if (loopP->uringH != NULL) {
+    return chronosEventLoopUringRunOnce(timeoutMs, numEventsP, loopP);
+  }
+
+  numEvents = epoll_wait(loopP->epollFd,
+                         loopP->eventArr,
+                         CHRONOS_EVENT_LOOP_MAX_EVENTS,
+                         timeoutMs);
+  if (numEvents < 0) {
+    if (errno != EINTR) {
+      perror("epoll_wait() failed");
+      goto failXit;
+    }
+    numEvents = 0;
+  }
+
+  for (i=0; i<numEvents; i++) {
+    if (loopP->eventArr[i].data.ptr == loopP) {
+      while (read(loopP->wakeupFd, &value, sizeof(value)) > 0) {
+        ;
+      }
+      continue;
+    }
+
+    connH = loopP->eventArr[i].data.ptr;
+
+    rc = chronosClientEventsHandle(loopP->eventArr[i].events, connH);
+    if (rc != CHRONOS_SUCCESS) {
+      chronosEventLoopConnFail(connH, loopP);
+    }
+  }
+
+  if (numEventsP != NULL) {
+    *numEventsP = numEvents;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Service the loop until it has no connections left
+ * or isTimeToDieFp says so.
+ *------------------------------------------------*/
+int
+chronosEventLoopRun(int                  (*isTimeToDieFp) (void),
+                    CHRONOS_EVENT_LOOP_H   loopH)
+{
+  int rc;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  while (loopP->numConns > 0) {
+    if (isTimeToDieFp != NULL && isTimeToDieFp()) {
+      break;
+    }
+
+    rc = chronosEventLoopRunOnce(1000 /* one second */, NULL, loopH);
+    if (rc != CHRONOS_SUCCESS) {
+      return CHRONOS_FAIL;
+    }
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Make a thread blocked in the loop return right
+ * away, e.g. so that it notices it is time to die.
+ * Can be called from any thread.
+ *------------------------------------------------*/
+int
+chronosEventLoopInterrupt(CHRONOS_EVENT_LOOP_H loopH)
+{
+  uint64_t value = 1;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  if (write(loopP->wakeupFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    perror("write() failed");
+    return CHRONOS_FAIL;
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Collect completions of requests submitted on any of
+ * the loop's connections. If none is queued, service
+ * the loop for up to timeoutMs first (0 does not
+ * block). *numCompletionsP may be 0 on return.
+ *------------------------------------------------*/
+int
+chronosEventLoopPollCompletions(chronosCompletion_t  *completionArr,
+                                int                   maxCompletions,
+                                int                  *numCompletionsP,
+                                int                   timeoutMs,
+                                CHRONOS_EVENT_LOOP_H  loopH)
+{
+  int rc;
+  chronosEventLoop_t *loopP = NULL;
+
+  if (loopH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  loopP = (chronosEventLoop_t *) loopH;
+  CHRONOS_EVENT_LOOP_MAGIC_CHECK(loopP);
+
+  rc = chronosCompletionQueuePop(completionArr,
+                                 maxCompletions,
+                                 numCompletionsP,
+                                 loopP->completionQueueH);
+  if (rc != CHRONOS_SUCCESS || *numCompletionsP > 0) {
+    return rc;
+  }
+
+  rc = chronosEventLoopRunOnce(timeoutMs, NULL, loopH);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  return chronosCompletionQueuePop(completionArr,
+                                   maxCompletions,
+                                   numCompletionsP,
+                                   loopP->completionQueueH);
+
+failXit:
+  return CHRONOS_FAIL;
+}
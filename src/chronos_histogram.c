@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "chronos.h"
+#include "include/chronos_histogram.h"
+
+const char *chronos_latency_phase_str[] = {
+  "CHRONOS_LATENCY_PACK",
+  "CHRONOS_LATENCY_SEND",
+  "CHRONOS_LATENCY_WAIT"
+};
+
+#define CHRONOS_HIST_SUB_COUNT  (1 << CHRONOS_HIST_SUB_BITS)
+
+/* Histograms are written by a single thread but may be
+ * read by another one taking a snapshot. Relaxed atomics
+ * keep that well defined without a locked instruction on
+ * the recording side */
+#define HIST_LOAD(_p)         __atomic_load_n((_p), __ATOMIC_RELAXED)
+#define HIST_STORE(_p, _v)    __atomic_store_n((_p), (_v), __ATOMIC_RELAXED)
+#define HIST_ADD(_p, _v)      HIST_STORE((_p), HIST_LOAD(_p) + (_v))
+
+static int
+histBucketIdx(uint64_t valueNs)
+{
+  int msb;
+  int shift;
+
+  if (valueNs < CHRONOS_HIST_SUB_COUNT) {
+    return (int) valueNs;
+  }
+
+  msb = 63 - __builtin_clzll(valueNs);
+  if (msb >= CHRONOS_HIST_MAX_BITS) {
+    return CHRONOS_HIST_NUM_BUCKETS - 1;
+  }
+
+  shift = msb - CHRONOS_HIST_SUB_BITS;
+
+  return ((shift + 1) << CHRONOS_HIST_SUB_BITS)
+         + (int) ((valueNs >> shift) - CHRONOS_HIST_SUB_COUNT);
+}
+
+/* Highest value that falls in the bucket */
+static uint64_t
+histBucketValue(int idx)
+{
+  int shift;
+  uint64_t lower;
+
+  if (idx < CHRONOS_HIST_SUB_COUNT) {
+    return idx;
+  }
+
+  shift = (idx >> CHRONOS_HIST_SUB_BITS) - 1;
+  lower = (uint64_t) (CHRONOS_HIST_SUB_COUNT + (idx & (CHRONOS_HIST_SUB_COUNT - 1))) << shift;
+
+  return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+void
+chronosHistogramReset(chronosHistogram_t *histP)
+{
+  int i;
+
+  HIST_STORE(&histP->count, 0);
+  HIST_STORE(&histP->sumNs, 0);
+  HIST_STORE(&histP->minNs, UINT64_MAX);
+  HIST_STORE(&histP->maxNs, 0);
+
+  for (i=0; i<CHRONOS_HIST_NUM_BUCKETS; i++) {
+    HIST_STORE(&histP->bucketArr[i], 0);
+  }
+}
+
+/*--------------------------------------------------------
+ * Add one value to a histogram. Only one thread may record
+ * into a given histogram.
+ *------------------------------------------------------*/
+void
+chronosHistogramRecord(uint64_t            valueNs,
+                       chronosHistogram_t *histP)
+{
+  HIST_ADD(&histP->bucketArr[histBucketIdx(valueNs)], 1);
+  HIST_ADD(&histP->sumNs, valueNs);
+  HIST_ADD(&histP->count, 1);
+
+  if (valueNs < HIST_LOAD(&histP->minNs)) {
+    HIST_STORE(&histP->minNs, valueNs);
+  }
+  if (valueNs > HIST_LOAD(&histP->maxNs)) {
+    HIST_STORE(&histP->maxNs, valueNs);
+  }
+}
+
+/*--------------------------------------------------------
+ * Add the contents of srcP to dstP. srcP may be recording
+ * concurrently; the result is then a consistent-enough
+ * view of it, possibly missing the latest few values.
+ *------------------------------------------------------*/
+void
+chronosHistogramMerge(chronosHistogram_t       *dstP,
+                      const chronosHistogram_t *srcP)
+{
+  int i;
+  uint64_t value;
+
+  for (i=0; i<CHRONOS_HIST_NUM_BUCKETS; i++) {
+    value = HIST_LOAD(&srcP->bucketArr[i]);
+    if (value > 0) {
+      dstP->bucketArr[i] += value;
+    }
+  }
+
+  dstP->count += HIST_LOAD(&srcP->count);
+  dstP->sumNs += HIST_LOAD(&srcP->sumNs);
+
+  value = HIST_LOAD(&srcP->minNs);
+  if (value < dstP->minNs) {
+    dstP->minNs = value;
+  }
+  value = HIST_LOAD(&srcP->maxNs);
+  if (value > dstP->maxNs) {
+    dstP->maxNs = value;
+  }
+}
+
+/*--------------------------------------------------------
+ * Value at the given percentile (0-100). The answer is the
+ * highest value of the bucket the percentile falls in,
+ * capped by the largest value recorded.
+ *------------------------------------------------------*/
+uint64_t
+chronosHistogramPercentileGet(double                    percentile,
+                              const chronosHistogram_t *histP)
+{
+  int i;
+  uint64_t rank;
+  uint64_t seen = 0;
+  uint64_t value;
+
+  if (histP->count == 0) {
+    return 0;
+  }
+
+  if (percentile <= 0) {
+    return histP->minNs;
+  }
+  if (percentile >= 100) {
+    return histP->maxNs;
+  }
+
+  rank = (uint64_t) (percentile / 100.0 * histP->count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  for (i=0; i<CHRONOS_HIST_NUM_BUCKETS; i++) {
+    seen += histP->bucketArr[i];
+    if (seen >= rank) {
+      value = histBucketValue(i);
+      return (value < histP->maxNs) ? value : histP->maxNs;
+    }
+  }
+
+  return histP->maxNs;
+}
+
+double
+chronosHistogramMeanGet(const chronosHistogram_t *histP)
+{
+  if (histP->count == 0) {
+    return 0;
+  }
+
+  return (double) histP->sumNs / histP->count;
+}
+
+/*--------------------------------------------------------
+ * Per-thread latency sets. Each thread lazily allocates its
+ * own set and links it in a global list; the list lock is
+ * only taken when a thread registers, exits, or a snapshot
+ * is taken. When a thread exits its counts are folded into
+ * the retired set so they are not lost.
+ *------------------------------------------------------*/
+typedef struct chronosLatencySet_t {
+  struct chronosLatencySet_t *nextP;
+  struct chronosLatencySet_t *prevP;
+  chronosLatencySnapshot_t    latency;
+} chronosLatencySet_t;
+
+static pthread_key_t             latencySetKey;
+static pthread_once_t            latencySetOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t           latencySetLock = PTHREAD_MUTEX_INITIALIZER;
+static chronosLatencySet_t      *latencySetListP = NULL;
+static chronosLatencySnapshot_t *latencyRetiredP = NULL;
+
+static void
+latencySnapshotReset(chronosLatencySnapshot_t *snapshotP)
+{
+  int phase;
+  int txnType;
+
+  for (phase=0; phase<CHRONOS_LATENCY_PHASE_MAX; phase++) {
+    for (txnType=0; txnType<CHRONOS_LATENCY_NUM_TXN_TYPES; txnType++) {
+      chronosHistogramReset(&snapshotP->histArr[phase][txnType]);
+    }
+  }
+}
+
+static void
+latencySnapshotMerge(chronosLatencySnapshot_t       *dstP,
+                     const chronosLatencySnapshot_t *srcP)
+{
+  int phase;
+  int txnType;
+
+  for (phase=0; phase<CHRONOS_LATENCY_PHASE_MAX; phase++) {
+    for (txnType=0; txnType<CHRONOS_LATENCY_NUM_TXN_TYPES; txnType++) {
+      chronosHistogramMerge(&dstP->histArr[phase][txnType],
+                            &srcP->histArr[phase][txnType]);
+    }
+  }
+}
+
+static void
+latencySetDestroy(void *arg)
+{
+  chronosLatencySet_t *setP = (chronosLatencySet_t *) arg;
+
+  if (setP == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&latencySetLock);
+
+  if (latencyRetiredP == NULL) {
+    latencyRetiredP = malloc(sizeof(chronosLatencySnapshot_t));
+    if (latencyRetiredP != NULL) {
+      latencySnapshotReset(latencyRetiredP);
+    }
+  }
+
+  if (latencyRetiredP != NULL) {
+    latencySnapshotMerge(latencyRetiredP, &setP->latency);
+  }
+  else {
+    chronos_warning("Dropping latencies of exiting thread");
+  }
+
+  if (setP->prevP != NULL) {
+    setP->prevP->nextP = setP->nextP;
+  }
+  else {
+    latencySetListP = setP->nextP;
+  }
+  if (setP->nextP != NULL) {
+    setP->nextP->prevP = setP->prevP;
+  }
+
+  pthread_mutex_unlock(&latencySetLock);
+
+  free(setP);
+}
+
+static void
+latencySetKeyCreate(void)
+{
+  if (pthread_key_create(&latencySetKey, latencySetDestroy) != 0) {
+    chronos_error("Could not create latency set key");
+  }
+}
+
+static chronosLatencySet_t *
+latencySetGet(void)
+{
+  chronosLatencySet_t *setP = NULL;
+
+  pthread_once(&latencySetOnce, latencySetKeyCreate);
+
+  setP = pthread_getspecific(latencySetKey);
+  if (setP != NULL) {
+    return setP;
+  }
+
+  setP = malloc(sizeof(chronosLatencySet_t));
+  if (setP == NULL) {
+    return NULL;
+  }
+
+  latencySnapshotReset(&setP->latency);
+
+  if (pthread_setspecific(latencySetKey, setP) != 0) {
+    free(setP);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&latencySetLock);
+  setP->prevP = NULL;
+  setP->nextP = latencySetListP;
+  if (latencySetListP != NULL) {
+    latencySetListP->prevP = setP;
+  }
+  latencySetListP = setP;
+  pthread_mutex_unlock(&latencySetLock);
+
+  return setP;
+}
+
+uint64_t
+chronosLatencyNowNs(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*--------------------------------------------------------
+ * Record a latency in the calling thread's histograms.
+ *------------------------------------------------------*/
+void
+chronosLatencyRecord(chronosUserTransaction_t txnType,
+                     chronosLatencyPhase_t    phase,
+                     uint64_t                 latencyNs)
+{
+  chronosLatencySet_t *setP = NULL;
+
+  if (txnType < 0 || txnType >= CHRONOS_LATENCY_NUM_TXN_TYPES
+      || phase < 0 || phase >= CHRONOS_LATENCY_PHASE_MAX) {
+    return;
+  }
+
+  setP = latencySetGet();
+  if (setP == NULL) {
+    return;
+  }
+
+  chronosHistogramRecord(latencyNs, &setP->latency.histArr[phase][txnType]);
+}
+
+/*--------------------------------------------------------
+ * Merge the latencies of every thread, live or exited,
+ * into snapshotP.
+ *------------------------------------------------------*/
+int
+chronosLatencySnapshotGet(chronosLatencySnapshot_t *snapshotP)
+{
+  chronosLatencySet_t *setP = NULL;
+
+  if (snapshotP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  latencySnapshotReset(snapshotP);
+
+  pthread_mutex_lock(&latencySetLock);
+
+  if (latencyRetiredP != NULL) {
+    latencySnapshotMerge(snapshotP, latencyRetiredP);
+  }
+
+  for (setP = latencySetListP; setP != NULL; setP = setP->nextP) {
+    latencySnapshotMerge(snapshotP, &setP->latency);
+  }
+
+  pthread_mutex_unlock(&latencySetLock);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------------
+ * Clear the latencies of every thread. Values recorded
+ * while the reset is in progress may be lost.
+ *------------------------------------------------------*/
+int
+chronosLatencyReset(void)
+{
+  chronosLatencySet_t *setP = NULL;
+
+  pthread_mutex_lock(&latencySetLock);
+
+  if (latencyRetiredP != NULL) {
+    latencySnapshotReset(latencyRetiredP);
+  }
+
+  for (setP = latencySetListP; setP != NULL; setP = setP->nextP) {
+    latencySnapshotReset(&setP->latency);
+  }
+
+  pthread_mutex_unlock(&latencySetLock);
+
+  return CHRONOS_SUCCESS;
+}
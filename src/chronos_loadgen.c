@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include "chronos.h"
+#include "include/chronos_loadgen.h"
+#include "include/chronos_histogram.h"
+
+#define CHRONOS_LOADGEN_MAGIC   (0x10AD)
+#define CHRONOS_LOADGEN_MAGIC_CHECK(loadGenP)    assert((loadGenP)->magic == CHRONOS_LOADGEN_MAGIC)
+#define CHRONOS_LOADGEN_MAGIC_SET(loadGenP)      (loadGenP)->magic = CHRONOS_LOADGEN_MAGIC
+
+/* Max number of requests handed to a single writev() */
+#define CHRONOS_LOADGEN_SEND_BATCH   (32)
+
+/* Longest single wait, in us, so that isTimeToDieFp is
+ * still checked regularly */
+#define CHRONOS_LOADGEN_MAX_WAIT_US  (100000)
+
+#define CHRONOS_LOADGEN_SLOT(_requestId)  ((_requestId) & (CHRONOS_CLIENT_MAX_INFLIGHT - 1))
+
+/*--------------------------------------------------
+ * What the generator remembers about a request in
+ * flight. Requests are found by the id the client
+ * stamped on them, the same way the connection
+ * tracks them.
+ *------------------------------------------------*/
+typedef struct chronosLoadGenSlot_t {
+  uint64_t                  intendedNs;
+  uint64_t                  deadlineNs;
+  chronosUserTransaction_t  txnType;
+} chronosLoadGenSlot_t;
+
+typedef struct chronosLoadGen_t {
+  int                     magic;
+  chronosLoadGenConfig_t  config;
+  int                     totalWeight;
+  double                  meanIntervalNs;
+
+  CHRONOS_CONN_H          connH;
+  CHRONOS_CLIENT_CACHE_H  clientCacheH;
+  CHRONOS_ENV_H           envH;
+  chronosRandom_t        *randP;
+
+  chronosLoadGenStats_t   stats;
+  chronosLoadGenSlot_t    slotArr[CHRONOS_CLIENT_MAX_INFLIGHT];
+} chronosLoadGen_t;
+
+/*--------------------------------------------------
+ * Time until the next arrival. Poisson arrivals have
+ * exponentially distributed gaps with the same mean
+ * as the constant schedule.
+ *------------------------------------------------*/
+static uint64_t
+loadGenIntervalNext(chronosLoadGen_t *loadGenP)
+{
+  if (loadGenP->config.arrivalType == CHRONOS_ARRIVAL_POISSON) {
+    return (uint64_t) (-log(1.0 - chronosRandomDouble(loadGenP->randP))
+                       * loadGenP->meanIntervalNs);
+  }
+
+  return (uint64_t) loadGenP->meanIntervalNs;
+}
+
+static chronosUserTransaction_t
+loadGenTxnTypeNext(chronosLoadGen_t *loadGenP)
+{
+  int txnType;
+  int draw;
+
+  if (loadGenP->totalWeight == 0) {
+    return (chronosUserTransaction_t) chronosRandomRange(CHRONOS_USER_TXN_MAX, loadGenP->randP);
+  }
+
+  draw = chronosRandomRange(loadGenP->totalWeight, loadGenP->randP);
+  for (txnType = CHRONOS_USER_TXN_MIN; txnType < CHRONOS_USER_TXN_MAX; txnType ++) {
+    draw -= loadGenP->config.txnWeightArr[txnType];
+    if (draw < 0) {
+      break;
+    }
+  }
+
+  assert(txnType < CHRONOS_USER_TXN_MAX);
+  return (chronosUserTransaction_t) txnType;
+}
+
+CHRONOS_LOADGEN_H
+chronosLoadGenAlloc(const chronosLoadGenConfig_t *configP,
+                    CHRONOS_CONN_H                connH,
+                    CHRONOS_CLIENT_CACHE_H        clientCacheH)
+{
+  int i;
+  chronosLoadGen_t *loadGenP = NULL;
+
+  if (configP == NULL || connH == NULL || clientCacheH == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  if (!(configP->ratePerSec > 0)) {
+    chronos_error("Invalid arrival rate");
+    goto failXit;
+  }
+
+  if (configP->maxInFlight < 0 || configP->maxInFlight > CHRONOS_CLIENT_MAX_INFLIGHT) {
+    chronos_error("Invalid max number of requests in flight: %d", configP->maxInFlight);
+    goto failXit;
+  }
+
+  loadGenP = malloc(sizeof(chronosLoadGen_t));
+  if (loadGenP == NULL) {
+    chronos_error("Could not allocate load generator");
+    goto failXit;
+  }
+
+  memset(loadGenP, 0, sizeof(*loadGenP));
+  loadGenP->config = *configP;
+
+  if (loadGenP->config.maxInFlight == 0) {
+    loadGenP->config.maxInFlight = CHRONOS_CLIENT_MAX_INFLIGHT;
+  }
+
+  for (i=CHRONOS_USER_TXN_MIN; i<CHRONOS_USER_TXN_MAX; i++) {
+    if (configP->txnWeightArr[i] < 0) {
+      chronos_error("Invalid weight for %s", CHRONOS_TXN_NAME(i));
+      goto failXit;
+    }
+    loadGenP->totalWeight += configP->txnWeightArr[i];
+  }
+
+  loadGenP->meanIntervalNs = 1000000000.0 / configP->ratePerSec;
+
+  loadGenP->envH = chronosClientEnvGet(connH);
+  if (loadGenP->envH == NULL) {
+    chronos_error("Could not get env handle");
+    goto failXit;
+  }
+
+  loadGenP->randP = chronosClientCacheRandomGet(clientCacheH);
+  if (loadGenP->randP == NULL) {
+    chronos_error("Could not get random stream");
+    goto failXit;
+  }
+
+  loadGenP->connH = connH;
+  loadGenP->clientCacheH = clientCacheH;
+  CHRONOS_LOADGEN_MAGIC_SET(loadGenP);
+
+  return loadGenP;
+
+failXit:
+  if (loadGenP != NULL) {
+    free(loadGenP);
+  }
+  return NULL;
+}
+
+int
+chronosLoadGenFree(CHRONOS_LOADGEN_H loadGenH)
+{
+  chronosLoadGen_t *loadGenP = NULL;
+
+  if (loadGenH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loadGenP = (chronosLoadGen_t *) loadGenH;
+  CHRONOS_LOADGEN_MAGIC_CHECK(loadGenP);
+
+  memset(loadGenP, 0, sizeof(*loadGenP));
+  free(loadGenP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Sends every request whose scheduled time has come,
+ * as far as the window allows. Requests that could
+ * not go out stay due; their scheduled time does not
+ * move, so the wait is charged to their latency.
+ *------------------------------------------------*/
+static int
+loadGenSendDue(uint64_t          nowNs,
+               uint64_t         *nextSendNsP,
+               uint64_t         *numToSendP,
+               chronosLoadGen_t *loadGenP)
+{
+  int i;
+  int rc;
+  int numBatch = 0;
+  int numInFlight;
+  unsigned int requestId;
+  chronosLoadGenSlot_t *slotP = NULL;
+  uint64_t intendedArr[CHRONOS_LOADGEN_SEND_BATCH];
+  CHRONOS_REQUEST_H requestArr[CHRONOS_LOADGEN_SEND_BATCH];
+
+  numInFlight = chronosClientNumInFlightGet(loadGenP->connH);
+
+  while (*numToSendP > 0
+         && *nextSendNsP <= nowNs
+         && numBatch < CHRONOS_LOADGEN_SEND_BATCH) {
+
+    if (numInFlight + numBatch >= loadGenP->config.maxInFlight) {
+      loadGenP->stats.numWindowFull ++;
+      break;
+    }
+
+    requestArr[numBatch] = chronosRequestCreate(loadGenP->config.numDataItems,
+                                                loadGenTxnTypeNext(loadGenP),
+                                                loadGenP->clientCacheH,
+                                                loadGenP->envH);
+    if (requestArr[numBatch] == NULL) {
+      chronos_error("Could not create request");
+      goto failXit;
+    }
+
+    /* The deadline runs from the scheduled send time, which
+     * may already be behind us */
+    if (loadGenP->config.relativeDeadlineNs > 0) {
+      chronosRequestDeadlineSet(chronosRequestCreatedGet(requestArr[numBatch])
+                                + loadGenP->config.relativeDeadlineNs
+                                - (nowNs - *nextSendNsP),
+                                requestArr[numBatch]);
+    }
+    chronosRequestPrioritySet(loadGenP->config.priority, requestArr[numBatch]);
+
+    intendedArr[numBatch] = *nextSendNsP;
+    numBatch ++;
+
+    *nextSendNsP += loadGenIntervalNext(loadGenP);
+    (*numToSendP) --;
+  }
+
+  if (numBatch == 0) {
+    return CHRONOS_SUCCESS;
+  }
+
+  rc = chronosClientSendRequests(requestArr, numBatch, loadGenP->connH);
+  if (rc != CHRONOS_SUCCESS) {
+    chronos_error("Could not send requests");
+    goto failXit;
+  }
+
+  for (i=0; i<numBatch; i++) {
+    requestId = chronosRequestIdGet(requestArr[i]);
+    slotP = &(loadGenP->slotArr[CHRONOS_LOADGEN_SLOT(requestId)]);
+    slotP->intendedNs = intendedArr[i];
+    slotP->txnType = chronosRequestTypeGet(requestArr[i]);
+    slotP->deadlineNs = chronosRequestDeadlineGet(requestArr[i]);
+
+    if (nowNs - intendedArr[i] > loadGenP->stats.sendLagMaxNs) {
+      loadGenP->stats.sendLagMaxNs = nowNs - intendedArr[i];
+    }
+
+    chronosRequestFree(requestArr[i]);
+  }
+
+  loadGenP->stats.numSent += numBatch;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  for (i=0; i<numBatch; i++) {
+    chronosRequestFree(requestArr[i]);
+  }
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Collects responses until the next send is due.
+ * With timeoutUs zero only what already arrived is
+ * collected.
+ *------------------------------------------------*/
+static int
+loadGenCollect(int               timeoutUs,
+               chronosLoadGen_t *loadGenP)
+{
+  int rc;
+  int txn_rc;
+  uint64_t nowNs;
+  uint64_t latencyNs;
+  unsigned int requestId;
+  chronosLoadGenSlot_t *slotP = NULL;
+
+  while (chronosClientNumInFlightGet(loadGenP->connH) > 0) {
+    rc = chronosClientReceiveResponseAny(&requestId, &txn_rc, timeoutUs, loadGenP->connH);
+    if (rc == CHRONOS_TIMEOUT) {
+      break;
+    }
+    else if (rc != CHRONOS_SUCCESS) {
+      chronos_error("Could not receive response");
+      goto failXit;
+    }
+
+    nowNs = chronosLatencyNowNs();
+    slotP = &(loadGenP->slotArr[CHRONOS_LOADGEN_SLOT(requestId)]);
+    latencyNs = nowNs - slotP->intendedNs;
+
+    loadGenP->stats.numCompleted ++;
+    if (txn_rc != CHRONOS_SUCCESS) {
+      loadGenP->stats.numTxnFailed ++;
+    }
+    loadGenP->stats.latencySumNs += latencyNs;
+    if (latencyNs > loadGenP->stats.latencyMaxNs) {
+      loadGenP->stats.latencyMaxNs = latencyNs;
+    }
+    if (slotP->deadlineNs != 0 && chronosRequestTimeNowNs() > slotP->deadlineNs) {
+      loadGenP->stats.numDeadlineMissed ++;
+    }
+
+    if (loadGenP->config.completeFp != NULL) {
+      loadGenP->config.completeFp(slotP->txnType, txn_rc, latencyNs, loadGenP->config.completeArg);
+    }
+
+    /* Got one, pick up the rest without waiting */
+    timeoutUs = 0;
+  }
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Drives the connection open-loop until numRequests
+ * have been sent or durationMs have elapsed, whichever
+ * comes first (zero means no limit, but at least one
+ * must be given). Then waits for every request still
+ * in flight. Statistics accumulate across runs.
+ *------------------------------------------------*/
+int
+chronosLoadGenRun(uint64_t          numRequests,
+                  int               durationMs,
+                  int             (*isTimeToDieFp) (void),
+                  CHRONOS_LOADGEN_H loadGenH)
+{
+  int rc;
+  int timeoutUs;
+  int numInFlight;
+  uint64_t nowNs;
+  uint64_t startNs;
+  uint64_t endNs;
+  uint64_t nextSendNs;
+  uint64_t numToSend;
+  chronosLoadGen_t *loadGenP = NULL;
+
+  if (loadGenH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  loadGenP = (chronosLoadGen_t *) loadGenH;
+  CHRONOS_LOADGEN_MAGIC_CHECK(loadGenP);
+
+  if (numRequests == 0 && durationMs <= 0) {
+    chronos_error("Either a number of requests or a duration is needed");
+    goto failXit;
+  }
+
+  numToSend = (numRequests > 0) ? numRequests : UINT64_MAX;
+
+  startNs = chronosLatencyNowNs();
+  endNs = (durationMs > 0) ? startNs + (uint64_t) durationMs * 1000000ULL : UINT64_MAX;
+  nextSendNs = startNs;
+
+  while (1) {
+    if (isTimeToDieFp != NULL && isTimeToDieFp()) {
+      chronos_error("requested to die");
+      goto failXit;
+    }
+
+    nowNs = chronosLatencyNowNs();
+    if (nowNs >= endNs) {
+      numToSend = 0;
+    }
+
+    rc = loadGenSendDue(nowNs, &nextSendNs, &numToSend, loadGenP);
+    if (rc != CHRONOS_SUCCESS) {
+      goto failXit;
+    }
+
+    if (numToSend == 0 && chronosClientNumInFlightGet(loadGenP->connH) == 0) {
+      break;
+    }
+
+    /* Wait for responses until the next send is due. Once
+     * sending is over, or while the window is full, wait
+     * in short slices so we can still honor isTimeToDieFp */
+    nowNs = chronosLatencyNowNs();
+    numInFlight = chronosClientNumInFlightGet(loadGenP->connH);
+    if (numToSend == 0 || numInFlight >= loadGenP->config.maxInFlight) {
+      timeoutUs = CHRONOS_LOADGEN_MAX_WAIT_US;
+    }
+    else if (nextSendNs <= nowNs) {
+      timeoutUs = 0;
+    }
+    else if (nextSendNs - nowNs >= CHRONOS_LOADGEN_MAX_WAIT_US * 1000ULL) {
+      timeoutUs = CHRONOS_LOADGEN_MAX_WAIT_US;
+    }
+    else {
+      timeoutUs = (int) ((nextSendNs - nowNs) / 1000);
+    }
+
+    if (numInFlight > 0) {
+      rc = loadGenCollect(timeoutUs, loadGenP);
+      if (rc != CHRONOS_SUCCESS) {
+        goto failXit;
+      }
+    }
+    else if (timeoutUs > 0) {
+      struct timespec sleepTime;
+      sleepTime.tv_sec = timeoutUs / 1000000;
+      sleepTime.tv_nsec = (timeoutUs % 1000000) * 1000L;
+      nanosleep(&sleepTime, NULL);
+    }
+  }
+
+  loadGenP->stats.elapsedNs += chronosLatencyNowNs() - startNs;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+int
+chronosLoadGenStatsGet(chronosLoadGenStats_t *statsP,
+                       CHRONOS_LOADGEN_H      loadGenH)
+{
+  chronosLoadGen_t *loadGenP = NULL;
+
+  if (loadGenH == NULL || statsP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  loadGenP = (chronosLoadGen_t *) loadGenH;
+  CHRONOS_LOADGEN_MAGIC_CHECK(loadGenP);
+
+  *statsP = loadGenP->stats;
+
+  return CHRONOS_SUCCESS;
+}
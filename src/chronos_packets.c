@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 #include "chronos.h"
 #include "include/chronos_transactions.h"
 #include "include/chronos_packets.h"
 #include "include/chronos_environment.h"
 #include "include/chronos_cache.h"
+#include "include/chronos_histogram.h"
 
 const char *chronos_user_transaction_str[] = {
   "CHRONOS_USER_TXN_VIEW_STOCK",
@@ -18,6 +21,132 @@ const char *chronos_system_transaction_str[] = {
   "CHRONOS_SYS_TXN_UPDATE_STOCK"
 };
 
+/*--------------------------------------------------------
+ * Request packets are recycled through a small per-thread
+ * pool, so that in steady state creating and freeing a
+ * request does not touch the heap. Packets sitting in the
+ * pool are all zeroes: when a packet is released only the
+ * part that was used (its frame) is cleared.
+ *------------------------------------------------------*/
+#define CHRONOS_REQUEST_POOL_SIZE   (256)
+
+typedef struct chronosRequestPool_t {
+  int                      numFree;
+  chronosRequestPacket_t  *freeArr[CHRONOS_REQUEST_POOL_SIZE];
+} chronosRequestPool_t;
+
+static pthread_key_t   requestPoolKey;
+static pthread_once_t  requestPoolOnce = PTHREAD_ONCE_INIT;
+
+static void
+chronosRequestPoolDestroy(void *arg)
+{
+  int i;
+  chronosRequestPool_t *poolP = (chronosRequestPool_t *) arg;
+
+  if (poolP == NULL) {
+    return;
+  }
+
+  for (i=0; i<poolP->numFree; i++) {
+    free(poolP->freeArr[i]);
+    poolP->freeArr[i] = NULL;
+  }
+
+  free(poolP);
+}
+
+static void
+chronosRequestPoolKeyCreate(void)
+{
+  if (pthread_key_create(&requestPoolKey, chronosRequestPoolDestroy) != 0) {
+    chronos_error("Could not create request pool key");
+  }
+}
+
+static chronosRequestPool_t *
+chronosRequestPoolGet(void)
+{
+  chronosRequestPool_t *poolP = NULL;
+
+  pthread_once(&requestPoolOnce, chronosRequestPoolKeyCreate);
+
+  poolP = pthread_getspecific(requestPoolKey);
+  if (poolP == NULL) {
+    poolP = malloc(sizeof(chronosRequestPool_t));
+    if (poolP == NULL) {
+      return NULL;
+    }
+
+    memset(poolP, 0, sizeof(*poolP));
+
+    if (pthread_setspecific(requestPoolKey, poolP) != 0) {
+      free(poolP);
+      return NULL;
+    }
+  }
+
+  return poolP;
+}
+
+/*--------------------------------------------------------
+ * Get a zeroed request packet, from this thread's pool if
+ * possible.
+ *------------------------------------------------------*/
+static chronosRequestPacket_t *
+chronosRequestPacketAlloc(void)
+{
+  chronosRequestPool_t   *poolP = NULL;
+  chronosRequestPacket_t *reqPacketP = NULL;
+
+  poolP = chronosRequestPoolGet();
+  if (poolP != NULL && poolP->numFree > 0) {
+    poolP->numFree --;
+    reqPacketP = poolP->freeArr[poolP->numFree];
+    poolP->freeArr[poolP->numFree] = NULL;
+    return reqPacketP;
+  }
+
+  reqPacketP = malloc(sizeof(chronosRequestPacket_t));
+  if (reqPacketP == NULL) {
+    return NULL;
+  }
+
+  memset(reqPacketP, 0, sizeof(*reqPacketP));
+
+  return reqPacketP;
+}
+
+/*--------------------------------------------------------
+ * Clear the used part of a request packet and give it
+ * back to this thread's pool. If the pool is full the
+ * packet is freed.
+ *------------------------------------------------------*/
+static void
+chronosRequestPacketRelease(chronosRequestPacket_t *reqPacketP)
+{
+  size_t itemSize;
+  size_t usedSize = sizeof(*reqPacketP);
+  chronosRequestPool_t *poolP = NULL;
+
+  itemSize = chronosRequestItemSizeGet(reqPacketP->txn_type);
+  if (itemSize > 0 
+      && 0 <= reqPacketP->numItems 
+      && reqPacketP->numItems <= CHRONOS_REQUEST_PACKET_SIZE) {
+    usedSize = CHRONOS_REQUEST_HEADER_SIZE + reqPacketP->numItems * itemSize;
+  }
+
+  poolP = chronosRequestPoolGet();
+  if (poolP == NULL || poolP->numFree >= CHRONOS_REQUEST_POOL_SIZE) {
+    free(reqPacketP);
+    return;
+  }
+
+  memset(reqPacketP, 0, usedSize);
+  poolP->freeArr[poolP->numFree] = reqPacketP;
+  poolP->numFree ++;
+}
+
 /*--------------------------------------------------------
  * Pack a request for updating the stock price for
  * the provided symbol.
@@ -184,12 +313,63 @@ cleanup:
   return rc;
 }
 
+/*---------------------------------------------------------
+ * Pick the symbol of one data item of a user transaction.
+ * With a symbol distribution the draw is already a symbol
+ * id of the chronos cache, so that all users share its hot
+ * symbols. Otherwise it is a raw draw that picks a symbol
+ * of the user's portfolio.
+ *-------------------------------------------------------*/
+static const char *
+chronosRequestSymbolPick(unsigned int            draw,
+                         int                     isSymbolId,
+                         int                     user_idx,
+                         int                    *symbolIdP,
+                         CHRONOS_CLIENT_CACHE_H  clientCacheH,
+                         CHRONOS_CACHE_H         chronosCacheH)
+{
+  int symbol_idx;
+
+  if (isSymbolId) {
+    *symbolIdP = (int) draw;
+    return chronosCacheSymbolGet((int) draw, chronosCacheH);
+  }
+
+  symbol_idx = CHRONOS_RANDOM_BOUND(draw, 
+                                    chronosClientCacheNumSymbolFromUserGet(user_idx, clientCacheH));
+
+  *symbolIdP = chronosClientCacheSymbolIdFromUserGet(user_idx, symbol_idx, clientCacheH);
+  return chronosClientCacheSymbolFromUserGet(user_idx, symbol_idx, clientCacheH);
+}
+
+/*---------------------------------------------------------
+ * Tell a "latest" symbol distribution which symbol was
+ * just updated. Symbol ids are mapped back to its keys.
+ *-------------------------------------------------------*/
+static void
+chronosRequestLatestSet(int                symbolId,
+                        int                numSymbols,
+                        CHRONOS_KEY_DIST_H symbolDistH)
+{
+  int numKeys;
+
+  if (symbolDistH == NULL 
+      || numSymbols <= 0
+      || chronosKeyDistTypeGet(symbolDistH) != CHRONOS_KEY_DIST_LATEST) {
+    return;
+  }
+
+  numKeys = chronosKeyDistNumKeysGet(symbolDistH);
+  chronosKeyDistLatestSet((int) ((int64_t) symbolId * numKeys / numSymbols), symbolDistH);
+}
+
 CHRONOS_REQUEST_H
 chronosRequestCreateForClient(int user_idx,
                               CHRONOS_CLIENT_CACHE_H  clientCacheH,
                               CHRONOS_ENV_H envH)
 {
   int i;
+  uint64_t startNs = chronosLatencyNowNs();
   int rc = CHRONOS_SUCCESS;
   int num_data_items = CHRONOS_MAX_DATA_ITEMS_PER_XACT;
   int random_user_idx = 0;
@@ -213,14 +393,14 @@ chronosRequestCreateForClient(int user_idx,
     goto failXit;
   }
 
-  reqPacketP = malloc(sizeof(chronosRequestPacket_t));
+  reqPacketP = chronosRequestPacketAlloc();
   if (reqPacketP == NULL) {
     chronos_error("Could not allocate request structure");
     goto failXit;
   }
 
-  memset(reqPacketP, 0, sizeof(*reqPacketP));
   CHRONOS_REQUEST_MAGIC_SET(reqPacketP);
+  reqPacketP->createdNs = chronosRequestTimeNowNs();
 
   // Get user details
   user = chronosClientCacheUserGet(user_idx, clientCacheH);
@@ -254,11 +434,16 @@ chronosRequestCreateForClient(int user_idx,
 
 failXit:
   if (reqPacketP != NULL) {
-    free(reqPacketP);
+    chronosRequestPacketRelease(reqPacketP);
     reqPacketP = NULL;
   }
 
 cleanup:
+  if (reqPacketP != NULL) {
+    chronosLatencyRecord(reqPacketP->txn_type, 
+                         CHRONOS_LATENCY_PACK, 
+                         chronosLatencyNowNs() - startNs);
+  }
   return (void *) reqPacketP;
 }
 
@@ -275,10 +460,13 @@ chronosRequestUpdateFromListCreate(unsigned int             num_data_items,
                                    CHRONOS_ENV_H            envH)
 {
   int i;
+  uint64_t startNs = chronosLatencyNowNs();
   int rc = CHRONOS_SUCCESS;
   int symbolIdx = -1;
+  int numSymbols;
   float random_price;
   const char *symbol = NULL;
+  CHRONOS_KEY_DIST_H      symbolDistH = NULL;
   CHRONOS_CACHE_H         chronosCacheH = NULL;
   chronosRequestPacket_t *reqPacketP = NULL;
 
@@ -293,17 +481,25 @@ chronosRequestUpdateFromListCreate(unsigned int             num_data_items,
     goto failXit;
   }
 
-  reqPacketP = malloc(sizeof(chronosRequestPacket_t));
+  if (num_data_items > CHRONOS_REQUEST_PACKET_SIZE) {
+    chronos_error("Too many data items: %u", num_data_items);
+    goto failXit;
+  }
+
+  reqPacketP = chronosRequestPacketAlloc();
   if (reqPacketP == NULL) {
     chronos_error("Could not allocate request structure");
     goto failXit;
   }
 
-  memset(reqPacketP, 0, sizeof(*reqPacketP));
   CHRONOS_REQUEST_MAGIC_SET(reqPacketP);
+  reqPacketP->createdNs = chronosRequestTimeNowNs();
   reqPacketP->txn_type = CHRONOS_SYS_TXN_UPDATE_STOCK;
   reqPacketP->numItems = num_data_items;
 
+  numSymbols = chronosCacheNumSymbolsGet(chronosCacheH);
+  symbolDistH = chronosClientCacheSymbolDistGet(clientCacheH);
+
   for (i=0; i<num_data_items; i++) {
     /*--------------------------------------------------
      * TODO: According to the paper, a server thread
@@ -332,16 +528,23 @@ chronosRequestUpdateFromListCreate(unsigned int             num_data_items,
       chronos_error("Could not pack update request");
       goto failXit;
     }
+
+    chronosRequestLatestSet(symbolIdx, numSymbols, symbolDistH);
   }
   goto cleanup;
 
 failXit:
   if (reqPacketP != NULL) {
-    free(reqPacketP);
+    chronosRequestPacketRelease(reqPacketP);
     reqPacketP = NULL;
   }
 
 cleanup:
+  if (reqPacketP != NULL) {
+    chronosLatencyRecord(reqPacketP->txn_type, 
+                         CHRONOS_LATENCY_PACK, 
+                         chronosLatencyNowNs() - startNs);
+  }
   return (void *) reqPacketP;
 }
 
@@ -359,8 +562,12 @@ chronosRequestDump(CHRONOS_REQUEST_H requestH)
   requestP = (chronosRequestPacket_t *) requestH;
 
   fprintf(stderr, "================================================\n");
+  fprintf(stderr, " Txn Id: %u\n", requestP->requestId);
   fprintf(stderr, " Txn Type: %s\n", CHRONOS_TXN_NAME(requestP->txn_type));
   fprintf(stderr, " Txn Size: %d\n", requestP->numItems);
+  fprintf(stderr, " Txn Priority: %d\n", requestP->priority);
+  fprintf(stderr, " Txn Created: %llu\n", (unsigned long long) requestP->createdNs);
+  fprintf(stderr, " Txn Deadline: %llu\n", (unsigned long long) requestP->deadlineNs);
   fprintf(stderr, "------------------------------------------------\n");
 
   for (i=0; i<requestP->numItems; i++) {
@@ -428,16 +635,23 @@ chronosRequestCreate(unsigned int             num_data_items,
                      CHRONOS_ENV_H            envH)
 {
   int i;
-  int random_num_data_items = CHRONOS_MIN_DATA_ITEMS_PER_XACT + rand() % (1 + CHRONOS_MAX_DATA_ITEMS_PER_XACT - CHRONOS_MIN_DATA_ITEMS_PER_XACT);
+  uint64_t startNs = chronosLatencyNowNs();
+  int random_num_data_items = 0;
   int rc = CHRONOS_SUCCESS;
+  int numPortfolios = 0;
+  int numSymbols = 0;
   int random_user_idx = 0;
-  int random_symbol_idx = 0;
   int random_symbol;
   int random_amount;
   float random_price;
   int symbol_idx = 0;
   const char *symbol;
   const char *user;
+  unsigned int userDrawArr[CHRONOS_REQUEST_PACKET_SIZE];
+  unsigned int symbolDrawArr[CHRONOS_REQUEST_PACKET_SIZE];
+  chronosRandom_t *randP = NULL;
+  CHRONOS_KEY_DIST_H userDistH = NULL;
+  CHRONOS_KEY_DIST_H symbolDistH = NULL;
   chronosRequestPacket_t *reqPacketP = NULL;
   CHRONOS_CACHE_H chronosCacheH = NULL;
 
@@ -452,36 +666,72 @@ chronosRequestCreate(unsigned int             num_data_items,
     goto failXit;
   }
 
+  randP = chronosClientCacheRandomGet(clientCacheH);
+  if (randP == NULL) {
+    chronos_error("Invalid client cache handle");
+    goto failXit;
+  }
+
   if (num_data_items > 0) {
     random_num_data_items = num_data_items;
   }
+  else {
+    random_num_data_items = CHRONOS_MIN_DATA_ITEMS_PER_XACT 
+                            + chronosRandomRange(1 + CHRONOS_MAX_DATA_ITEMS_PER_XACT - CHRONOS_MIN_DATA_ITEMS_PER_XACT, randP);
+  }
 
   if (random_num_data_items > CHRONOS_MAX_DATA_ITEMS_PER_XACT) {
     random_num_data_items = CHRONOS_MAX_DATA_ITEMS_PER_XACT;
   }
 
-  reqPacketP = malloc(sizeof(chronosRequestPacket_t));
+  reqPacketP = chronosRequestPacketAlloc();
   if (reqPacketP == NULL) {
     chronos_error("Could not allocate request structure");
     goto failXit;
   }
 
-  memset(reqPacketP, 0, sizeof(*reqPacketP));
   CHRONOS_REQUEST_MAGIC_SET(reqPacketP);
+  reqPacketP->createdNs = chronosRequestTimeNowNs();
   reqPacketP->txn_type = txnType;
   reqPacketP->numItems = random_num_data_items;
 
+  /* Draw the random choices for the whole transaction in 
+   * one go, from the client's key distributions if any. 
+   * User draws are already bounded. Symbol draws from a
+   * distribution are symbol ids of the chronos cache; 
+   * without one they are raw and get bounded by the size
+   * of the chosen portfolio.
+   */
+  numSymbols = chronosCacheNumSymbolsGet(chronosCacheH);
+  symbolDistH = chronosClientCacheSymbolDistGet(clientCacheH);
+
+  if (symbolDistH != NULL) {
+    chronosKeyDistFill(symbolDrawArr, random_num_data_items, numSymbols, symbolDistH, randP);
+  }
+
+  if (txnType != CHRONOS_SYS_TXN_UPDATE_STOCK) {
+    numPortfolios = chronosClientCacheNumPortfoliosGet(clientCacheH);
+    userDistH = chronosClientCacheUserDistGet(clientCacheH);
+
+    if (userDistH != NULL) {
+      chronosKeyDistFill(userDrawArr, random_num_data_items, numPortfolios, userDistH, randP);
+    }
+    else {
+      chronosRandomFill(userDrawArr, random_num_data_items, numPortfolios, randP);
+    }
+
+    if (symbolDistH == NULL) {
+      chronosRandomFill(symbolDrawArr, random_num_data_items, 0, randP);
+    }
+  }
+
   switch (txnType) {
     case CHRONOS_USER_TXN_VIEW_STOCK:
-      random_user_idx = rand() % chronosClientCacheNumPortfoliosGet(clientCacheH);
+      random_user_idx = userDrawArr[0];
       for (i=0; i<random_num_data_items; i++) {
         // Choose a random symbol for this user
-        random_symbol_idx = rand() % chronosClientCacheNumSymbolFromUserGet(random_user_idx, clientCacheH);
-
-        // Now get the symbol
-        random_symbol = chronosClientCacheSymbolIdFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
-        symbol = chronosClientCacheSymbolFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
-        //symbol = chronosClientCacheSymbolFromUserGet(random_user_idx, random_symbol, clientCacheH);
+        symbol = chronosRequestSymbolPick(symbolDrawArr[i], symbolDistH != NULL, random_user_idx,
+                                          &random_symbol, clientCacheH, chronosCacheH);
         rc = chronosPackViewStock(random_symbol, 
                                    symbol,
                                    &(reqPacketP->request_data.symbolInfo[i]));
@@ -495,7 +745,7 @@ chronosRequestCreate(unsigned int             num_data_items,
 
     case CHRONOS_USER_TXN_VIEW_PORTFOLIO:
       for (i=0; i<random_num_data_items; i++) {
-        random_user_idx = rand() % chronosClientCacheNumPortfoliosGet(clientCacheH);
+        random_user_idx = userDrawArr[i];
         user = chronosClientCacheUserGet(random_user_idx, clientCacheH);
         rc = chronosPackViewPortfolio(user,
                                      &(reqPacketP->request_data.portfolioInfo[i]));
@@ -509,21 +759,17 @@ chronosRequestCreate(unsigned int             num_data_items,
     case CHRONOS_USER_TXN_PURCHASE:
       for (i=0; i<random_num_data_items; i++) {
         // Choose a random user
-        random_user_idx = rand() % chronosClientCacheNumPortfoliosGet(clientCacheH);
+        random_user_idx = userDrawArr[i];
 
         // Get user details
         user = chronosClientCacheUserGet(random_user_idx, clientCacheH);
 
         // Choose a random symbol for this user
-        random_symbol_idx = rand() % chronosClientCacheNumSymbolFromUserGet(random_user_idx, clientCacheH);
-
-        // Now get the symbol
-        random_symbol = chronosClientCacheSymbolIdFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
-        symbol = chronosClientCacheSymbolFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
+        symbol = chronosRequestSymbolPick(symbolDrawArr[i], symbolDistH != NULL, random_user_idx,
+                                          &random_symbol, clientCacheH, chronosCacheH);
 
         random_amount = 10;
         // Allow a high price
-        //random_price = chronosClientCacheSymbolPriceFromUserGet(random_user_idx, random_symbol_idx, clientCacheH) + 10;
         random_price = 2000;
 
         rc = chronosPackPurchase(user,
@@ -540,21 +786,17 @@ chronosRequestCreate(unsigned int             num_data_items,
     case CHRONOS_USER_TXN_SALE:
       for (i=0; i<random_num_data_items; i++) {
         // Choose a random user
-        random_user_idx = rand() % chronosClientCacheNumPortfoliosGet(clientCacheH);
+        random_user_idx = userDrawArr[i];
 
         // Get user details
         user = chronosClientCacheUserGet(random_user_idx, clientCacheH);
 
         // Choose a random symbol for this user
-        random_symbol_idx = rand() % chronosClientCacheNumSymbolFromUserGet(random_user_idx, clientCacheH);
-
-        // Now get the symbol
-        random_symbol = chronosClientCacheSymbolIdFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
-        symbol = chronosClientCacheSymbolFromUserGet(random_user_idx, random_symbol_idx, clientCacheH);
+        symbol = chronosRequestSymbolPick(symbolDrawArr[i], symbolDistH != NULL, random_user_idx,
+                                          &random_symbol, clientCacheH, chronosCacheH);
 
         random_amount = 5;
         // Allow a low price
-        //random_price = chronosClientCacheSymbolPriceFromUserGet(random_user_idx, random_symbol_idx, clientCacheH) - 10;
         random_price = 0;
 
         rc = chronosPackSellStock(user,
@@ -583,10 +825,17 @@ chronosRequestCreate(unsigned int             num_data_items,
 
         /*
          * Get the symbol name at index i from the chronos 
-         * cache.
+         * cache, or the drawn one if there is a symbol
+         * distribution.
          */
-        symbol_idx = chronosCacheSymbolIdxGet(i, chronosCacheH);
-        symbol = chronosCacheSymbolGet(i, chronosCacheH);
+        if (symbolDistH != NULL) {
+          symbol_idx = symbolDrawArr[i];
+          symbol = chronosCacheSymbolGet(symbol_idx, chronosCacheH);
+        }
+        else {
+          symbol_idx = chronosCacheSymbolIdxGet(i, chronosCacheH);
+          symbol = chronosCacheSymbolGet(i, chronosCacheH);
+        }
         assert(symbol != NULL);
         random_price = 1000;
 
@@ -598,6 +847,8 @@ chronosRequestCreate(unsigned int             num_data_items,
           chronos_error("Could not pack update request");
           goto failXit;
         }
+
+        chronosRequestLatestSet(symbol_idx, numSymbols, symbolDistH);
       }
       break;
 
@@ -609,14 +860,23 @@ chronosRequestCreate(unsigned int             num_data_items,
 
 failXit:
   if (reqPacketP != NULL) {
-    free(reqPacketP);
+    chronosRequestPacketRelease(reqPacketP);
     reqPacketP = NULL;
   }
 
 cleanup:
+  if (reqPacketP != NULL) {
+    chronosLatencyRecord(reqPacketP->txn_type, 
+                         CHRONOS_LATENCY_PACK, 
+                         chronosLatencyNowNs() - startNs);
+  }
   return (void *) reqPacketP;
 }
 
+/*--------------------------------------------------------
+ * Drop a reference to the request. The packet goes back
+ * to the pool once nobody holds it any more.
+ *------------------------------------------------------*/
 int
 chronosRequestFree(CHRONOS_REQUEST_H requestH)
 {
@@ -628,8 +888,13 @@ chronosRequestFree(CHRONOS_REQUEST_H requestH)
   }
 
   requestP = (chronosRequestPacket_t *) requestH;
-  memset(requestP, 0, sizeof(*requestP));
-  free(requestP);
+
+  if (requestP->refCount > 0) {
+    requestP->refCount --;
+    return CHRONOS_SUCCESS;
+  }
+
+  chronosRequestPacketRelease(requestP);
 
   return CHRONOS_SUCCESS;
 
@@ -637,6 +902,28 @@ failXit:
   return CHRONOS_FAIL; 
 }
 
+/*--------------------------------------------------------
+ * Keep the request alive until a matching
+ * chronosRequestFree(), e.g. while the kernel still reads
+ * its frame for a zero-copy send. The request must not be
+ * changed meanwhile.
+ *------------------------------------------------------*/
+int
+chronosRequestRetain(CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  requestP->refCount ++;
+
+  return CHRONOS_SUCCESS;
+}
+
 chronosUserTransaction_t
 chronosRequestTypeGet(CHRONOS_REQUEST_H requestH)
 {
@@ -654,9 +941,189 @@ failXit:
   return CHRONOS_USER_TXN_INVAL;
 }
 
+unsigned int
+chronosRequestIdGet(CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  return requestP->requestId;
+
+failXit:
+  return 0;
+}
+
+int
+chronosRequestIdSet(unsigned int      requestId,
+                    CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  requestP->requestId = requestId;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*---------------------------------------------------------
+ * Wall-clock time in nanoseconds since the epoch. This is
+ * the clock request timestamps and deadlines are based on,
+ * so that they mean the same thing to client and server.
+ *-------------------------------------------------------*/
+uint64_t
+chronosRequestTimeNowNs(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t
+chronosRequestCreatedGet(CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  return requestP->createdNs;
+
+failXit:
+  return 0;
+}
+
+uint64_t
+chronosRequestDeadlineGet(CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  return requestP->deadlineNs;
+
+failXit:
+  return 0;
+}
+
+/*---------------------------------------------------------
+ * Set the absolute deadline of a request, in the clock of
+ * chronosRequestTimeNowNs(). Zero means no deadline.
+ *-------------------------------------------------------*/
+int
+chronosRequestDeadlineSet(uint64_t          deadlineNs,
+                          CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  requestP->deadlineNs = deadlineNs;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+int
+chronosRequestPriorityGet(CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  return requestP->priority;
+
+failXit:
+  return 0;
+}
+
+int
+chronosRequestPrioritySet(int               priority,
+                          CHRONOS_REQUEST_H requestH)
+{
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  requestP->priority = priority;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*---------------------------------------------------------
+ * Size of a single entry of request_data for the given
+ * transaction type. Returns 0 for an unknown type.
+ *-------------------------------------------------------*/
+size_t
+chronosRequestItemSizeGet(chronosUserTransaction_t txnType)
+{
+  switch (txnType) {
+    case CHRONOS_USER_TXN_VIEW_STOCK:
+      return sizeof(chronosSymbol_t);
+
+    case CHRONOS_USER_TXN_VIEW_PORTFOLIO:
+      return sizeof(chronosViewPortfolioInfo_t);
+
+    case CHRONOS_USER_TXN_PURCHASE:
+      return sizeof(chronosPurchaseInfo_t);
+
+    case CHRONOS_USER_TXN_SALE:
+      return sizeof(chronosSellInfo_t);
+
+    case CHRONOS_SYS_TXN_UPDATE_STOCK:
+      return sizeof(chronosUpdateStockInfo_t);
+
+    default:
+      return 0;
+  }
+}
+
+/*---------------------------------------------------------
+ * Returns the size of the encoded frame for this request:
+ * the fixed header plus numItems type-specific entries.
+ *-------------------------------------------------------*/
 size_t
 chronosRequestSizeGet(CHRONOS_REQUEST_H requestH)
 {
+  size_t itemSize;
   chronosRequestPacket_t *requestP = NULL;
 
   if (requestH == NULL) {
@@ -665,12 +1132,152 @@ chronosRequestSizeGet(CHRONOS_REQUEST_H requestH)
   }
 
   requestP = (chronosRequestPacket_t *) requestH;
-  return sizeof(*requestP);
+
+  if (requestP->numItems < 0 || requestP->numItems > CHRONOS_REQUEST_PACKET_SIZE) {
+    chronos_error("Invalid number of items: %d", requestP->numItems);
+    goto failXit;
+  }
+
+  itemSize = chronosRequestItemSizeGet(requestP->txn_type);
+  if (itemSize == 0) {
+    chronos_error("Invalid transaction type: %d", requestP->txn_type);
+    goto failXit;
+  }
+
+  return CHRONOS_REQUEST_HEADER_SIZE + requestP->numItems * itemSize;
 
 failXit:
   return -1;
 }
 
+/*---------------------------------------------------------
+ * Stamp the length prefix of a request and return the
+ * bytes that make up its wire frame. The frame is the
+ * leading part of the packet itself, so nothing is copied.
+ *-------------------------------------------------------*/
+int
+chronosRequestEncode(CHRONOS_REQUEST_H requestH,
+                     const char      **frameP,
+                     size_t           *frameSizeP)
+{
+  size_t frameSize;
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (requestH == NULL || frameP == NULL || frameSizeP == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  CHRONOS_REQUEST_MAGIC_CHECK(requestP);
+
+  frameSize = chronosRequestSizeGet(requestH);
+  if (frameSize == (size_t) -1) {
+    chronos_error("Could not compute frame size");
+    goto failXit;
+  }
+
+  requestP->length = frameSize;
+
+  *frameP = (const char *) requestP;
+  *frameSizeP = frameSize;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
+/*---------------------------------------------------------
+ * Peek at the length prefix of the frame at the start of
+ * buf. Returns 0 if not even the prefix is available yet.
+ *-------------------------------------------------------*/
+size_t
+chronosRequestFrameSizeGet(const char *buf,
+                           size_t      bufSize)
+{
+  int length;
+
+  if (buf == NULL || bufSize < sizeof(length)) {
+    return 0;
+  }
+
+  memcpy(&length, buf, sizeof(length));
+  if (length < 0) {
+    return 0;
+  }
+
+  return length;
+}
+
+/*---------------------------------------------------------
+ * Decode one frame from buf into the provided request.
+ * Only the header and the numItems entries carried by the
+ * frame are written. On success *consumedP holds the
+ * number of bytes taken from buf.
+ *-------------------------------------------------------*/
+int
+chronosRequestDecode(const char        *buf,
+                     size_t             bufSize,
+                     CHRONOS_REQUEST_H  requestH,
+                     size_t            *consumedP)
+{
+  size_t itemSize;
+  size_t frameSize;
+  chronosRequestPacket_t *requestP = NULL;
+
+  if (buf == NULL || requestH == NULL || consumedP == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  if (bufSize < CHRONOS_REQUEST_HEADER_SIZE) {
+    chronos_error("Incomplete frame header: %zu bytes", bufSize);
+    goto failXit;
+  }
+
+  requestP = (chronosRequestPacket_t *) requestH;
+  memcpy(requestP, buf, CHRONOS_REQUEST_HEADER_SIZE);
+
+  if (requestP->magic != CHRONOS_REQUEST_MAGIC) {
+    chronos_error("Bad request magic: 0x%x", requestP->magic);
+    goto failXit;
+  }
+
+  if (requestP->numItems < 0 || requestP->numItems > CHRONOS_REQUEST_PACKET_SIZE) {
+    chronos_error("Invalid number of items: %d", requestP->numItems);
+    goto failXit;
+  }
+
+  itemSize = chronosRequestItemSizeGet(requestP->txn_type);
+  if (itemSize == 0) {
+    chronos_error("Invalid transaction type: %d", requestP->txn_type);
+    goto failXit;
+  }
+
+  frameSize = CHRONOS_REQUEST_HEADER_SIZE + requestP->numItems * itemSize;
+  if ((size_t) requestP->length != frameSize) {
+    chronos_error("Frame length mismatch: %d vs %zu", requestP->length, frameSize);
+    goto failXit;
+  }
+
+  if (bufSize < frameSize) {
+    chronos_error("Incomplete frame: %zu of %zu bytes", bufSize, frameSize);
+    goto failXit;
+  }
+
+  memcpy(&(requestP->request_data),
+         buf + CHRONOS_REQUEST_HEADER_SIZE,
+         frameSize - CHRONOS_REQUEST_HEADER_SIZE);
+
+  *consumedP = frameSize;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  return CHRONOS_FAIL;
+}
+
 CHRONOS_RESPONSE_H
 chronosResponseAlloc()
 {
@@ -766,3 +1373,20 @@ failXit:
   return -1;
 }
 
+unsigned int
+chronosResponseRequestIdGet(CHRONOS_RESPONSE_H responseH)
+{
+  chronosResponsePacket_t *responseP = NULL;
+
+  if (responseH == NULL) {
+    chronos_error("Invalid handle");
+    goto failXit;
+  }
+
+  responseP = (chronosResponsePacket_t *) responseH;
+  return responseP->requestId;
+
+failXit:
+  return 0;
+}
+
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "chronos.h"
+#include "include/chronos_pool.h"
+#include "include/chronos_eventloop.h"
+#include "include/chronos_histogram.h"
+#include "include/chronos_random.h"
+
+#define CHRONOS_POOL_MAGIC   (0x9001)
+#define CHRONOS_POOL_MAGIC_CHECK(poolP)    assert((poolP)->magic == CHRONOS_POOL_MAGIC)
+#define CHRONOS_POOL_MAGIC_SET(poolP)      (poolP)->magic = CHRONOS_POOL_MAGIC
+
+typedef struct chronosPoolConn_t {
+  CHRONOS_CONN_H  connH;
+
+  /* Connecting or connected, and serviced by the loop */
+  int             isInLoop;
+
+  /* Seen connected since it was last (re)started */
+  int             isUp;
+
+  /* When not in the loop: when to try again, and how
+   * long to wait if that attempt fails too */
+  uint64_t        retryAtNs;
+  uint64_t        backoffNs;
+
+  /* Last submit that found it backlogged */
+  uint64_t        againSeq;
+} chronosPoolConn_t;
+
+typedef struct chronosPool_t {
+  int                   magic;
+  char                  serverAddress[256];
+  int                   serverPort;
+
+  CHRONOS_EVENT_LOOP_H  loopH;
+  chronosRandom_t       rand;
+  chronosPoolStats_t    stats;
+
+  /* Numbers the calls to chronosPoolSubmit() */
+  uint64_t              submitSeq;
+
+  int                   numConns;
+  chronosPoolConn_t    *connArr;
+} chronosPool_t;
+
+/*
+ * Takes a failed connection out of service and schedules
+ * its next connect attempt. The delay is the current
+ * backoff give or take 25%.
+ */
+static void
+chronosPoolConnFailed(chronosPoolConn_t *connP,
+                      chronosPool_t     *poolP)
+{
+  uint64_t delayNs;
+
+  connP->isInLoop = 0;
+  connP->isUp = 0;
+
+  delayNs = connP->backoffNs * 3 / 4
+            + (uint64_t) (chronosRandomDouble(&poolP->rand) * connP->backoffNs / 2);
+  connP->retryAtNs = chronosLatencyNowNs() + delayNs;
+
+  connP->backoffNs *= 2;
+  if (connP->backoffNs > CHRONOS_POOL_BACKOFF_MAX_NS) {
+    connP->backoffNs = CHRONOS_POOL_BACKOFF_MAX_NS;
+  }
+
+  poolP->stats.numConnFailures ++;
+}
+
+/*
+ * Called by the event loop once it has dropped a failed
+ * connection.
+ */
+static void
+chronosPoolLoopError(CHRONOS_CONN_H  connH,
+                     void           *arg)
+{
+  int i;
+  chronosPool_t *poolP = (chronosPool_t *) arg;
+
+  for (i=0; i<poolP->numConns; i++) {
+    if (poolP->connArr[i].connH == connH) {
+      chronos_warning("Connection %d to %.64s:%d failed",
+                      i, poolP->serverAddress, poolP->serverPort);
+      chronosPoolConnFailed(&(poolP->connArr[i]), poolP);
+      return;
+    }
+  }
+}
+
+/*
+ * Starts connecting without waiting, the loop finishes
+ * the job.
+ */
+static int
+chronosPoolConnStart(chronosPoolConn_t *connP,
+                     chronosPool_t     *poolP)
+{
+  int rc;
+
+  rc = chronosClientConnectStart(poolP->serverAddress,
+                                 poolP->serverPort,
+                                 NULL,
+                                 connP->connH);
+  if (rc != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  rc = chronosEventLoopAdd(connP->connH, poolP->loopH);
+  if (rc != CHRONOS_SUCCESS) {
+    chronosClientDisconnect(connP->connH);
+    goto failXit;
+  }
+
+  connP->isInLoop = 1;
+  connP->isUp = 0;
+
+  return CHRONOS_SUCCESS;
+
+failXit:
+  chronosPoolConnFailed(connP, poolP);
+  return CHRONOS_FAIL;
+}
+
+/*
+ * Retries the connections whose backoff expired and resets
+ * the backoff of the ones that made it. Returns how long
+ * until the next retry is due, in ms, or -1 if none is.
+ */
+static int
+chronosPoolMaintain(chronosPool_t *poolP)
+{
+  int i;
+  int waitMs = -1;
+  int connWaitMs;
+  uint64_t nowNs;
+  chronosPoolConn_t *connP = NULL;
+
+  nowNs = chronosLatencyNowNs();
+
+  for (i=0; i<poolP->numConns; i++) {
+    connP = &(poolP->connArr[i]);
+
+    if (connP->isInLoop) {
+      if (!connP->isUp && chronosClientIsConnected(connP->connH)) {
+        connP->isUp = 1;
+        connP->backoffNs = CHRONOS_POOL_BACKOFF_MIN_NS;
+      }
+      continue;
+    }
+
+    if (connP->retryAtNs <= nowNs) {
+      poolP->stats.numReconnects ++;
+      if (chronosPoolConnStart(connP, poolP) == CHRONOS_SUCCESS) {
+        continue;
+      }
+    }
+
+    /* Round up so that the retry is due when we wake up */
+    connWaitMs = (int) ((connP->retryAtNs - nowNs + 999999) / 1000000);
+    if (waitMs < 0 || connWaitMs < waitMs) {
+      waitMs = connWaitMs;
+    }
+  }
+
+  return waitMs;
+}
+
+/*--------------------------------------------------
+ * Allocate a pool of numConns connections to the
+ * server. Connections are established in the
+ * background, a server that is not up yet is not an
+ * error. Shared-memory addresses are refused: those
+ * connections cannot be driven by an event loop.
+ *------------------------------------------------*/
+CHRONOS_POOL_H
+chronosPoolAlloc(int            numConns,
+                 const char    *serverAddress,
+                 int            serverPort,
+                 CHRONOS_ENV_H  envH)
+{
+  int i;
+  chronosPool_t *poolP = NULL;
+
+  if (numConns <= 0 || serverAddress == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  if (strncmp(serverAddress, CHRONOS_CLIENT_SHM_PREFIX, strlen(CHRONOS_CLIENT_SHM_PREFIX)) == 0) {
+    chronos_error("Shared-memory connections cannot be pooled: %s", serverAddress);
+    goto failXit;
+  }
+
+  poolP = malloc(sizeof(chronosPool_t));
+  if (poolP == NULL) {
+    chronos_error("Could not allocate pool");
+    goto failXit;
+  }
+
+  memset(poolP, 0, sizeof(*poolP));
+  CHRONOS_POOL_MAGIC_SET(poolP);
+
+  strncpy(poolP->serverAddress, serverAddress, sizeof(poolP->serverAddress) - 1);
+  poolP->serverPort = serverPort;
+  chronosRandomSeed(chronosLatencyNowNs(), &poolP->rand);
+
+  poolP->loopH = chronosEventLoopAlloc(chronosPoolLoopError, poolP);
+  if (poolP->loopH == NULL) {
+    goto failXit;
+  }
+
+  poolP->connArr = calloc(numConns, sizeof(chronosPoolConn_t));
+  if (poolP->connArr == NULL) {
+    chronos_error("Could not allocate pool connections");
+    goto failXit;
+  }
+
+  for (i=0; i<numConns; i++) {
+    poolP->connArr[i].connH = chronosConnHandleAlloc(envH);
+    if (poolP->connArr[i].connH == NULL) {
+      goto failXit;
+    }
+    poolP->connArr[i].backoffNs = CHRONOS_POOL_BACKOFF_MIN_NS;
+    poolP->numConns ++;
+
+    chronosPoolConnStart(&(poolP->connArr[i]), poolP);
+  }
+
+  return poolP;
+
+failXit:
+  if (poolP != NULL) {
+    chronosPoolFree(poolP);
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------
+ * Completions not polled yet are lost.
+ *------------------------------------------------*/
+int
+chronosPoolFree(CHRONOS_POOL_H poolH)
+{
+  int i;
+  chronosPool_t *poolP = NULL;
+
+  if (poolH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  for (i=0; i<poolP->numConns; i++) {
+    if (poolP->connArr[i].isInLoop) {
+      chronosClientDisconnect(poolP->connArr[i].connH);
+      chronosEventLoopRemove(poolP->connArr[i].connH, poolP->loopH);
+    }
+    chronosConnHandleFree(poolP->connArr[i].connH);
+  }
+
+  if (poolP->connArr != NULL) {
+    free(poolP->connArr);
+  }
+
+  if (poolP->loopH != NULL) {
+    chronosEventLoopFree(poolP->loopH);
+  }
+
+  memset(poolP, 0, sizeof(*poolP));
+  free(poolP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Send a request on the connected connection with
+ * the fewest requests in flight, skipping those whose
+ * window or send backlog is full. If sending fails
+ * that connection is dropped, and if it is backlogged
+ * it is passed over; either way the next best one is
+ * tried. Returns CHRONOS_TIMEOUT when no connection
+ * can take the request right now: poll completions
+ * and try again. The request can be freed on return.
+ *------------------------------------------------*/
+int
+chronosPoolSubmit(CHRONOS_REQUEST_H requestH,
+                  uint64_t          userTag,
+                  CHRONOS_POOL_H    poolH)
+{
+  int i;
+  int rc;
+  int numInFlight;
+  int bestNumInFlight;
+  chronosPoolConn_t *connP = NULL;
+  chronosPoolConn_t *bestP = NULL;
+  chronosPool_t     *poolP = NULL;
+
+  if (poolH == NULL || requestH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  chronosPoolMaintain(poolP);
+
+  poolP->submitSeq ++;
+
+  while (1) {
+    bestP = NULL;
+    bestNumInFlight = CHRONOS_CLIENT_MAX_INFLIGHT;
+
+    for (i=0; i<poolP->numConns; i++) {
+      connP = &(poolP->connArr[i]);
+      if (!connP->isInLoop 
+          || !chronosClientIsConnected(connP->connH)
+          || connP->againSeq == poolP->submitSeq) {
+        continue;
+      }
+
+      /* Its window is full: not a failure, it just has to
+       * wait for responses */
+      if (chronosClientWindowFreeGet(connP->connH) <= 0) {
+        continue;
+      }
+
+      /* Backpressured: its socket is not keeping up */
+      if (chronosClientSendPendingGet(connP->connH) >= chronosClientSendLimitGet(connP->connH)) {
+        continue;
+      }
+
+      numInFlight = chronosClientNumInFlightGet(connP->connH);
+      if (numInFlight < bestNumInFlight) {
+        bestNumInFlight = numInFlight;
+        bestP = connP;
+      }
+    }
+
+    if (bestP == NULL) {
+      return CHRONOS_TIMEOUT;
+    }
+
+    rc = chronosClientSubmit(requestH, bestP->connH, userTag);
+    if (rc == CHRONOS_SUCCESS) {
+      poolP->stats.numSubmitted ++;
+      return CHRONOS_SUCCESS;
+    }
+    else if (rc == CHRONOS_AGAIN) {
+      bestP->againSeq = poolP->submitSeq;
+      continue;
+    }
+
+    chronos_warning("Dropping connection %d to %.64s:%d",
+                    (int) (bestP - poolP->connArr),
+                    poolP->serverAddress,
+                    poolP->serverPort);
+    chronosClientDisconnect(bestP->connH);
+    chronosEventLoopRemove(bestP->connH, poolP->loopH);
+    chronosPoolConnFailed(bestP, poolP);
+  }
+}
+
+/*--------------------------------------------------
+ * Collect completions from all the pool's connections,
+ * servicing them for up to timeoutMs if none is
+ * queued (0 does not block). Requests lost with a
+ * connection complete with CHRONOS_FAIL.
+ *------------------------------------------------*/
+int
+chronosPoolPollCompletions(chronosCompletion_t *completionArr,
+                           int                  maxCompletions,
+                           int                 *numCompletionsP,
+                           int                  timeoutMs,
+                           CHRONOS_POOL_H       poolH)
+{
+  int retryMs;
+  chronosPool_t *poolP = NULL;
+
+  if (poolH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  /* Do not sleep past the next reconnect attempt */
+  retryMs = chronosPoolMaintain(poolP);
+  if (retryMs >= 0 && (timeoutMs < 0 || retryMs < timeoutMs)) {
+    timeoutMs = retryMs;
+  }
+
+  return chronosEventLoopPollCompletions(completionArr,
+                                         maxCompletions,
+                                         numCompletionsP,
+                                         timeoutMs,
+                                         poolP->loopH);
+}
+
+int
+chronosPoolInterrupt(CHRONOS_POOL_H poolH)
+{
+  chronosPool_t *poolP = NULL;
+
+  if (poolH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  return chronosEventLoopInterrupt(poolP->loopH);
+}
+
+int
+chronosPoolNumConnectedGet(CHRONOS_POOL_H poolH)
+{
+  int i;
+  int numConnected = 0;
+  chronosPool_t *poolP = NULL;
+
+  if (poolH == NULL) {
+    chronos_error("Invalid handle");
+    return -1;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  for (i=0; i<poolP->numConns; i++) {
+    if (poolP->connArr[i].isInLoop && chronosClientIsConnected(poolP->connArr[i].connH)) {
+      numConnected ++;
+    }
+  }
+
+  return numConnected;
+}
+
+int
+chronosPoolStatsGet(chronosPoolStats_t *statsP,
+                    CHRONOS_POOL_H      poolH)
+{
+  chronosPool_t *poolP = NULL;
+
+  if (poolH == NULL || statsP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  poolP = (chronosPool_t *) poolH;
+  CHRONOS_POOL_MAGIC_CHECK(poolP);
+
+  *statsP = poolP->stats;
+
+  return CHRONOS_SUCCESS;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include "chronos.h"
+#include "include/chronos_random.h"
+
+static inline uint64_t
+rotl(const uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+/*--------------------------------------------------------
+ * Expand a 64-bit seed into the generator state using
+ * splitmix64, as recommended by the xoshiro authors. Any
+ * seed, including 0, gives a valid state.
+ *------------------------------------------------------*/
+void
+chronosRandomSeed(uint64_t         seed,
+                  chronosRandom_t *randP)
+{
+  int i;
+  uint64_t z;
+
+  for (i=0; i<4; i++) {
+    seed += 0x9E3779B97F4A7C15ULL;
+    z = seed;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    randP->s[i] = z ^ (z >> 31);
+  }
+}
+
+uint64_t
+chronosRandomNext(chronosRandom_t *randP)
+{
+  uint64_t *s = randP->s;
+  const uint64_t result = rotl(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+/*--------------------------------------------------------
+ * Uniform value in [0, bound). Uses a multiply-shift
+ * instead of a modulo, so there is no division on the
+ * hot path.
+ *------------------------------------------------------*/
+unsigned int
+chronosRandomRange(unsigned int     bound,
+                   chronosRandom_t *randP)
+{
+  return CHRONOS_RANDOM_BOUND(chronosRandomNext(randP) >> 32, bound);
+}
+
+/*--------------------------------------------------------
+ * Uniform value in [0, 1)
+ *------------------------------------------------------*/
+double
+chronosRandomDouble(chronosRandom_t *randP)
+{
+  return (chronosRandomNext(randP) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*--------------------------------------------------------
+ * Fill an array with uniform values in [0, bound), or with
+ * raw 32-bit values if bound is 0. Each 64-bit output of
+ * the generator yields two values.
+ *------------------------------------------------------*/
+void
+chronosRandomFill(unsigned int    *valuesArr,
+                  int              numValues,
+                  unsigned int     bound,
+                  chronosRandom_t *randP)
+{
+  int i;
+  uint64_t r;
+
+  for (i=0; i+1<numValues; i+=2) {
+    r = chronosRandomNext(randP);
+    if (bound == 0) {
+      valuesArr[i] = (unsigned int) (r >> 32);
+      valuesArr[i+1] = (unsigned int) r;
+    }
+    else {
+      valuesArr[i] = CHRONOS_RANDOM_BOUND(r >> 32, bound);
+      valuesArr[i+1] = CHRONOS_RANDOM_BOUND(r & 0xFFFFFFFFULL, bound);
+    }
+  }
+
+  if (i < numValues) {
+    r = chronosRandomNext(randP);
+    valuesArr[i] = (bound == 0) ? (unsigned int) (r >> 32) : CHRONOS_RANDOM_BOUND(r >> 32, bound);
+  }
+}
@@ -0,0 +1,858 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/poll.h>
+#include <sys/types.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include "chronos.h"
+#include "include/chronos_shm.h"
+#include "include/chronos_packets.h"
+
+#define CHRONOS_SHM_MAGIC   (0x5348)
+#define CHRONOS_SHM_MAGIC_CHECK(shmP)    assert((shmP)->magic == CHRONOS_SHM_MAGIC)
+#define CHRONOS_SHM_MAGIC_SET(shmP)      (shmP)->magic = CHRONOS_SHM_MAGIC
+
+/* Written in the segment once it is ready to be attached */
+#define CHRONOS_SHM_SEGMENT_MAGIC   (0xC405C405)
+
+#define CHRONOS_SHM_CACHE_LINE   (64)
+
+/* How many times a side checks for work before it goes to
+ * sleep on its futex. Only worth it with more than one CPU:
+ * on a single one, spinning just delays the peer */
+#define CHRONOS_SHM_SPIN_LOOPS   (2000)
+
+/* How long an attach waits for the server to release a
+ * segment whose client died without closing it */
+#define CHRONOS_SHM_RECLAIM_WAIT_MS   (1000)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHRONOS_SHM_CPU_RELAX()   __asm__ __volatile__("pause" ::: "memory")
+#else
+#define CHRONOS_SHM_CPU_RELAX()   __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define SHM_LOAD(_p)          __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define SHM_STORE(_p, _v)     __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+
+typedef enum {
+  CHRONOS_SHM_CLIENT = 0,
+  CHRONOS_SHM_SERVER
+} chronosShmSide_t;
+
+/* Requests go on the client's ring, responses on the
+ * server's; each side sleeps on its own doorbell */
+#define CHRONOS_SHM_TX_RING(_side)   (_side)
+#define CHRONOS_SHM_RX_RING(_side)   (1 - (_side))
+#define CHRONOS_SHM_CLOSED(_side)    (1 << (_side))
+
+typedef struct chronosShmRing_t {
+  /* Bytes ever written, advanced by the producer only */
+  uint64_t  tail __attribute__((aligned(CHRONOS_SHM_CACHE_LINE)));
+
+  /* Bytes ever read, advanced by the consumer only */
+  uint64_t  head __attribute__((aligned(CHRONOS_SHM_CACHE_LINE)));
+} chronosShmRing_t;
+
+typedef struct chronosShmDoorbell_t {
+  /* The futex word, bumped to wake up the owner */
+  uint32_t  seq __attribute__((aligned(CHRONOS_SHM_CACHE_LINE)));
+
+  /* Set by the owner while it sleeps (or is about to) */
+  uint32_t  isWaiting;
+} chronosShmDoorbell_t;
+
+/* The ring data follows, one ring after the other */
+typedef struct chronosShmSegment_t {
+  uint32_t              magic;
+  uint32_t              ringSize;
+  /* The attached client's process, 0 if there is none */
+  uint32_t              clientPid;
+  uint32_t              closedMask;
+
+  chronosShmRing_t      ringArr[2];
+  chronosShmDoorbell_t  doorbellArr[2];
+} chronosShmSegment_t;
+
+typedef struct chronosShm_t {
+  int                    magic;
+  chronosShmSide_t       side;
+  char                   name[256];
+  size_t                 mapSize;
+  uint64_t               mask;
+
+  chronosShmSegment_t   *segP;
+  chronosShmRing_t      *txRingP;
+  chronosShmRing_t      *rxRingP;
+  char                  *txDataP;
+  char                  *rxDataP;
+  chronosShmDoorbell_t  *ownBellP;
+  chronosShmDoorbell_t  *peerBellP;
+
+  /* Our doorbell when the last wait returned: if it moved
+   * since, the next wait returns right away */
+  uint32_t               lastSeq;
+  int                    spinLoops;
+} chronosShm_t;
+
+static size_t
+chronosShmMapSizeGet(size_t ringSize)
+{
+  return sizeof(chronosShmSegment_t) + 2 * ringSize;
+}
+
+static int
+chronosShmFutexWait(uint32_t              *addr,
+                    uint32_t               value,
+                    const struct timespec *timeoutP)
+{
+  return syscall(SYS_futex, addr, FUTEX_WAIT, value, timeoutP, NULL, 0);
+}
+
+static void
+chronosShmFutexWake(uint32_t *addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Bumps a doorbell and wakes up its owner.
+ */
+static void
+chronosShmRing(chronosShmDoorbell_t *bellP)
+{
+  __atomic_add_fetch(&bellP->seq, 1, __ATOMIC_RELEASE);
+  chronosShmFutexWake(&bellP->seq);
+}
+
+/*
+ * Wakes up the owner of a doorbell if it is sleeping. The
+ * fence pairs with the one in chronosShmWait(): either the
+ * waiter sees what we published before it sleeps, or we
+ * see it waiting.
+ */
+static void
+chronosShmNotify(chronosShmDoorbell_t *bellP)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&bellP->isWaiting, __ATOMIC_RELAXED)) {
+    chronosShmRing(bellP);
+  }
+}
+
+static void
+chronosShmSideSet(chronosShmSide_t  side,
+                  chronosShm_t     *shmP)
+{
+  char *dataP = (char *) (shmP->segP + 1);
+  size_t ringSize = shmP->segP->ringSize;
+
+  shmP->side = side;
+  shmP->mask = ringSize - 1;
+  shmP->txRingP = &(shmP->segP->ringArr[CHRONOS_SHM_TX_RING(side)]);
+  shmP->rxRingP = &(shmP->segP->ringArr[CHRONOS_SHM_RX_RING(side)]);
+  shmP->txDataP = dataP + CHRONOS_SHM_TX_RING(side) * ringSize;
+  shmP->rxDataP = dataP + CHRONOS_SHM_RX_RING(side) * ringSize;
+  shmP->ownBellP = &(shmP->segP->doorbellArr[side]);
+  shmP->peerBellP = &(shmP->segP->doorbellArr[1 - side]);
+  shmP->lastSeq = SHM_LOAD(&shmP->ownBellP->seq);
+  shmP->spinLoops = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? CHRONOS_SHM_SPIN_LOOPS : 0;
+}
+
+/* shm_open() wants names that start with a slash */
+static void
+chronosShmNameSet(const char   *name,
+                  chronosShm_t *shmP)
+{
+  snprintf(shmP->name, sizeof(shmP->name), "%s%s",
+           (name[0] == '/') ? "" : "/",
+           name);
+}
+
+/*--------------------------------------------------
+ * Create the segment, server side. An old segment of
+ * the same name is replaced.
+ *------------------------------------------------*/
+CHRONOS_SHM_H
+chronosShmCreate(const char *name,
+                 size_t      ringSize)
+{
+  int fd = -1;
+  chronosShm_t *shmP = NULL;
+  void *mapP = MAP_FAILED;
+
+  if (name == NULL || ringSize == 0 || (ringSize & (ringSize - 1)) != 0 || ringSize > UINT32_MAX / 2) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  shmP = malloc(sizeof(chronosShm_t));
+  if (shmP == NULL) {
+    chronos_error("Could not allocate shared memory handle");
+    goto failXit;
+  }
+
+  memset(shmP, 0, sizeof(*shmP));
+  chronosShmNameSet(name, shmP);
+  shmP->mapSize = chronosShmMapSizeGet(ringSize);
+
+  shm_unlink(shmP->name);
+
+  fd = shm_open(shmP->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    perror("shm_open() failed");
+    goto failXit;
+  }
+
+  if (ftruncate(fd, shmP->mapSize) < 0) {
+    perror("ftruncate() failed");
+    goto failXit;
+  }
+
+  mapP = mmap(NULL, shmP->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapP == MAP_FAILED) {
+    perror("mmap() failed");
+    goto failXit;
+  }
+
+  close(fd);
+  fd = -1;
+
+  /* The segment comes zeroed: both rings are empty */
+  shmP->segP = (chronosShmSegment_t *) mapP;
+  shmP->segP->ringSize = ringSize;
+  SHM_STORE(&shmP->segP->magic, CHRONOS_SHM_SEGMENT_MAGIC);
+
+  chronosShmSideSet(CHRONOS_SHM_SERVER, shmP);
+  CHRONOS_SHM_MAGIC_SET(shmP);
+
+  return shmP;
+
+failXit:
+  if (fd >= 0) {
+    close(fd);
+    shm_unlink(shmP->name);
+  }
+  if (shmP != NULL) {
+    free(shmP);
+  }
+  return NULL;
+}
+
+/*
+ * Takes the segment for this process. A client that died
+ * without closing it leaves its pid behind: it is closed
+ * on its behalf, so that the server releases the segment
+ * as it does when a client goes away, and we wait for it.
+ */
+static int
+chronosShmClientClaim(chronosShm_t *shmP)
+{
+  int i;
+  uint32_t ownPid = (uint32_t) getpid();
+  uint32_t expected = 0;
+  chronosShmSegment_t *segP = shmP->segP;
+
+  for (i=0; i<CHRONOS_SHM_RECLAIM_WAIT_MS; i++) {
+    expected = 0;
+    if (__atomic_compare_exchange_n(&segP->clientPid, &expected, ownPid,
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return CHRONOS_SUCCESS;
+    }
+
+    if (kill((pid_t) expected, 0) == 0 || errno != ESRCH) {
+      break;
+    }
+
+    if (i == 0) {
+      chronos_warning("Reclaiming shared memory segment %.64s from dead process %u",
+                      shmP->name, expected);
+      __atomic_or_fetch(&segP->closedMask, CHRONOS_SHM_CLOSED(CHRONOS_SHM_CLIENT), __ATOMIC_SEQ_CST);
+      chronosShmRing(&segP->doorbellArr[CHRONOS_SHM_SERVER]);
+    }
+
+    usleep(1000);
+  }
+
+  return CHRONOS_FAIL;
+}
+
+/*--------------------------------------------------
+ * Attach to a segment created by a server, client
+ * side. Fails if another live client is attached.
+ *------------------------------------------------*/
+CHRONOS_SHM_H
+chronosShmAttach(const char *name)
+{
+  int fd = -1;
+  struct stat st;
+  chronosShm_t *shmP = NULL;
+  void *mapP = MAP_FAILED;
+
+  if (name == NULL) {
+    chronos_error("Invalid argument");
+    goto failXit;
+  }
+
+  shmP = malloc(sizeof(chronosShm_t));
+  if (shmP == NULL) {
+    chronos_error("Could not allocate shared memory handle");
+    goto failXit;
+  }
+
+  memset(shmP, 0, sizeof(*shmP));
+  chronosShmNameSet(name, shmP);
+
+  fd = shm_open(shmP->name, O_RDWR, 0);
+  if (fd < 0) {
+    chronos_error("Could not open shared memory segment %.64s: %s", shmP->name, strerror(errno));
+    goto failXit;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    perror("fstat() failed");
+    goto failXit;
+  }
+
+  if ((size_t) st.st_size < sizeof(chronosShmSegment_t)) {
+    chronos_error("Shared memory segment %.64s is not ready", shmP->name);
+    goto failXit;
+  }
+
+  shmP->mapSize = st.st_size;
+  mapP = mmap(NULL, shmP->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapP == MAP_FAILED) {
+    perror("mmap() failed");
+    goto failXit;
+  }
+
+  close(fd);
+  fd = -1;
+
+  shmP->segP = (chronosShmSegment_t *) mapP;
+
+  if (SHM_LOAD(&shmP->segP->magic) != CHRONOS_SHM_SEGMENT_MAGIC
+      || chronosShmMapSizeGet(shmP->segP->ringSize) != shmP->mapSize) {
+    chronos_error("Shared memory segment %.64s is not ready", shmP->name);
+    goto failXit;
+  }
+
+  if (SHM_LOAD(&shmP->segP->closedMask) & CHRONOS_SHM_CLOSED(CHRONOS_SHM_SERVER)) {
+    chronos_error("Shared memory segment %.64s is closed", shmP->name);
+    goto failXit;
+  }
+
+  if (chronosShmClientClaim(shmP) != CHRONOS_SUCCESS) {
+    chronos_error("Shared memory segment %.64s is busy", shmP->name);
+    goto failXit;
+  }
+
+  chronosShmSideSet(CHRONOS_SHM_CLIENT, shmP);
+  CHRONOS_SHM_MAGIC_SET(shmP);
+
+  return shmP;
+
+failXit:
+  if (mapP != MAP_FAILED) {
+    munmap(mapP, shmP->mapSize);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (shmP != NULL) {
+    free(shmP);
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------
+ * Detach from the segment. The peer sees the rings
+ * closed once it has read what was left in them. The
+ * server also removes the segment's name.
+ *------------------------------------------------*/
+int
+chronosShmClose(CHRONOS_SHM_H shmH)
+{
+  chronosShm_t *shmP = NULL;
+
+  if (shmH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  shmP = (chronosShm_t *) shmH;
+  CHRONOS_SHM_MAGIC_CHECK(shmP);
+
+  __atomic_or_fetch(&shmP->segP->closedMask, CHRONOS_SHM_CLOSED(shmP->side), __ATOMIC_SEQ_CST);
+  chronosShmRing(shmP->peerBellP);
+
+  if (shmP->side == CHRONOS_SHM_SERVER) {
+    shm_unlink(shmP->name);
+  }
+
+  munmap(shmP->segP, shmP->mapSize);
+
+  memset(shmP, 0, sizeof(*shmP));
+  free(shmP);
+
+  return CHRONOS_SUCCESS;
+}
+
+static int
+chronosShmPeerClosed(chronosShm_t *shmP)
+{
+  return (SHM_LOAD(&shmP->segP->closedMask) & CHRONOS_SHM_CLOSED(1 - shmP->side)) != 0;
+}
+
+/*--------------------------------------------------
+ * Write as much of the iovec array as the ring takes,
+ * without blocking. Like writev() on a non-blocking
+ * socket: fails with EAGAIN if nothing fits and with
+ * EPIPE once the peer is gone.
+ *------------------------------------------------*/
+ssize_t
+chronosShmWritev(const struct iovec *iov,
+                 int                 iovcnt,
+                 CHRONOS_SHM_H       shmH)
+{
+  int i;
+  size_t len;
+  size_t pos;
+  size_t chunk;
+  size_t space;
+  size_t written = 0;
+  uint64_t head;
+  uint64_t tail;
+  chronosShm_t *shmP = NULL;
+
+  if (shmH == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  shmP = (chronosShm_t *) shmH;
+  CHRONOS_SHM_MAGIC_CHECK(shmP);
+
+  if (chronosShmPeerClosed(shmP)) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  head = SHM_LOAD(&shmP->txRingP->head);
+  tail = shmP->txRingP->tail;
+  space = shmP->segP->ringSize - (tail - head);
+
+  for (i=0; i<iovcnt && written < space; i++) {
+    len = iov[i].iov_len;
+    if (len > space - written) {
+      len = space - written;
+    }
+
+    /* At most two copies, the second one after wrapping */
+    pos = (tail + written) & shmP->mask;
+    chunk = shmP->segP->ringSize - pos;
+    if (chunk > len) {
+      chunk = len;
+    }
+    memcpy(shmP->txDataP + pos, iov[i].iov_base, chunk);
+    memcpy(shmP->txDataP, (const char *) iov[i].iov_base + chunk, len - chunk);
+
+    written += len;
+  }
+
+  if (written == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  SHM_STORE(&shmP->txRingP->tail, tail + written);
+  chronosShmNotify(shmP->peerBellP);
+
+  return written;
+}
+
+/*--------------------------------------------------
+ * Read up to len bytes without blocking. Like read()
+ * on a non-blocking socket: fails with EAGAIN if the
+ * ring is empty and returns 0 once it is empty and
+ * the peer is gone.
+ *------------------------------------------------*/
+ssize_t
+chronosShmRead(void          *buf,
+               size_t         len,
+               CHRONOS_SHM_H  shmH)
+{
+  size_t pos;
+  size_t chunk;
+  size_t avail;
+  uint64_t head;
+  uint64_t tail;
+  chronosShm_t *shmP = NULL;
+
+  if (shmH == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  shmP = (chronosShm_t *) shmH;
+  CHRONOS_SHM_MAGIC_CHECK(shmP);
+
+  /* Check for the close first: bytes written before it
+   * are then sure to be seen */
+  if (chronosShmPeerClosed(shmP)) {
+    tail = SHM_LOAD(&shmP->rxRingP->tail);
+    if (tail == shmP->rxRingP->head) {
+      return 0;
+    }
+  }
+
+  tail = SHM_LOAD(&shmP->rxRingP->tail);
+  head = shmP->rxRingP->head;
+  avail = tail - head;
+
+  if (avail == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  if (len > avail) {
+    len = avail;
+  }
+
+  pos = head & shmP->mask;
+  chunk = shmP->segP->ringSize - pos;
+  if (chunk > len) {
+    chunk = len;
+  }
+  memcpy(buf, shmP->rxDataP + pos, chunk);
+  memcpy((char *) buf + chunk, shmP->rxDataP, len - chunk);
+
+  SHM_STORE(&shmP->rxRingP->head, head + len);
+  chronosShmNotify(shmP->peerBellP);
+
+  return len;
+}
+
+/* What poll() would report for the given events */
+static short
+chronosShmReadyGet(short         events,
+                   chronosShm_t *shmP)
+{
+  short revents = 0;
+
+  if ((events & POLLIN)
+      && SHM_LOAD(&shmP->rxRingP->tail) != shmP->rxRingP->head) {
+    revents |= POLLIN;
+  }
+
+  if ((events & POLLOUT)
+      && shmP->txRingP->tail - SHM_LOAD(&shmP->txRingP->head) < shmP->segP->ringSize) {
+    revents |= POLLOUT;
+  }
+
+  if (chronosShmPeerClosed(shmP)) {
+    revents |= POLLHUP;
+  }
+
+  return revents;
+}
+
+/*--------------------------------------------------
+ * The poll() of the transport: wait until the rings
+ * are ready for the given events (POLLIN, POLLOUT) or
+ * for up to *timeoutP (NULL waits forever). POLLHUP
+ * is reported once the peer is gone. Returns
+ * CHRONOS_TIMEOUT if nothing happened in time. A
+ * chronosShmWake() since the last wait returned makes
+ * it return CHRONOS_SUCCESS, possibly with no events.
+ *------------------------------------------------*/
+int
+chronosShmWait(short                  events,
+               const struct timespec *timeoutP,
+               short                 *reventsP,
+               CHRONOS_SHM_H          shmH)
+{
+  int i;
+  int rc = CHRONOS_SUCCESS;
+  uint32_t seq;
+  short revents;
+  chronosShm_t *shmP = NULL;
+
+  if (shmH == NULL || reventsP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  shmP = (chronosShm_t *) shmH;
+  CHRONOS_SHM_MAGIC_CHECK(shmP);
+
+  /* The peer is typically just about to answer */
+  for (i=0; i<shmP->spinLoops; i++) {
+    seq = SHM_LOAD(&shmP->ownBellP->seq);
+    revents = chronosShmReadyGet(events, shmP);
+    if (revents != 0 || seq != shmP->lastSeq) {
+      goto cleanup;
+    }
+    CHRONOS_SHM_CPU_RELAX();
+  }
+
+  seq = SHM_LOAD(&shmP->ownBellP->seq);
+  __atomic_store_n(&shmP->ownBellP->isWaiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  revents = chronosShmReadyGet(events, shmP);
+  if (revents != 0 || seq != shmP->lastSeq) {
+    goto cleanup;
+  }
+
+  if (chronosShmFutexWait(&shmP->ownBellP->seq, seq, timeoutP) < 0) {
+    if (errno == ETIMEDOUT) {
+      rc = CHRONOS_TIMEOUT;
+    }
+    else if (errno != EAGAIN && errno != EINTR) {
+      perror("futex() failed");
+      rc = CHRONOS_FAIL;
+    }
+  }
+
+  revents = chronosShmReadyGet(events, shmP);
+  if (revents != 0 && rc == CHRONOS_TIMEOUT) {
+    rc = CHRONOS_SUCCESS;
+  }
+
+cleanup:
+  __atomic_store_n(&shmP->ownBellP->isWaiting, 0, __ATOMIC_RELAXED);
+  shmP->lastSeq = SHM_LOAD(&shmP->ownBellP->seq);
+  *reventsP = revents;
+
+  return rc;
+}
+
+/*--------------------------------------------------
+ * Wake up a thread of this side sleeping in
+ * chronosShmWait(). Can be called from any thread.
+ *------------------------------------------------*/
+int
+chronosShmWake(CHRONOS_SHM_H shmH)
+{
+  chronosShm_t *shmP = NULL;
+
+  if (shmH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  shmP = (chronosShm_t *) shmH;
+  CHRONOS_SHM_MAGIC_CHECK(shmP);
+
+  chronosShmRing(shmP->ownBellP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*--------------------------------------------------
+ * Loopback server
+ *------------------------------------------------*/
+#define CHRONOS_SHM_LOOPBACK_MAGIC   (0x5349)
+#define CHRONOS_SHM_LOOPBACK_MAGIC_CHECK(loopbackP)    assert((loopbackP)->magic == CHRONOS_SHM_LOOPBACK_MAGIC)
+#define CHRONOS_SHM_LOOPBACK_MAGIC_SET(loopbackP)      (loopbackP)->magic = CHRONOS_SHM_LOOPBACK_MAGIC
+
+#define CHRONOS_SHM_LOOPBACK_BUF_SIZE   (2 * sizeof(chronosRequestPacket_t))
+
+typedef struct chronosShmLoopback_t {
+  int              magic;
+  int              isStopping;
+  chronosShm_t    *shmP;
+  pthread_t        thread;
+
+  size_t           recvLen;
+  char             recvBuf[CHRONOS_SHM_LOOPBACK_BUF_SIZE];
+} chronosShmLoopback_t;
+
+/*
+ * Gets the segment ready for the next client once the
+ * current one is gone: whatever it left behind is dropped.
+ */
+static void
+chronosShmClientRelease(chronosShm_t *shmP)
+{
+  chronosShmSegment_t *segP = shmP->segP;
+
+  segP->ringArr[0].head = segP->ringArr[0].tail = 0;
+  segP->ringArr[1].head = segP->ringArr[1].tail = 0;
+
+  __atomic_and_fetch(&segP->closedMask, ~CHRONOS_SHM_CLOSED(CHRONOS_SHM_CLIENT), __ATOMIC_SEQ_CST);
+  SHM_STORE(&segP->clientPid, 0);
+}
+
+/*
+ * Answers every whole request in the receive buffer.
+ * Fails if the client went away.
+ */
+static int
+chronosShmLoopbackAnswer(chronosShmLoopback_t *loopbackP)
+{
+  int rc;
+  size_t offset = 0;
+  size_t frameSize;
+  size_t consumed;
+  ssize_t written;
+  short revents;
+  struct iovec iov;
+  struct timespec timeout = { 0, 100 * 1000 * 1000 };
+  chronosRequestPacket_t  request;
+  chronosResponsePacket_t response;
+
+  while (1) {
+    frameSize = chronosRequestFrameSizeGet(loopbackP->recvBuf + offset,
+                                           loopbackP->recvLen - offset);
+    if (frameSize == 0 || loopbackP->recvLen - offset < frameSize) {
+      break;
+    }
+
+    rc = chronosRequestDecode(loopbackP->recvBuf + offset, frameSize, &request, &consumed);
+    if (rc != CHRONOS_SUCCESS) {
+      chronos_error("Could not decode request");
+      return CHRONOS_FAIL;
+    }
+    offset += consumed;
+
+    memset(&response, 0, sizeof(response));
+    response.requestId = request.requestId;
+    response.txn_type = request.txn_type;
+    response.rc = CHRONOS_SUCCESS;
+
+    iov.iov_base = &response;
+    iov.iov_len = sizeof(response);
+
+    while (iov.iov_len > 0 && !loopbackP->isStopping) {
+      written = chronosShmWritev(&iov, 1, loopbackP->shmP);
+      if (written < 0) {
+        if (errno != EAGAIN) {
+          return CHRONOS_FAIL;
+        }
+        chronosShmWait(POLLOUT, &timeout, &revents, loopbackP->shmP);
+        continue;
+      }
+      iov.iov_base = (char *) iov.iov_base + written;
+      iov.iov_len -= written;
+    }
+  }
+
+  memmove(loopbackP->recvBuf, loopbackP->recvBuf + offset, loopbackP->recvLen - offset);
+  loopbackP->recvLen -= offset;
+
+  return CHRONOS_SUCCESS;
+}
+
+static void *
+chronosShmLoopbackThread(void *arg)
+{
+  int rc;
+  ssize_t numBytes;
+  short revents;
+  struct timespec timeout = { 0, 100 * 1000 * 1000 };
+  chronosShmLoopback_t *loopbackP = (chronosShmLoopback_t *) arg;
+
+  while (!__atomic_load_n(&loopbackP->isStopping, __ATOMIC_ACQUIRE)) {
+    rc = chronosShmWait(POLLIN, &timeout, &revents, loopbackP->shmP);
+    if (rc == CHRONOS_FAIL) {
+      break;
+    }
+
+    numBytes = chronosShmRead(loopbackP->recvBuf + loopbackP->recvLen,
+                              sizeof(loopbackP->recvBuf) - loopbackP->recvLen,
+                              loopbackP->shmP);
+    if (numBytes > 0) {
+      loopbackP->recvLen += numBytes;
+      rc = chronosShmLoopbackAnswer(loopbackP);
+      if (rc == CHRONOS_SUCCESS) {
+        continue;
+      }
+    }
+    else if (numBytes < 0) {
+      continue;
+    }
+
+    /* The client is gone: wait for the next one */
+    loopbackP->recvLen = 0;
+    chronosShmClientRelease(loopbackP->shmP);
+  }
+
+  return NULL;
+}
+
+CHRONOS_SHM_LOOPBACK_H
+chronosShmLoopbackStart(const char *name,
+                        size_t      ringSize)
+{
+  chronosShmLoopback_t *loopbackP = NULL;
+
+  loopbackP = malloc(sizeof(chronosShmLoopback_t));
+  if (loopbackP == NULL) {
+    chronos_error("Could not allocate loopback server");
+    goto failXit;
+  }
+
+  memset(loopbackP, 0, sizeof(*loopbackP));
+
+  loopbackP->shmP = chronosShmCreate(name, ringSize);
+  if (loopbackP->shmP == NULL) {
+    goto failXit;
+  }
+
+  if (pthread_create(&loopbackP->thread, NULL, chronosShmLoopbackThread, loopbackP) != 0) {
+    chronos_error("Could not start loopback server thread");
+    goto failXit;
+  }
+
+  CHRONOS_SHM_LOOPBACK_MAGIC_SET(loopbackP);
+
+  return loopbackP;
+
+failXit:
+  if (loopbackP != NULL) {
+    if (loopbackP->shmP != NULL) {
+      chronosShmClose(loopbackP->shmP);
+    }
+    free(loopbackP);
+  }
+  return NULL;
+}
+
+int
+chronosShmLoopbackStop(CHRONOS_SHM_LOOPBACK_H loopbackH)
+{
+  chronosShmLoopback_t *loopbackP = NULL;
+
+  if (loopbackH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  loopbackP = (chronosShmLoopback_t *) loopbackH;
+  CHRONOS_SHM_LOOPBACK_MAGIC_CHECK(loopbackP);
+
+  __atomic_store_n(&loopbackP->isStopping, 1, __ATOMIC_RELEASE);
+  chronosShmWake(loopbackP->shmP);
+  pthread_join(loopbackP->thread, NULL);
+
+  chronosShmClose(loopbackP->shmP);
+
+  memset(loopbackP, 0, sizeof(*loopbackP));
+  free(loopbackP);
+
+  return CHRONOS_SUCCESS;
+}
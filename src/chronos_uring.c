@@ -0,0 +1,721 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include "chronos.h"
+#include "include/chronos_uring.h"
+
+/* Multishot receives from a ring of provided buffers came
+ * with Linux 6.0, and with them these headers */
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define CHRONOS_URING_SUPPORTED  1
+#endif
+
+#ifdef CHRONOS_URING_SUPPORTED
+
+#define CHRONOS_URING_MAGIC   (0x0A17)
+#define CHRONOS_URING_MAGIC_CHECK(uringP)    assert((uringP)->magic == CHRONOS_URING_MAGIC)
+#define CHRONOS_URING_MAGIC_SET(uringP)      (uringP)->magic = CHRONOS_URING_MAGIC
+
+/* Id of the group of provided receive buffers */
+#define CHRONOS_URING_RECV_BUF_GROUP   (0)
+
+#define URING_LOAD(_p)          __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define URING_STORE(_p, _v)     __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+
+typedef struct chronosUring_t {
+  int                    magic;
+  int                    ringFd;
+
+  /* Submission ring: the kernel consumes from *sqHeadP,
+   * we produce at sqTail and publish it in *sqTailP */
+  void                  *sqMapP;
+  size_t                 sqMapSize;
+  unsigned int          *sqHeadP;
+  unsigned int          *sqTailP;
+  unsigned int          *sqArrayP;
+  unsigned int           sqMask;
+  unsigned int           sqEntries;
+  unsigned int           sqTail;
+  struct io_uring_sqe   *sqeArr;
+  size_t                 sqeMapSize;
+
+  /* Completion ring, shares the submission ring's mapping */
+  unsigned int          *cqHeadP;
+  unsigned int          *cqTailP;
+  unsigned int           cqMask;
+  struct io_uring_cqe   *cqeArr;
+
+  /* Provided receive buffers and the ring that hands them
+   * to the kernel */
+  struct io_uring_buf_ring *bufRingP;
+  size_t                 bufRingMapSize;
+  char                  *recvBufArr;
+  uint16_t               bufRingTail;
+
+  int                    isRecvMultishot;
+
+  /* Operations submitted whose last completion has not
+   * been picked up yet */
+  int                    numPending;
+} chronosUring_t;
+
+static int
+chronosUringSetup(unsigned int            numEntries,
+                  struct io_uring_params *paramsP)
+{
+  return syscall(__NR_io_uring_setup, numEntries, paramsP);
+}
+
+static int
+chronosUringEnter(int          ringFd,
+                  unsigned int toSubmit,
+                  unsigned int minComplete,
+                  unsigned int flags,
+                  void        *argP,
+                  size_t       argSize)
+{
+  return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, argP, argSize);
+}
+
+static int
+chronosUringRegister(int          ringFd,
+                     unsigned int opcode,
+                     void        *argP,
+                     unsigned int numArgs)
+{
+  return syscall(__NR_io_uring_register, ringFd, opcode, argP, numArgs);
+}
+
+/*
+ * Hands every prepared operation to the kernel, without
+ * waiting for any of them.
+ */
+static int
+chronosUringSubmit(chronosUring_t *uringP)
+{
+  int rc;
+  unsigned int toSubmit;
+
+  toSubmit = uringP->sqTail - URING_LOAD(uringP->sqHeadP);
+  while (toSubmit > 0) {
+    rc = chronosUringEnter(uringP->ringFd, toSubmit, 0, 0, NULL, 0);
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      /* Out of memory for completions, or too many of them
+       * not reaped: the caller reaps and tries again */
+      if (errno == EAGAIN || errno == EBUSY) {
+        return CHRONOS_TIMEOUT;
+      }
+      perror("io_uring_enter() failed");
+      return CHRONOS_FAIL;
+    }
+    toSubmit = uringP->sqTail - URING_LOAD(uringP->sqHeadP);
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Returns a cleared submission entry to prepare, submitting
+ * what is already there if the ring is full.
+ */
+static struct io_uring_sqe *
+chronosUringSqeGet(uint64_t        userData,
+                   chronosUring_t *uringP)
+{
+  unsigned int index;
+  struct io_uring_sqe *sqeP = NULL;
+
+  if (uringP->sqTail - URING_LOAD(uringP->sqHeadP) >= uringP->sqEntries) {
+    if (chronosUringSubmit(uringP) != CHRONOS_SUCCESS) {
+      chronos_error("io_uring submission ring is full");
+      return NULL;
+    }
+  }
+
+  index = uringP->sqTail & uringP->sqMask;
+  sqeP = &(uringP->sqeArr[index]);
+  memset(sqeP, 0, sizeof(*sqeP));
+  sqeP->user_data = userData;
+
+  uringP->sqArrayP[index] = index;
+  uringP->sqTail ++;
+  URING_STORE(uringP->sqTailP, uringP->sqTail);
+
+  uringP->numPending ++;
+
+  return sqeP;
+}
+
+static int
+chronosUringRecvBufRingSetup(chronosUring_t *uringP)
+{
+  int i;
+  struct io_uring_buf_reg reg;
+
+  uringP->bufRingMapSize = CHRONOS_URING_NUM_RECV_BUFS * sizeof(struct io_uring_buf);
+  uringP->bufRingP = mmap(NULL, uringP->bufRingMapSize,
+                          PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE,
+                          -1, 0);
+  if (uringP->bufRingP == MAP_FAILED) {
+    uringP->bufRingP = NULL;
+    perror("mmap() failed");
+    return CHRONOS_FAIL;
+  }
+
+  uringP->recvBufArr = malloc(CHRONOS_URING_NUM_RECV_BUFS * CHRONOS_URING_RECV_BUF_SIZE);
+  if (uringP->recvBufArr == NULL) {
+    chronos_error("Could not allocate receive buffers");
+    return CHRONOS_FAIL;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) uringP->bufRingP;
+  reg.ring_entries = CHRONOS_URING_NUM_RECV_BUFS;
+  reg.bgid = CHRONOS_URING_RECV_BUF_GROUP;
+
+  if (chronosUringRegister(uringP->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    chronos_info("io_uring buffer rings not supported: %s", strerror(errno));
+    return CHRONOS_FAIL;
+  }
+
+  for (i=0; i<CHRONOS_URING_NUM_RECV_BUFS; i++) {
+    chronosUringRecvBufPut(i, uringP);
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Sets up a ring with room for numEntries operations in
+ * submission. Returns NULL if io_uring is not usable here.
+ */
+CHRONOS_URING_H
+chronosUringAlloc(unsigned int numEntries)
+{
+  struct io_uring_params params;
+  chronosUring_t *uringP = NULL;
+
+  uringP = malloc(sizeof(chronosUring_t));
+  if (uringP == NULL) {
+    chronos_error("Could not allocate io_uring");
+    goto failXit;
+  }
+
+  memset(uringP, 0, sizeof(*uringP));
+  uringP->ringFd = -1;
+  CHRONOS_URING_MAGIC_SET(uringP);
+
+  /* Completions can outnumber submissions by far with
+   * multishot receives */
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 8 * numEntries;
+
+  uringP->ringFd = chronosUringSetup(numEntries, &params);
+  if (uringP->ringFd < 0) {
+    chronos_info("io_uring not available: %s", strerror(errno));
+    goto failXit;
+  }
+
+  /* Timed waits and a single mapping for both rings */
+  if (!(params.features & IORING_FEAT_EXT_ARG)
+      || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    chronos_info("io_uring too old, features: 0x%x", params.features);
+    goto failXit;
+  }
+
+  uringP->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > uringP->sqMapSize) {
+    uringP->sqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  }
+
+  uringP->sqMapP = mmap(NULL, uringP->sqMapSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        uringP->ringFd, IORING_OFF_SQ_RING);
+  if (uringP->sqMapP == MAP_FAILED) {
+    uringP->sqMapP = NULL;
+    perror("mmap() failed");
+    goto failXit;
+  }
+
+  uringP->sqeMapSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  uringP->sqeArr = mmap(NULL, uringP->sqeMapSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        uringP->ringFd, IORING_OFF_SQES);
+  if (uringP->sqeArr == MAP_FAILED) {
+    uringP->sqeArr = NULL;
+    perror("mmap() failed");
+    goto failXit;
+  }
+
+  uringP->sqHeadP = (unsigned int *) ((char *) uringP->sqMapP + params.sq_off.head);
+  uringP->sqTailP = (unsigned int *) ((char *) uringP->sqMapP + params.sq_off.tail);
+  uringP->sqArrayP = (unsigned int *) ((char *) uringP->sqMapP + params.sq_off.array);
+  uringP->sqMask = *(unsigned int *) ((char *) uringP->sqMapP + params.sq_off.ring_mask);
+  uringP->sqEntries = params.sq_entries;
+  uringP->sqTail = *uringP->sqTailP;
+
+  uringP->cqHeadP = (unsigned int *) ((char *) uringP->sqMapP + params.cq_off.head);
+  uringP->cqTailP = (unsigned int *) ((char *) uringP->sqMapP + params.cq_off.tail);
+  uringP->cqMask = *(unsigned int *) ((char *) uringP->sqMapP + params.cq_off.ring_mask);
+  uringP->cqeArr = (struct io_uring_cqe *) ((char *) uringP->sqMapP + params.cq_off.cqes);
+
+  if (chronosUringRecvBufRingSetup(uringP) != CHRONOS_SUCCESS) {
+    goto failXit;
+  }
+
+  uringP->isRecvMultishot = 1;
+
+  return uringP;
+
+failXit:
+  if (uringP != NULL) {
+    uringP->numPending = 0;
+    chronosUringFree(uringP);
+  }
+  return NULL;
+}
+
+/*
+ * Operations still pending are cancelled by the kernel
+ * when the ring goes away.
+ */
+int
+chronosUringFree(CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = NULL;
+
+  if (uringH == NULL) {
+    chronos_error("Invalid handle");
+    return CHRONOS_FAIL;
+  }
+
+  uringP = (chronosUring_t *) uringH;
+  CHRONOS_URING_MAGIC_CHECK(uringP);
+
+  if (uringP->numPending > 0) {
+    chronos_warning("Freeing io_uring with %d operations pending", uringP->numPending);
+  }
+
+  if (uringP->ringFd >= 0) {
+    close(uringP->ringFd);
+  }
+  if (uringP->sqeArr != NULL) {
+    munmap(uringP->sqeArr, uringP->sqeMapSize);
+  }
+  if (uringP->sqMapP != NULL) {
+    munmap(uringP->sqMapP, uringP->sqMapSize);
+  }
+  if (uringP->bufRingP != NULL) {
+    munmap(uringP->bufRingP, uringP->bufRingMapSize);
+  }
+  if (uringP->recvBufArr != NULL) {
+    free(uringP->recvBufArr);
+  }
+
+  memset(uringP, 0, sizeof(*uringP));
+  free(uringP);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * The buffer must stay untouched until the send completes.
+ * It may complete short, like send() would.
+ */
+int
+chronosUringSendPrep(int             fd,
+                     const void     *buf,
+                     size_t          len,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  struct io_uring_sqe *sqeP = NULL;
+
+  sqeP = chronosUringSqeGet(userData, (chronosUring_t *) uringH);
+  if (sqeP == NULL) {
+    return CHRONOS_FAIL;
+  }
+
+  sqeP->opcode = IORING_OP_SEND;
+  sqeP->fd = fd;
+  sqeP->addr = (uint64_t) (uintptr_t) buf;
+  sqeP->len = len;
+  sqeP->msg_flags = MSG_NOSIGNAL;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Receives into provided buffers, see
+ * chronosUringRecvBufIdGet().
+ */
+int
+chronosUringRecvPrep(int             fd,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+  struct io_uring_sqe *sqeP = NULL;
+
+  sqeP = chronosUringSqeGet(userData, uringP);
+  if (sqeP == NULL) {
+    return CHRONOS_FAIL;
+  }
+
+  sqeP->opcode = IORING_OP_RECV;
+  sqeP->fd = fd;
+  sqeP->flags = IOSQE_BUFFER_SELECT;
+  sqeP->buf_group = CHRONOS_URING_RECV_BUF_GROUP;
+  if (uringP->isRecvMultishot) {
+    sqeP->ioprio = IORING_RECV_MULTISHOT;
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+int
+chronosUringPollPrep(int             fd,
+                     short           events,
+                     int             isMultishot,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  struct io_uring_sqe *sqeP = NULL;
+
+  sqeP = chronosUringSqeGet(userData, (chronosUring_t *) uringH);
+  if (sqeP == NULL) {
+    return CHRONOS_FAIL;
+  }
+
+  sqeP->opcode = IORING_OP_POLL_ADD;
+  sqeP->fd = fd;
+  sqeP->poll32_events = (unsigned short) events;
+  if (isMultishot) {
+    sqeP->len = IORING_POLL_ADD_MULTI;
+  }
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Cancels every pending operation with the given user
+ * data. The cancel itself completes with user data 0.
+ */
+int
+chronosUringCancelPrep(uint64_t        targetUserData,
+                       CHRONOS_URING_H uringH)
+{
+  struct io_uring_sqe *sqeP = NULL;
+
+  sqeP = chronosUringSqeGet(0, (chronosUring_t *) uringH);
+  if (sqeP == NULL) {
+    return CHRONOS_FAIL;
+  }
+
+  sqeP->opcode = IORING_OP_ASYNC_CANCEL;
+  sqeP->fd = -1;
+  sqeP->addr = targetUserData;
+  sqeP->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Submits every prepared operation and picks up to
+ * maxCompletions completions, waiting up to timeoutMs (-1
+ * waits forever, 0 does not wait) if there is none. All of
+ * it takes a single system call.
+ */
+int
+chronosUringWait(int                       timeoutMs,
+                 chronosUringCompletion_t *completionArr,
+                 int                       maxCompletions,
+                 int                      *numCompletionsP,
+                 CHRONOS_URING_H           uringH)
+{
+  int rc;
+  int n = 0;
+  unsigned int head;
+  unsigned int tail;
+  unsigned int toSubmit;
+  unsigned int minComplete;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  struct io_uring_cqe *cqeP = NULL;
+  chronosUring_t *uringP = NULL;
+
+  if (uringH == NULL || completionArr == NULL || numCompletionsP == NULL) {
+    chronos_error("Invalid argument");
+    return CHRONOS_FAIL;
+  }
+
+  uringP = (chronosUring_t *) uringH;
+  CHRONOS_URING_MAGIC_CHECK(uringP);
+
+  *numCompletionsP = 0;
+
+  head = *uringP->cqHeadP;
+  tail = URING_LOAD(uringP->cqTailP);
+  toSubmit = uringP->sqTail - URING_LOAD(uringP->sqHeadP);
+  minComplete = (head == tail && timeoutMs != 0) ? 1 : 0;
+
+  if (toSubmit > 0 || minComplete > 0) {
+    memset(&arg, 0, sizeof(arg));
+    if (timeoutMs >= 0) {
+      ts.tv_sec = timeoutMs / 1000;
+      ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+      arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    rc = chronosUringEnter(uringP->ringFd,
+                           toSubmit,
+                           minComplete,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                           &arg,
+                           sizeof(arg));
+    if (rc < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      perror("io_uring_enter() failed");
+      return CHRONOS_FAIL;
+    }
+  }
+
+  tail = URING_LOAD(uringP->cqTailP);
+  while (head != tail && n < maxCompletions) {
+    cqeP = &(uringP->cqeArr[head & uringP->cqMask]);
+    completionArr[n].userData = cqeP->user_data;
+    completionArr[n].res = cqeP->res;
+    completionArr[n].flags = cqeP->flags;
+
+    if (chronosUringCompletionIsLast(&(completionArr[n]))) {
+      uringP->numPending --;
+    }
+
+    n ++;
+    head ++;
+  }
+
+  URING_STORE(uringP->cqHeadP, head);
+
+  *numCompletionsP = n;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Whether no more completions will come for the operation.
+ */
+int
+chronosUringCompletionIsLast(const chronosUringCompletion_t *completionP)
+{
+  return !(completionP->flags & IORING_CQE_F_MORE);
+}
+
+/*
+ * Returns CHRONOS_FAIL if the completion did not consume a
+ * provided buffer.
+ */
+int
+chronosUringRecvBufIdGet(const chronosUringCompletion_t *completionP,
+                         unsigned int                   *bufIdP)
+{
+  if (!(completionP->flags & IORING_CQE_F_BUFFER)) {
+    return CHRONOS_FAIL;
+  }
+
+  *bufIdP = completionP->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  return CHRONOS_SUCCESS;
+}
+
+const char *
+chronosUringRecvBufGet(unsigned int    bufId,
+                       CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+
+  assert(bufId < CHRONOS_URING_NUM_RECV_BUFS);
+
+  return uringP->recvBufArr + (size_t) bufId * CHRONOS_URING_RECV_BUF_SIZE;
+}
+
+int
+chronosUringRecvBufPut(unsigned int    bufId,
+                       CHRONOS_URING_H uringH)
+{
+  struct io_uring_buf *bufP = NULL;
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+
+  if (bufId >= CHRONOS_URING_NUM_RECV_BUFS) {
+    chronos_error("Invalid buffer id: %u", bufId);
+    return CHRONOS_FAIL;
+  }
+
+  bufP = &(uringP->bufRingP->bufs[uringP->bufRingTail & (CHRONOS_URING_NUM_RECV_BUFS - 1)]);
+  bufP->addr = (uint64_t) (uintptr_t) (uringP->recvBufArr + (size_t) bufId * CHRONOS_URING_RECV_BUF_SIZE);
+  bufP->len = CHRONOS_URING_RECV_BUF_SIZE;
+  bufP->bid = bufId;
+
+  uringP->bufRingTail ++;
+  URING_STORE(&(uringP->bufRingP->tail), uringP->bufRingTail);
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * For kernels that reject multishot receives: each receive
+ * then completes once and must be prepared again.
+ */
+int
+chronosUringRecvMultishotDisable(CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+
+  if (uringP->isRecvMultishot) {
+    chronos_info("io_uring multishot receives not supported");
+  }
+  uringP->isRecvMultishot = 0;
+
+  return CHRONOS_SUCCESS;
+}
+
+/*
+ * Whether the receives prepared now are multishot.
+ */
+int
+chronosUringRecvIsMultishot(CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+
+  return uringP->isRecvMultishot;
+}
+
+int
+chronosUringNumPendingGet(CHRONOS_URING_H uringH)
+{
+  chronosUring_t *uringP = (chronosUring_t *) uringH;
+
+  return uringP->numPending;
+}
+
+#else /* CHRONOS_URING_SUPPORTED */
+
+CHRONOS_URING_H
+chronosUringAlloc(unsigned int numEntries)
+{
+  chronos_info("Built without io_uring support");
+  return NULL;
+}
+
+int
+chronosUringFree(CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringSendPrep(int             fd,
+                     const void     *buf,
+                     size_t          len,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringRecvPrep(int             fd,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringPollPrep(int             fd,
+                     short           events,
+                     int             isMultishot,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringCancelPrep(uint64_t        targetUserData,
+                       CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringWait(int                       timeoutMs,
+                 chronosUringCompletion_t *completionArr,
+                 int                       maxCompletions,
+                 int                      *numCompletionsP,
+                 CHRONOS_URING_H           uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringCompletionIsLast(const chronosUringCompletion_t *completionP)
+{
+  return 1;
+}
+
+int
+chronosUringRecvBufIdGet(const chronosUringCompletion_t *completionP,
+                         unsigned int                   *bufIdP)
+{
+  return CHRONOS_FAIL;
+}
+
+const char *
+chronosUringRecvBufGet(unsigned int    bufId,
+                       CHRONOS_URING_H uringH)
+{
+  return NULL;
+}
+
+int
+chronosUringRecvBufPut(unsigned int    bufId,
+                       CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringRecvMultishotDisable(CHRONOS_URING_H uringH)
+{
+  return CHRONOS_FAIL;
+}
+
+int
+chronosUringRecvIsMultishot(CHRONOS_URING_H uringH)
+{
+  return 0;
+}
+
+int
+chronosUringNumPendingGet(CHRONOS_URING_H uringH)
+{
+  return 0;
+}
+
+#endif /* CHRONOS_URING_SUPPORTED */
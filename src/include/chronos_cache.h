@@ -1,19 +1,36 @@
 #ifndef _CHRONOS_CACHE_H_
 #define _CHRONOS_CACHE_H_
 
+#include "chronos_random.h"
+#include "chronos_distribution.h"
+
 #define CHRONOS_CLIENT_MAX_PORTFOLIOS_PER_CLIENT  (100)
 #define CHRONOS_CLIENT_MAX_SYMBOLS_PER_PORTFOLIO  (100)
 
+/* Number of symbols cached when the caller does not ask
+ * for a specific number */
+#define CHRONOS_CACHE_DEFAULT_NUM_SYMBOLS  (3000)
+#define CHRONOS_CACHE_MAX_NUM_SYMBOLS      (1 << 28)
+
+/* Name of the binary cache snapshot looked up in the
+ * data files directory by chronosCacheAlloc() */
+#define CHRONOS_CACHE_SNAPSHOT_FILE  "chronos_cache.snap"
+
 typedef void *CHRONOS_CACHE_H;
 typedef void *CHRONOS_CLIENT_CACHE_H;
 
 CHRONOS_CACHE_H
 chronosCacheAlloc(const char *homedir, 
-                  const char *datafilesdir);
+                  const char *datafilesdir,
+                  int         numSymbols);
 
 int
 chronosCacheFree(CHRONOS_CACHE_H chronosCacheH);
 
+int
+chronosCacheSnapshotWrite(const char      *snapshotPath,
+                          CHRONOS_CACHE_H  chronosCacheH);
+
 int
 chronosCacheSymbolsRangeSet(int firstElt, int numElt, CHRONOS_CACHE_H chronosCacheH);
 
@@ -24,6 +41,10 @@ const char *
 chronosCacheSymbolGet(int symbolNum,
                       CHRONOS_CACHE_H chronosCacheH);
 
+int
+chronosCacheSymbolLookup(const char      *symbol,
+                         CHRONOS_CACHE_H  chronosCacheH);
+
 int
 chronosCacheSymbolIdxGet(int             symbolNum,
                          CHRONOS_CACHE_H chronosCacheH);
@@ -43,6 +64,27 @@ chronosClientCacheAlloc(int numClient,
 int
 chronosClientCacheFree(CHRONOS_CLIENT_CACHE_H chronosClientCacheH);
 
+int
+chronosClientCacheSeedSet(uint64_t                seed,
+                          CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
+chronosRandom_t *
+chronosClientCacheRandomGet(CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
+int
+chronosClientCacheUserDistSet(CHRONOS_KEY_DIST_H      distH,
+                              CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
+CHRONOS_KEY_DIST_H
+chronosClientCacheUserDistGet(CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
+int
+chronosClientCacheSymbolDistSet(CHRONOS_KEY_DIST_H      distH,
+                                CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
+CHRONOS_KEY_DIST_H
+chronosClientCacheSymbolDistGet(CHRONOS_CLIENT_CACHE_H  clientCacheH);
+
 int
 chronosClientCacheNumPortfoliosGet(CHRONOS_CLIENT_CACHE_H  clientCacheH);
 
@@ -4,23 +4,149 @@
 #include "chronos_packets.h"
 #include "chronos_environment.h"
 
+/* Max number of requests a connection can have in flight.
+ * Must be a power of two */
+#define CHRONOS_CLIENT_MAX_INFLIGHT  (128)
+
+/* Default cap on the bytes a connection buffers for
+ * sending, see chronosClientSendLimitSet() */
+#define CHRONOS_CLIENT_SEND_LIMIT    (1024 * 1024)
+
+/* Batches smaller than this are copied even on zero-copy
+ * connections: pinning the pages would cost more */
+#define CHRONOS_CLIENT_ZEROCOPY_MIN_SIZE  (8 * 1024)
+
+/* Server addresses starting with this are Unix domain
+ * socket paths. A path starting with '@' is in the
+ * abstract namespace */
+#define CHRONOS_CLIENT_UNIX_PREFIX     "unix:"
+
+/* Server addresses starting with this name a shared-memory
+ * segment, see chronos_shm.h */
+#define CHRONOS_CLIENT_SHM_PREFIX      "shm:"
+
 typedef void *CHRONOS_CONN_H;
 
+/*---------------------------------------------------------
+ * Socket tuning of a connection, applied every time it
+ * connects. Options that do not apply to the transport are
+ * ignored: the TCP ones on Unix domain sockets, all of them
+ * on shared-memory connections.
+ *-------------------------------------------------------*/
+typedef struct chronosConnOptions_t {
+  /* TCP_NODELAY: small frames go out without waiting
+   * for the ACK of the previous ones */
+  int  noDelay;
+
+  /* TCP_QUICKACK, re-armed by the first read of each
+   * burst of responses: they are acknowledged right
+   * away */
+  int  quickAck;
+
+  /* Non-blocking sends are held back and written out
+   * together by the event loop or chronosClientFlush() */
+  int  cork;
+
+  /* SO_SNDBUF and SO_RCVBUF in bytes, 0 keeps the
+   * kernel's autotuning */
+  int  sendBufSize;
+  int  recvBufSize;
+
+  /* SO_PRIORITY, -1 keeps the default */
+  int  priority;
+
+  /* MSG_ZEROCOPY sends: the kernel reads the frames
+   * straight from the requests, which stay allocated
+   * until it is done with them. Requests must not be
+   * changed or sent again after sending, only freed.
+   * A disconnect waits a little for the kernel to let go
+   * of them, and leaks the ones it still holds.
+   * Falls back to copying if the kernel cannot do it */
+  int  zeroCopy;
+} chronosConnOptions_t;
+
+typedef enum {
+  /* Every request on the wire as soon as possible */
+  CHRONOS_CONN_PROFILE_LATENCY = 0,
+
+  /* Fewer, fuller segments for streams of updates */
+  CHRONOS_CONN_PROFILE_BULK
+} chronosConnProfile_t;
+
+/* Receives a response as soon as it arrives, see
+ * chronosClientCompletionSet() */
+typedef void (*chronosClientCompletionFp_t) (CHRONOS_CONN_H           connH,
+                                             unsigned int             requestId,
+                                             chronosUserTransaction_t txnType,
+                                             int                      txn_rc,
+                                             void                    *arg);
+
+/*---------------------------------------------------------
+ * The outcome of a request sent with chronosClientSubmit().
+ * Completions are queued as responses arrive and picked up
+ * without blocking with chronosClientPollCompletions(), or
+ * chronosEventLoopPollCompletions() for connections in an
+ * event loop.
+ *-------------------------------------------------------*/
+typedef struct chronosCompletion_t {
+  uint64_t                 userTag;
+  CHRONOS_CONN_H           connH;
+  unsigned int             requestId;
+  chronosUserTransaction_t txnType;
+  int                      txn_rc;
+
+  /* From submit until the response arrived */
+  uint64_t                 latencyNs;
+} chronosCompletion_t;
+
+typedef void *CHRONOS_COMPLETION_QUEUE_H;
+
 CHRONOS_ENV_H
 chronosClientEnvGet(CHRONOS_CONN_H connH);
 
 CHRONOS_CONN_H
 chronosConnHandleAlloc(CHRONOS_ENV_H envH);
 
+void
+chronosConnOptionsInit(chronosConnProfile_t  profile,
+                       chronosConnOptions_t *optionsP);
+
+int
+chronosClientOptionsSet(const chronosConnOptions_t *optionsP,
+                        CHRONOS_CONN_H              connH);
+
 int
 chronosConnHandleFree(CHRONOS_CONN_H connH);
 
+/* serverAddress is an IPv4 address, or for a server on
+ * the same host (serverPort is then ignored):
+ *  - "unix:<path>", a Unix domain socket. A path starting
+ *    with '@' is in the abstract namespace
+ *  - "shm:<name>", a shared-memory segment, see
+ *    chronos_shm.h. These connections cannot be added to
+ *    an event loop */
 int
 chronosClientConnect(const char *serverAddress,
                      int serverPort,
                      const char *connName,
                      CHRONOS_CONN_H connH);
 
+int
+chronosClientConnectWithOptions(const char                 *serverAddress,
+                                int                         serverPort,
+                                const char                 *connName,
+                                const chronosConnOptions_t *optionsP,
+                                CHRONOS_CONN_H              connH);
+
+int
+chronosClientConnectStart(const char *serverAddress,
+                          int serverPort,
+                          const char *connName,
+                          CHRONOS_CONN_H connH);
+
+int
+chronosClientConnectFinish(CHRONOS_CONN_H connH);
+
 int
 chronosClientDisconnect(CHRONOS_CONN_H connH);
 
@@ -28,9 +154,119 @@ int
 chronosClientSendRequest(CHRONOS_REQUEST_H    requestH,
                          CHRONOS_CONN_H connH);
 
+int
+chronosClientSendRequests(CHRONOS_REQUEST_H *requestArr,
+                          int                numRequests,
+                          CHRONOS_CONN_H     connH);
+
+int
+chronosClientSendRequestsNoWait(CHRONOS_REQUEST_H *requestArr,
+                                int                numRequests,
+                                CHRONOS_CONN_H     connH);
+
+int
+chronosClientFlush(CHRONOS_CONN_H connH);
+
+size_t
+chronosClientSendPendingGet(CHRONOS_CONN_H connH);
+
+int
+chronosClientSendLimitSet(size_t         sendLimit,
+                          CHRONOS_CONN_H connH);
+
+size_t
+chronosClientSendLimitGet(CHRONOS_CONN_H connH);
+
+int
+chronosClientSendWait(int            timeoutMs,
+                      CHRONOS_CONN_H connH);
+
 int
 chronosClientReceiveResponse(int *txn_rc_ret, 
                              CHRONOS_CONN_H connH, 
                              int (*isTimeToDieFp) (void));
 
+int
+chronosClientReceiveResponseById(unsigned int requestId,
+                                 int *txn_rc_ret, 
+                                 CHRONOS_CONN_H connH, 
+                                 int (*isTimeToDieFp) (void));
+
+int
+chronosClientReceiveResponseAny(unsigned int  *requestIdP,
+                                int           *txn_rc_ret,
+                                int            timeoutUs,
+                                CHRONOS_CONN_H connH);
+
+int
+chronosClientIsConnected(CHRONOS_CONN_H connH);
+
+int
+chronosClientNumInFlightGet(CHRONOS_CONN_H connH);
+
+int
+chronosClientWindowFreeGet(CHRONOS_CONN_H connH);
+
+int
+chronosClientZeroCopyStatsGet(uint64_t      *numSendsP,
+                              uint64_t      *numCopiedP,
+                              CHRONOS_CONN_H connH);
+
+int
+chronosClientDeadlineStatsGet(uint64_t      *numMetP,
+                              uint64_t      *numMissedP,
+                              CHRONOS_CONN_H connH);
+
+CHRONOS_RESPONSE_H
+chronosClientLastResponseGet(CHRONOS_CONN_H connH);
+
+CHRONOS_COMPLETION_QUEUE_H
+chronosCompletionQueueAlloc(void);
+
+int
+chronosCompletionQueueFree(CHRONOS_COMPLETION_QUEUE_H queueH);
+
+int
+chronosCompletionQueuePop(chronosCompletion_t       *completionArr,
+                          int                        maxCompletions,
+                          int                       *numCompletionsP,
+                          CHRONOS_COMPLETION_QUEUE_H queueH);
+
+int
+chronosClientCompletionQueueSet(CHRONOS_COMPLETION_QUEUE_H queueH,
+                                CHRONOS_CONN_H             connH);
+
+int
+chronosClientSubmit(CHRONOS_REQUEST_H requestH,
+                    CHRONOS_CONN_H    connH,
+                    uint64_t          userTag);
+
+int
+chronosClientPollCompletions(chronosCompletion_t *completionArr,
+                             int                  maxCompletions,
+                             int                 *numCompletionsP,
+                             CHRONOS_CONN_H       connH);
+
+int
+chronosClientInterrupt(CHRONOS_CONN_H connH);
+
+int
+chronosClientCompletionSet(chronosClientCompletionFp_t completionFp,
+                           void                       *completionArg,
+                           CHRONOS_CONN_H              connH);
+
+int
+chronosClientEpollAttach(int            epollFd,
+                         CHRONOS_CONN_H connH);
+
+int
+chronosClientEpollDetach(CHRONOS_CONN_H connH);
+
+int
+chronosClientInputProcess(CHRONOS_CONN_H connH);
+
+int
+chronosClientEventsHandle(uint32_t       events,
+                          CHRONOS_CONN_H connH);
+
 #endif
@@ -0,0 +1,60 @@
+#ifndef _CHRONOS_DISTRIBUTION_H_
+#define _CHRONOS_DISTRIBUTION_H_
+
+#include "chronos_random.h"
+
+/*---------------------------------------------------------
+ * Key distributions used to pick users and symbols when
+ * generating requests. Keys are in [0, numKeys); for the
+ * skewed distributions key 0 is the hottest one.
+ *-------------------------------------------------------*/
+typedef enum chronosKeyDistType_t {
+  CHRONOS_KEY_DIST_UNIFORM = 0,
+  CHRONOS_KEY_DIST_ZIPF,
+  CHRONOS_KEY_DIST_HOTSET,
+  CHRONOS_KEY_DIST_LATEST
+} chronosKeyDistType_t;
+
+typedef void *CHRONOS_KEY_DIST_H;
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistUniformAlloc(int numKeys);
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistZipfAlloc(int    numKeys,
+                        double theta);
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistHotSetAlloc(int    numKeys,
+                          double hotAccessFraction,
+                          double hotKeyFraction);
+
+CHRONOS_KEY_DIST_H
+chronosKeyDistLatestAlloc(int    numKeys,
+                          double theta);
+
+int
+chronosKeyDistFree(CHRONOS_KEY_DIST_H distH);
+
+chronosKeyDistType_t
+chronosKeyDistTypeGet(CHRONOS_KEY_DIST_H distH);
+
+int
+chronosKeyDistNumKeysGet(CHRONOS_KEY_DIST_H distH);
+
+int
+chronosKeyDistLatestSet(int                key,
+                        CHRONOS_KEY_DIST_H distH);
+
+int
+chronosKeyDistSample(CHRONOS_KEY_DIST_H  distH,
+                     chronosRandom_t    *randP);
+
+int
+chronosKeyDistFill(unsigned int       *valuesArr,
+                   int                 numValues,
+                   unsigned int        bound,
+                   CHRONOS_KEY_DIST_H  distH,
+                   chronosRandom_t    *randP);
+
+#endif
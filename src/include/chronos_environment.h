@@ -7,7 +7,8 @@ typedef void *CHRONOS_ENV_H;
 
 extern CHRONOS_ENV_H
 chronosEnvAlloc(const char *homedir, 
-                const char *datafilesdir);
+                const char *datafilesdir,
+                int         numSymbols);
 
 extern int
 chronosEnvFree(CHRONOS_ENV_H envH);
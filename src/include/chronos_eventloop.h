@@ -0,0 +1,94 @@
+#ifndef _CHRONOS_EVENTLOOP_H_
+#define _CHRONOS_EVENTLOOP_H_
+
+#include "chronos_client.h"
+
+/*---------------------------------------------------------
+ * An event loop that drives many connections from a
+ * single thread. Connections added to the loop are
+ * serviced without blocking: pending connects complete,
+ * queued requests are written as the sockets drain, and
+ * responses go to each connection's completion callback
+ * (see chronosClientCompletionSet()).
+ *
+ * Requests are sent on loop connections with
+ * chronosClientSendRequestsNoWait(), typically from the
+ * completion callbacks themselves. A connection whose
+ * socket cannot keep up refuses them with CHRONOS_AGAIN
+ * until the loop has written out its backlog. To drop a
+ * connection, disconnect it and then remove it from the
+ * loop; a callback may do so for any of the loop's
+ * connections, whose pending events are then ignored, but
+ * must not free one before the current round returns.
+ *
+ * Alternatively requests are submitted with
+ * chronosClientSubmit() and their completions, from all
+ * the loop's connections, collected with
+ * chronosEventLoopPollCompletions().
+ *
+ * The loop runs on epoll by default. With the io_uring
+ * engine the loop does the socket I/O itself: each round
+ * submits all the sends and receives queued since the
+ * previous one with a single system call, and responses
+ * land in buffers registered with the kernel. Blocking
+ * calls on its connections fail, and a connection must
+ * be disconnected before it is removed.
+ *-------------------------------------------------------*/
+typedef void *CHRONOS_EVENT_LOOP_H;
+
+typedef enum chronosEventLoopEngine_t {
+  CHRONOS_EVENT_LOOP_EPOLL = 0,
+  CHRONOS_EVENT_LOOP_URING
+} chronosEventLoopEngine_t;
+
+/* Called when a connection fails. By then the connection
+ * has been removed from the loop and disconnected */
+typedef void (*chronosEventLoopErrorFp_t) (CHRONOS_CONN_H connH,
+                                           void          *arg);
+
+CHRONOS_EVENT_LOOP_H
+chronosEventLoopAlloc(chronosEventLoopErrorFp_t  errorFp,
+                      void                      *errorArg);
+
+CHRONOS_EVENT_LOOP_H
+chronosEventLoopAllocWithEngine(chronosEventLoopEngine_t   engine,
+                                chronosEventLoopErrorFp_t  errorFp,
+                                void                      *errorArg);
+
+chronosEventLoopEngine_t
+chronosEventLoopEngineGet(CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopFree(CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopAdd(CHRONOS_CONN_H       connH,
+                    CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopRemove(CHRONOS_CONN_H       connH,
+                       CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopNumConnsGet(CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopRunOnce(int                  timeoutMs,
+                        int                 *numEventsP,
+                        CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopRun(int                  (*isTimeToDieFp) (void),
+                    CHRONOS_EVENT_LOOP_H   loopH);
+
+int
+chronosEventLoopInterrupt(CHRONOS_EVENT_LOOP_H loopH);
+
+int
+chronosEventLoopPollCompletions(chronosCompletion_t  *completionArr,
+                                int                   maxCompletions,
+                                int                  *numCompletionsP,
+                                int                   timeoutMs,
+                                CHRONOS_EVENT_LOOP_H  loopH);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _CHRONOS_HISTOGRAM_H_
+#define _CHRONOS_HISTOGRAM_H_
+
+#include <stdint.h>
+#include "chronos_transactions.h"
+
+/*---------------------------------------------------------
+ * Log-linear latency histograms, in the spirit of HDR
+ * histograms. Values below 2^SUB_BITS get a bucket each;
+ * above that every power of two is split in 2^SUB_BITS
+ * equal buckets, which keeps the relative error of any
+ * reported value under ~3%. Values are in nanoseconds and
+ * anything above 2^MAX_BITS (~18 minutes) lands in the
+ * last bucket.
+ *-------------------------------------------------------*/
+#define CHRONOS_HIST_SUB_BITS     (5)
+#define CHRONOS_HIST_MAX_BITS     (40)
+#define CHRONOS_HIST_NUM_BUCKETS  ((CHRONOS_HIST_MAX_BITS - CHRONOS_HIST_SUB_BITS + 1) << CHRONOS_HIST_SUB_BITS)
+
+typedef struct chronosHistogram_t {
+  uint64_t  count;
+  uint64_t  sumNs;
+  uint64_t  minNs;
+  uint64_t  maxNs;
+  uint64_t  bucketArr[CHRONOS_HIST_NUM_BUCKETS];
+} chronosHistogram_t;
+
+void
+chronosHistogramReset(chronosHistogram_t *histP);
+
+void
+chronosHistogramRecord(uint64_t            valueNs,
+                       chronosHistogram_t *histP);
+
+void
+chronosHistogramMerge(chronosHistogram_t       *dstP,
+                      const chronosHistogram_t *srcP);
+
+uint64_t
+chronosHistogramPercentileGet(double                    percentile,
+                              const chronosHistogram_t *histP);
+
+double
+chronosHistogramMeanGet(const chronosHistogram_t *histP);
+
+/*---------------------------------------------------------
+ * Where the client library spends time on a transaction:
+ *  - PACK: building the request (chronosRequestCreate*)
+ *  - SEND: encoding it and handing it to the socket
+ *  - WAIT: from the end of the send until its response
+ *          has been collected
+ *
+ * Every thread records into its own set of histograms, so
+ * recording takes no lock. chronosLatencySnapshotGet()
+ * merges the sets of all threads, including the ones that
+ * already exited.
+ *-------------------------------------------------------*/
+typedef enum chronosLatencyPhase_t {
+  CHRONOS_LATENCY_PACK = 0,
+  CHRONOS_LATENCY_SEND,
+  CHRONOS_LATENCY_WAIT,
+  CHRONOS_LATENCY_PHASE_MAX
+} chronosLatencyPhase_t;
+
+/* User transactions plus the stock update */
+#define CHRONOS_LATENCY_NUM_TXN_TYPES   (CHRONOS_SYS_TXN_UPDATE_STOCK + 1)
+
+/* Big (over 100KB): allocate it, do not put it on the stack */
+typedef struct chronosLatencySnapshot_t {
+  chronosHistogram_t  histArr[CHRONOS_LATENCY_PHASE_MAX][CHRONOS_LATENCY_NUM_TXN_TYPES];
+} chronosLatencySnapshot_t;
+
+extern const char *chronos_latency_phase_str[];
+
+uint64_t
+chronosLatencyNowNs(void);
+
+void
+chronosLatencyRecord(chronosUserTransaction_t txnType,
+                     chronosLatencyPhase_t    phase,
+                     uint64_t                 latencyNs);
+
+int
+chronosLatencySnapshotGet(chronosLatencySnapshot_t *snapshotP);
+
+int
+chronosLatencyReset(void);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _CHRONOS_LOADGEN_H_
+#define _CHRONOS_LOADGEN_H_
+
+#include <stdint.h>
+#include "chronos_client.h"
+#include "chronos_cache.h"
+
+/*---------------------------------------------------------
+ * Open-loop load generator. Requests are sent at a target
+ * arrival rate, independently of when responses come back,
+ * and latency is measured from the time each request was
+ * scheduled to go out (not from when it actually did).
+ * That way queueing delay on the client side shows up in
+ * the latency numbers instead of silently lowering the
+ * offered load.
+ *-------------------------------------------------------*/
+typedef enum chronosArrivalType_t {
+  CHRONOS_ARRIVAL_CONSTANT = 0,
+  CHRONOS_ARRIVAL_POISSON
+} chronosArrivalType_t;
+
+typedef struct chronosLoadGenConfig_t {
+  chronosArrivalType_t  arrivalType;
+
+  /* Target arrival rate, in requests per second */
+  double                ratePerSec;
+
+  /* Max requests in flight, up to CHRONOS_CLIENT_MAX_INFLIGHT.
+   * Zero means CHRONOS_CLIENT_MAX_INFLIGHT */
+  int                   maxInFlight;
+
+  /* Data items per request, zero means random */
+  int                   numDataItems;
+
+  /* Deadline of each request, relative to its scheduled
+   * send time (zero means none), and its priority */
+  uint64_t              relativeDeadlineNs;
+  int                   priority;
+
+  /* Relative weight of each transaction type.
+   * All zeroes means a uniform mix */
+  int                   txnWeightArr[CHRONOS_USER_TXN_MAX];
+
+  /* Called for every response collected, can be NULL */
+  void                (*completeFp) (chronosUserTransaction_t txnType,
+                                     int                      txn_rc,
+                                     uint64_t                 latencyNs,
+                                     void                    *arg);
+  void                 *completeArg;
+} chronosLoadGenConfig_t;
+
+typedef struct chronosLoadGenStats_t {
+  uint64_t  numSent;
+  uint64_t  numCompleted;
+  uint64_t  numTxnFailed;
+
+  /* Latency measured from the intended send time */
+  uint64_t  latencySumNs;
+  uint64_t  latencyMaxNs;
+
+  /* Requests with a deadline that completed after it */
+  uint64_t  numDeadlineMissed;
+
+  /* How far behind schedule requests went out, and how
+   * many times sending stalled on a full window */
+  uint64_t  sendLagMaxNs;
+  uint64_t  numWindowFull;
+
+  uint64_t  elapsedNs;
+} chronosLoadGenStats_t;
+
+typedef void *CHRONOS_LOADGEN_H;
+
+CHRONOS_LOADGEN_H
+chronosLoadGenAlloc(const chronosLoadGenConfig_t *configP,
+                    CHRONOS_CONN_H                connH,
+                    CHRONOS_CLIENT_CACHE_H        clientCacheH);
+
+int
+chronosLoadGenFree(CHRONOS_LOADGEN_H loadGenH);
+
+int
+chronosLoadGenRun(uint64_t          numRequests,
+                  int               durationMs,
+                  int             (*isTimeToDieFp) (void),
+                  CHRONOS_LOADGEN_H loadGenH);
+
+int
+chronosLoadGenStatsGet(chronosLoadGenStats_t *statsP,
+                       CHRONOS_LOADGEN_H      loadGenH);
+
+#endif
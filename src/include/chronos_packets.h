@@ -5,19 +5,46 @@
 #include "chronos_cache.h"
 #include "chronos_environment.h"
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define CHRONOS_REQUEST_PACKET_SIZE (100)
 
 typedef struct chronosResponsePacket_t {
+  /* Echo of the requestId of the request being answered */
+  unsigned int requestId;
+
   chronosUserTransaction_t txn_type;
   int rc;
 } chronosResponsePacket_t;
 
+/*---------------------------------------------------------
+ * On the wire a request is framed as the fixed header of
+ * chronosRequestPacket_t (everything before request_data),
+ * followed by only the first numItems entries of the
+ * type-specific array. The frame starts with its own total
+ * length, so a reader can pull it off a byte stream.
+ *-------------------------------------------------------*/
 typedef struct chronosRequestPacket_t {
+  /* Length in bytes of the encoded frame, header included */
+  int length;
+
   int magic;
 
+  /* Assigned by the client connection when the request is
+   * sent; the server echoes it back in the response */
+  unsigned int requestId;
+
   chronosUserTransaction_t txn_type;
 
+  /* Real-time attributes, so the server can schedule by
+   * deadline (e.g. EDF). Times are absolute, in ns of
+   * chronosRequestTimeNowNs(). A deadline of 0 means the
+   * request has none; a higher priority is more critical */
+  uint64_t createdNs;
+  uint64_t deadlineNs;
+  int priority;
+
   /* A transaction can affect up to 100 symbols */
   int numItems;
   union {
@@ -28,12 +55,18 @@ typedef struct chronosRequestPacket_t {
     chronosUpdateStockInfo_t   updateInfo[CHRONOS_REQUEST_PACKET_SIZE];
   } request_data;
 
+  /* Holders of the packet besides whoever created it, see
+   * chronosRequestRetain(). Not part of the frame */
+  int refCount;
+
 } chronosRequestPacket_t;
 
 #define CHRONOS_REQUEST_MAGIC                    (0xDEAF)
 #define CHRONOS_REQUEST_MAGIC_CHECK(requestP)    assert((requestP)->magic == CHRONOS_REQUEST_MAGIC)
 #define CHRONOS_REQUEST_MAGIC_SET(requestP)      (requestP)->magic = CHRONOS_REQUEST_MAGIC
 
+#define CHRONOS_REQUEST_HEADER_SIZE              (offsetof(chronosRequestPacket_t, request_data))
+
 typedef void *CHRONOS_REQUEST_H;
 typedef void *CHRONOS_RESPONSE_H;
 
@@ -60,12 +93,60 @@ chronosRequestCreateForClient(int user_idx,
 int
 chronosRequestFree(CHRONOS_REQUEST_H requestH);
 
+int
+chronosRequestRetain(CHRONOS_REQUEST_H requestH);
+
 chronosUserTransaction_t
 chronosRequestTypeGet(CHRONOS_REQUEST_H requestH);
 
+unsigned int
+chronosRequestIdGet(CHRONOS_REQUEST_H requestH);
+
+int
+chronosRequestIdSet(unsigned int      requestId,
+                    CHRONOS_REQUEST_H requestH);
+
+uint64_t
+chronosRequestTimeNowNs(void);
+
+uint64_t
+chronosRequestCreatedGet(CHRONOS_REQUEST_H requestH);
+
+uint64_t
+chronosRequestDeadlineGet(CHRONOS_REQUEST_H requestH);
+
+int
+chronosRequestDeadlineSet(uint64_t          deadlineNs,
+                          CHRONOS_REQUEST_H requestH);
+
+int
+chronosRequestPriorityGet(CHRONOS_REQUEST_H requestH);
+
+int
+chronosRequestPrioritySet(int               priority,
+                          CHRONOS_REQUEST_H requestH);
+
 size_t
 chronosRequestSizeGet(CHRONOS_REQUEST_H requestH);
 
+size_t
+chronosRequestItemSizeGet(chronosUserTransaction_t txnType);
+
+int
+chronosRequestEncode(CHRONOS_REQUEST_H requestH,
+                     const char      **frameP,
+                     size_t           *frameSizeP);
+
+size_t
+chronosRequestFrameSizeGet(const char *buf,
+                           size_t      bufSize);
+
+int
+chronosRequestDecode(const char        *buf,
+                     size_t             bufSize,
+                     CHRONOS_REQUEST_H  requestH,
+                     size_t            *consumedP);
+
 CHRONOS_RESPONSE_H
 chronosResponseAlloc();
 
@@ -80,4 +161,7 @@ chronosResponseTypeGet(CHRONOS_RESPONSE_H responseH);
 
 int
 chronosResponseResultGet(CHRONOS_RESPONSE_H responseH);
+
+unsigned int
+chronosResponseRequestIdGet(CHRONOS_RESPONSE_H responseH);
 #endif
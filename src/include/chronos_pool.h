@@ -0,0 +1,77 @@
+#ifndef _CHRONOS_POOL_H_
+#define _CHRONOS_POOL_H_
+
+#include <stdint.h>
+#include "chronos_client.h"
+
+/*---------------------------------------------------------
+ * A pool of connections to one Chronos Server, driven by a
+ * single thread. Each request submitted to the pool goes
+ * to the connected connection with the fewest requests in
+ * flight.
+ *
+ * A connection that fails is dropped without affecting the
+ * others. Its in-flight requests complete with CHRONOS_FAIL
+ * and it is reconnected in the background with exponential
+ * backoff (plus some jitter, so that a pool does not storm
+ * a restarting server). Completions come back through
+ * chronosPoolPollCompletions(), which is also what drives
+ * the reconnects.
+ *
+ * This is how a pool rides out a server restart: writes
+ * to the reset sockets fail with EPIPE (the library never
+ * raises SIGPIPE), the requests in flight on them complete
+ * with CHRONOS_FAIL, chronosPoolSubmit() returns
+ * CHRONOS_TIMEOUT while no connection is up, and each
+ * dropped connection keeps retrying until the server
+ * listens again. No signal handling is needed in the
+ * application.
+ *
+ * Shared-memory ("shm:") servers cannot be pooled, their
+ * connections do not fit in an event loop.
+ *-------------------------------------------------------*/
+typedef void *CHRONOS_POOL_H;
+
+/* Delay before the first reconnect attempt, doubled on
+ * every failure up to the max */
+#define CHRONOS_POOL_BACKOFF_MIN_NS   (10ULL * 1000 * 1000)
+#define CHRONOS_POOL_BACKOFF_MAX_NS   (5ULL * 1000 * 1000 * 1000)
+
+typedef struct chronosPoolStats_t {
+  uint64_t  numSubmitted;
+  uint64_t  numConnFailures;
+  uint64_t  numReconnects;
+} chronosPoolStats_t;
+
+CHRONOS_POOL_H
+chronosPoolAlloc(int            numConns,
+                 const char    *serverAddress,
+                 int            serverPort,
+                 CHRONOS_ENV_H  envH);
+
+int
+chronosPoolFree(CHRONOS_POOL_H poolH);
+
+int
+chronosPoolSubmit(CHRONOS_REQUEST_H requestH,
+                  uint64_t          userTag,
+                  CHRONOS_POOL_H    poolH);
+
+int
+chronosPoolPollCompletions(chronosCompletion_t *completionArr,
+                           int                  maxCompletions,
+                           int                 *numCompletionsP,
+                           int                  timeoutMs,
+                           CHRONOS_POOL_H       poolH);
+
+int
+chronosPoolInterrupt(CHRONOS_POOL_H poolH);
+
+int
+chronosPoolNumConnectedGet(CHRONOS_POOL_H poolH);
+
+int
+chronosPoolStatsGet(chronosPoolStats_t *statsP,
+                    CHRONOS_POOL_H      poolH);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _CHRONOS_RANDOM_H_
+#define _CHRONOS_RANDOM_H_
+
+#include <stdint.h>
+
+/*---------------------------------------------------------
+ * A small, seedable pseudo-random generator
+ * (xoshiro256**). Each client thread carries its own state,
+ * so threads never contend on a shared lock the way they
+ * do with rand(), and every thread's stream can be
+ * reproduced from its seed.
+ *-------------------------------------------------------*/
+typedef struct chronosRandom_t {
+  uint64_t s[4];
+} chronosRandom_t;
+
+/* Maps a raw 32-bit random value onto [0, _bound) */
+#define CHRONOS_RANDOM_BOUND(_raw, _bound) \
+  ((unsigned int) (((uint64_t) (_raw) * (uint32_t) (_bound)) >> 32))
+
+void
+chronosRandomSeed(uint64_t         seed,
+                  chronosRandom_t *randP);
+
+uint64_t
+chronosRandomNext(chronosRandom_t *randP);
+
+unsigned int
+chronosRandomRange(unsigned int     bound,
+                   chronosRandom_t *randP);
+
+double
+chronosRandomDouble(chronosRandom_t *randP);
+
+void
+chronosRandomFill(unsigned int    *valuesArr,
+                  int              numValues,
+                  unsigned int     bound,
+                  chronosRandom_t *randP);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _CHRONOS_SHM_H_
+#define _CHRONOS_SHM_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/*---------------------------------------------------------
+ * Shared-memory transport for a client and a server on the
+ * same host. A POSIX shared-memory segment holds two
+ * single-producer single-consumer byte rings: requests
+ * flow from the client to the server on one, responses
+ * flow back on the other. The frames are the same ones
+ * that go over a socket.
+ *
+ * Moving data takes no system call: each side publishes
+ * what it wrote with a release store of its ring index.
+ * A side with nothing to do spins briefly and then sleeps
+ * on a futex in the segment. The other side rings that
+ * futex only when it knows a waiter is there.
+ *
+ * The server creates the segment and the client attaches
+ * to it by name. A segment serves one client at a time;
+ * the next one reclaims it if that client died attached.
+ * Client connections select this transport with a server
+ * address of the form "shm:<name>" (see
+ * chronosClientConnect()).
+ *-------------------------------------------------------*/
+typedef void *CHRONOS_SHM_H;
+
+/* Default size of each ring, must be a power of two */
+#define CHRONOS_SHM_RING_SIZE   (256 * 1024)
+
+CHRONOS_SHM_H
+chronosShmCreate(const char *name,
+                 size_t      ringSize);
+
+CHRONOS_SHM_H
+chronosShmAttach(const char *name);
+
+int
+chronosShmClose(CHRONOS_SHM_H shmH);
+
+ssize_t
+chronosShmWritev(const struct iovec *iov,
+                 int                 iovcnt,
+                 CHRONOS_SHM_H       shmH);
+
+ssize_t
+chronosShmRead(void          *buf,
+               size_t         len,
+               CHRONOS_SHM_H  shmH);
+
+int
+chronosShmWait(short                  events,
+               const struct timespec *timeoutP,
+               short                 *reventsP,
+               CHRONOS_SHM_H          shmH);
+
+int
+chronosShmWake(CHRONOS_SHM_H shmH);
+
+/*---------------------------------------------------------
+ * A stand-in server for tests and benchmarks of the client
+ * side. It runs in a thread of its own, answers every
+ * request with CHRONOS_SUCCESS, and takes a new client as
+ * soon as the previous one detached.
+ *-------------------------------------------------------*/
+typedef void *CHRONOS_SHM_LOOPBACK_H;
+
+CHRONOS_SHM_LOOPBACK_H
+chronosShmLoopbackStart(const char *name,
+                        size_t      ringSize);
+
+int
+chronosShmLoopbackStop(CHRONOS_SHM_LOOPBACK_H loopbackH);
+
+#endif
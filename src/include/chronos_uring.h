@@ -0,0 +1,114 @@
+#ifndef _CHRONOS_URING_H_
+#define _CHRONOS_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chronos_client.h"
+
+/*---------------------------------------------------------
+ * A thin io_uring wrapper, on top of the raw system calls,
+ * for the io_uring engine of the event loop (see
+ * chronos_eventloop.h).
+ *
+ * Operations are prepared into the submission ring and
+ * only handed to the kernel, all together, by the next
+ * chronosUringWait(). That same call picks up their
+ * completions.
+ *
+ * Receives pick their buffer from a ring of
+ * CHRONOS_URING_NUM_RECV_BUFS buffers registered with the
+ * kernel, and keep delivering (multishot) until they fail
+ * or are cancelled. A buffer goes back to the ring with
+ * chronosUringRecvBufPut() once its data was consumed.
+ *
+ * chronosUringAlloc() returns NULL if the kernel, or the
+ * headers this was built with, lack any of this: callers
+ * fall back to epoll.
+ *
+ * This header is internal to the library and not
+ * installed.
+ *-------------------------------------------------------*/
+typedef void *CHRONOS_URING_H;
+
+#define CHRONOS_URING_NUM_RECV_BUFS   (256)
+#define CHRONOS_URING_RECV_BUF_SIZE   (4 * 1024)
+
+typedef struct chronosUringCompletion_t {
+  uint64_t  userData;
+  int       res;
+  uint32_t  flags;
+} chronosUringCompletion_t;
+
+CHRONOS_URING_H
+chronosUringAlloc(unsigned int numEntries);
+
+int
+chronosUringFree(CHRONOS_URING_H uringH);
+
+int
+chronosUringSendPrep(int             fd,
+                     const void     *buf,
+                     size_t          len,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH);
+
+int
+chronosUringRecvPrep(int             fd,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH);
+
+int
+chronosUringPollPrep(int             fd,
+                     short           events,
+                     int             isMultishot,
+                     uint64_t        userData,
+                     CHRONOS_URING_H uringH);
+
+int
+chronosUringCancelPrep(uint64_t        targetUserData,
+                       CHRONOS_URING_H uringH);
+
+int
+chronosUringWait(int                       timeoutMs,
+                 chronosUringCompletion_t *completionArr,
+                 int                       maxCompletions,
+                 int                      *numCompletionsP,
+                 CHRONOS_URING_H           uringH);
+
+int
+chronosUringCompletionIsLast(const chronosUringCompletion_t *completionP);
+
+int
+chronosUringRecvBufIdGet(const chronosUringCompletion_t *completionP,
+                         unsigned int                   *bufIdP);
+
+const char *
+chronosUringRecvBufGet(unsigned int    bufId,
+                       CHRONOS_URING_H uringH);
+
+int
+chronosUringRecvBufPut(unsigned int    bufId,
+                       CHRONOS_URING_H uringH);
+
+int
+chronosUringRecvMultishotDisable(CHRONOS_URING_H uringH);
+
+int
+chronosUringRecvIsMultishot(CHRONOS_URING_H uringH);
+
+int
+chronosUringNumPendingGet(CHRONOS_URING_H uringH);
+
+/* The connection side of the engine, see chronos_client.c */
+int
+chronosClientUringAttach(CHRONOS_URING_H uringH,
+                         CHRONOS_CONN_H  connH);
+
+int
+chronosClientUringDetach(CHRONOS_CONN_H connH);
+
+int
+chronosClientUringComplete(const chronosUringCompletion_t *completionP,
+                           CHRONOS_CONN_H                 *connHP);
+
+#endif